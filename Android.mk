@@ -75,7 +75,13 @@ LOCAL_SRC_FILES := \
     openrecoveryscript.cpp \
     tarWrite.c \
     twrpAdbBuFifo.cpp \
-    twrpRepacker.cpp
+    twrpRepacker.cpp \
+    twrpProfiler.cpp \
+    twrpRemover.cpp \
+    twrpFormatter.cpp \
+    twrpExec.cpp \
+    twrpWarmup.cpp \
+    twrpBackupCatalog.cpp
 
 ifeq ($(TW_EXCLUDE_APEX),)
     LOCAL_SRC_FILES += twrpApex.cpp
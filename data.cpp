@@ -23,6 +23,9 @@
 #include <time.h>
 #include <string>
 #include <sstream>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include <fstream>
 #include <cctype>
 #include <cutils/properties.h>
@@ -53,6 +56,54 @@ extern "C"
 
 #define FILE_VERSION 0x00010010	// Do not set to 0
 
+// Interned variables live in chunks that are never moved or freed, so a
+// slot can be read without locking once its id has been handed out
+#define VAR_CHUNK_SHIFT 8
+#define VAR_CHUNK_SIZE (1 << VAR_CHUNK_SHIFT)
+#define VAR_MAX_CHUNKS 64
+
+enum VarKind {
+  VAR_STORED,   // lives in mConst, mPersist or mData
+  VAR_MAGIC,    // computed by GetMagicValue, falls back to the stored value
+  VAR_PROPERTY  // "property.*", read from the system properties
+};
+
+struct VarSlot {
+  string name;
+  VarKind kind;
+  // The values below are current while this matches var_generation
+  std::atomic<unsigned> generation;
+  std::atomic<bool> exists;
+  std::atomic<int> int_value;
+  std::atomic<unsigned long long> u64_value;
+  std::shared_ptr<const string> str_value; // only through std::atomic_load/atomic_store
+  std::atomic<unsigned> version; // bumped when the value or its existence changes
+
+  VarSlot() : kind(VAR_STORED), generation(0), exists(false), int_value(0), u64_value(0), version(0) {}
+};
+
+static std::atomic<VarSlot*> var_chunks[VAR_MAX_CHUNKS];
+static std::atomic<int> var_count(0);
+static std::atomic<unsigned> var_generation(1);
+static std::unordered_map<string, int> var_index;
+static pthread_rwlock_t var_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static VarSlot* var_slot(int varId)
+{
+  if (varId < 0 || varId >= var_count.load(std::memory_order_acquire))
+    return NULL;
+  return &var_chunks[varId >> VAR_CHUNK_SHIFT].load(std::memory_order_acquire)[varId & (VAR_CHUNK_SIZE - 1)];
+}
+
+static int var_find(const string& varName)
+{
+  pthread_rwlock_rdlock(&var_index_lock);
+  std::unordered_map<string, int>::const_iterator it = var_index.find(varName);
+  int varId = it != var_index.end() ? it->second : -1;
+  pthread_rwlock_unlock(&var_index_lock);
+  return varId;
+}
+
 using namespace std;
 
 string DataManager::mBackingFile;
@@ -243,6 +294,7 @@ int DataManager::ResetDefaults()
   mPersist.Clear();
   mData.Clear();
   mConst.Clear();
+  InvalidateVars();
   pthread_mutex_unlock(&m_valuesLock);
 
   SetDefaultValues();
@@ -265,6 +317,7 @@ int DataManager::LoadValues(const string & filename)
   // Read in the file, if possible
   pthread_mutex_lock(&m_valuesLock);
   mPersist.LoadValues();
+  InvalidateVars();
 
 #ifndef TW_NO_SCREEN_TIMEOUT
   blankTimer.setTime(mPersist.GetIntValue("tw_screen_timeout_secs"));
@@ -340,6 +393,7 @@ int DataManager::LoadPersistValues(void)
   // Read in the file, if possible
   pthread_mutex_lock(&m_valuesLock);
   mPersist.LoadValues();
+  InvalidateVars();
 
 #ifndef TW_NO_SCREEN_TIMEOUT
   blankTimer.setTime(mPersist.GetIntValue("tw_screen_timeout_secs"));
@@ -407,13 +461,9 @@ int DataManager::SaveValues()
   return 0;
 }
 
-int DataManager::GetValue(const string & varName, string & value)
+int DataManager::GetVarId(const string & varName)
 {
   string localStr = varName;
-  int ret = 0;
-
-  if (!mInitialized)
-    SetDefaultValues();
 
   // Strip off leading and trailing '%' if provided
   if (localStr.length() > 2 && localStr[0] == '%'
@@ -422,37 +472,233 @@ int DataManager::GetValue(const string & varName, string & value)
       localStr.erase(0, 1);
       localStr.erase(localStr.length() - 1, 1);
     }
+  if (localStr.empty())
+    return -1;
+
+  int varId = var_find(localStr);
+  if (varId >= 0)
+    return varId;
+
+  pthread_rwlock_wrlock(&var_index_lock);
+  std::unordered_map<string, int>::const_iterator it = var_index.find(localStr);
+  if (it != var_index.end())
+    {
+      varId = it->second;
+      pthread_rwlock_unlock(&var_index_lock);
+      return varId;
+    }
+
+  varId = var_count.load(std::memory_order_relaxed);
+  int chunk = varId >> VAR_CHUNK_SHIFT;
+  if (chunk >= VAR_MAX_CHUNKS)
+    {
+      pthread_rwlock_unlock(&var_index_lock);
+      return -1;
+    }
+  if (!var_chunks[chunk].load(std::memory_order_relaxed))
+    var_chunks[chunk].store(new VarSlot[VAR_CHUNK_SIZE], std::memory_order_release);
+
+  VarSlot* slot = &var_chunks[chunk].load(std::memory_order_relaxed)[varId & (VAR_CHUNK_SIZE - 1)];
+  slot->name = localStr;
+  if (localStr == "tw_time" || localStr == "tw_cpu_temp" || localStr == "tw_battery" || localStr == "tw_battery_charge")
+    slot->kind = VAR_MAGIC;
+  else if (localStr.length() > 9 && localStr.compare(0, 9, "property.") == 0)
+    slot->kind = VAR_PROPERTY;
+  var_index[localStr] = varId;
+  var_count.store(varId + 1, std::memory_order_release);
+  pthread_rwlock_unlock(&var_index_lock);
+  return varId;
+}
+
+// Looks a name up in the value stores, const values win over persisted ones
+int DataManager::GetStoredValue(const string & varName, string & value)
+{
+  int ret;
+
+  pthread_mutex_lock(&m_valuesLock);
+  ret = mConst.GetValue(varName, value);
+  if (ret != 0)
+    ret = mPersist.GetValue(varName, value);
+  if (ret != 0)
+    ret = mData.GetValue(varName, value);
+  pthread_mutex_unlock(&m_valuesLock);
+  return ret;
+}
+
+void DataManager::RefreshVar(int varId)
+{
+  VarSlot* slot = var_slot(varId);
+  string value;
+
+  pthread_mutex_lock(&m_valuesLock);
+  // Read the generation first, a bulk change during the refresh marks the slot stale again
+  unsigned generation = var_generation.load(std::memory_order_acquire);
+  bool exists = GetStoredValue(slot->name, value) == 0;
+  std::shared_ptr<const string> old = std::atomic_load(&slot->str_value);
+  if (!old || exists != slot->exists.load(std::memory_order_relaxed) || *old != value)
+    slot->version.fetch_add(1, std::memory_order_relaxed);
+  slot->int_value.store(atoi(value.c_str()), std::memory_order_relaxed);
+  slot->u64_value.store(strtoull(value.c_str(), NULL, 10), std::memory_order_relaxed);
+  std::atomic_store(&slot->str_value, std::make_shared<const string>(value));
+  slot->exists.store(exists, std::memory_order_relaxed);
+  slot->generation.store(generation, std::memory_order_release);
+  pthread_mutex_unlock(&m_valuesLock);
+}
+
+// Called with m_valuesLock held after a single value changed
+void DataManager::UpdateVar(const string & varName)
+{
+  int varId = var_find(varName);
+  if (varId >= 0)
+    RefreshVar(varId);
+}
+
+// Called with m_valuesLock held after values changed in bulk
+void DataManager::InvalidateVars()
+{
+  var_generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+int DataManager::GetValue(int varId, string & value)
+{
+  if (!mInitialized)
+    SetDefaultValues();
+
+  VarSlot* slot = var_slot(varId);
+  if (!slot)
+    return -1;
 
   // Handle magic values
-  if (GetMagicValue(localStr, value) == 0)
+  if (slot->kind == VAR_MAGIC && GetMagicValue(slot->name, value) == 0)
     return 0;
 
   // Handle property
-  if (localStr.length() > 9 && localStr.substr(0, 9) == "property.")
+  if (slot->kind == VAR_PROPERTY)
     {
       char property_value[PROPERTY_VALUE_MAX];
-      property_get(localStr.substr(9).c_str(), property_value, "");
+      property_get(slot->name.c_str() + 9, property_value, "");
       value = property_value;
       return 0;
     }
 
-  pthread_mutex_lock(&m_valuesLock);
-  ret = mConst.GetValue(localStr, value);
-  if (ret == 0)
-    goto exit;
+  if (slot->generation.load(std::memory_order_acquire) != var_generation.load(std::memory_order_acquire))
+    RefreshVar(varId);
+  if (!slot->exists.load(std::memory_order_relaxed))
+    return -1;
+  value = *std::atomic_load(&slot->str_value);
+  return 0;
+}
 
-  ret = mPersist.GetValue(localStr, value);
-  if (ret == 0)
-    goto exit;
+int DataManager::GetValue(int varId, int &value)
+{
+  VarSlot* slot = var_slot(varId);
+  if (!slot)
+    return -1;
+  if (slot->kind != VAR_STORED)
+    {
+      string data;
+      if (GetValue(varId, data) != 0)
+	return -1;
+      value = atoi(data.c_str());
+      return 0;
+    }
 
-  ret = mData.GetValue(localStr, value);
-exit:
-  pthread_mutex_unlock(&m_valuesLock);
-  return ret;
+  if (!mInitialized)
+    SetDefaultValues();
+  if (slot->generation.load(std::memory_order_acquire) != var_generation.load(std::memory_order_acquire))
+    RefreshVar(varId);
+  if (!slot->exists.load(std::memory_order_relaxed))
+    return -1;
+  value = slot->int_value.load(std::memory_order_relaxed);
+  return 0;
+}
+
+int DataManager::GetValue(int varId, unsigned long long &value)
+{
+  VarSlot* slot = var_slot(varId);
+  if (!slot)
+    return -1;
+  if (slot->kind != VAR_STORED)
+    {
+      string data;
+      if (GetValue(varId, data) != 0)
+	return -1;
+      value = strtoull(data.c_str(), NULL, 10);
+      return 0;
+    }
+
+  if (!mInitialized)
+    SetDefaultValues();
+  if (slot->generation.load(std::memory_order_acquire) != var_generation.load(std::memory_order_acquire))
+    RefreshVar(varId);
+  if (!slot->exists.load(std::memory_order_relaxed))
+    return -1;
+  value = slot->u64_value.load(std::memory_order_relaxed);
+  return 0;
+}
+
+string DataManager::GetStrValue(int varId)
+{
+  string retVal;
+
+  GetValue(varId, retVal);
+  return retVal;
+}
+
+int DataManager::GetIntValue(int varId)
+{
+  int retVal = 0;
+
+  GetValue(varId, retVal);
+  return retVal;
+}
+
+bool DataManager::IsDynamicVar(int varId)
+{
+  VarSlot* slot = var_slot(varId);
+  return slot && slot->kind != VAR_STORED;
+}
+
+unsigned DataManager::GetVarVersion(int varId)
+{
+  VarSlot* slot = var_slot(varId);
+  if (!slot)
+    return 0;
+
+  if (!mInitialized)
+    SetDefaultValues();
+  if (slot->generation.load(std::memory_order_acquire) != var_generation.load(std::memory_order_acquire))
+    RefreshVar(varId);
+  return slot->version.load(std::memory_order_acquire);
+}
+
+int DataManager::GetValue(const string & varName, string & value)
+{
+  int varId = GetVarId(varName);
+  if (varId >= 0)
+    return GetValue(varId, value);
+
+  // Out of ids, look the name up directly
+  if (!mInitialized)
+    SetDefaultValues();
+  if (GetMagicValue(varName, value) == 0)
+    return 0;
+  if (varName.length() > 9 && varName.compare(0, 9, "property.") == 0)
+    {
+      char property_value[PROPERTY_VALUE_MAX];
+      property_get(varName.c_str() + 9, property_value, "");
+      value = property_value;
+      return 0;
+    }
+  return GetStoredValue(varName, value);
 }
 
 int DataManager::GetValue(const string & varName, int &value)
 {
+  int varId = GetVarId(varName);
+  if (varId >= 0)
+    return GetValue(varId, value);
+
   string data;
 
   if (GetValue(varName, data) != 0)
@@ -475,6 +721,10 @@ int DataManager::GetValue(const string & varName, float &value)
 
 int DataManager::GetValue(const string & varName, unsigned long long &value)
 {
+  int varId = GetVarId(varName);
+  if (varId >= 0)
+    return GetValue(varId, value);
+
   string data;
 
   if (GetValue(varName, data) != 0)
@@ -496,10 +746,10 @@ string DataManager::GetStrValue(const string & varName)
 // This function will return 0 if the value doesn't exist
 int DataManager::GetIntValue(const string & varName)
 {
-  string retVal;
+  int retVal = 0;
 
   GetValue(varName, retVal);
-  return atoi(retVal.c_str());
+  return retVal;
 }
 
 int DataManager::SetValue(const string & varName, const string & value,
@@ -547,6 +797,7 @@ int DataManager::SetValue(const string & varName, const string & value,
 	  mData.SetValue(varName, value);
 	}
     }
+  UpdateVar(varName);
 
   pthread_mutex_unlock(&m_valuesLock);
 
@@ -1293,6 +1544,7 @@ void DataManager::SetDefaultValues()
 	else
 		mConst.SetValue("tw_has_repack_tools", "0");
 
+	InvalidateVars();
 	pthread_mutex_unlock(&m_valuesLock);
 }
 
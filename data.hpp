@@ -47,6 +47,20 @@ public:
 	static string GetStrValue(const string& varName);
 	static int GetIntValue(const string& varName);
 
+	// Interned variables: resolve a name once with GetVarId(), then read it
+	// by id without string compares, map lookups or taking the values lock.
+	// Ids stay valid for the life of the process, -1 means no id is available.
+	static int GetVarId(const string& varName);
+	static int GetValue(int varId, string& value);
+	static int GetValue(int varId, int& value);
+	static int GetValue(int varId, unsigned long long& value);
+	static string GetStrValue(int varId);
+	static int GetIntValue(int varId);
+	// True for values that change without SetValue (time, battery, properties)
+	static bool IsDynamicVar(int varId);
+	// Changes whenever the stored value changes, to cache results derived from it
+	static unsigned GetVarVersion(int varId);
+
 	// Core set routines
 	static int SetValue(const string& varName, const string& value, const int persist = 0);
 	static int SetValue(const string& varName, const int value, const int persist = 0);
@@ -84,6 +98,10 @@ protected:
 	static int SaveValues();
 
 	static int GetMagicValue(const string& varName, string& value);
+	static int GetStoredValue(const string& varName, string& value);
+	static void RefreshVar(int varId);
+	static void UpdateVar(const string& varName);
+	static void InvalidateVars();
 
 private:
 	static void sanitize_device_id(char* device_id);
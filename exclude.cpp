@@ -109,6 +109,16 @@ bool TWExclude::check_absolute_skip_dirs(const string& path) {
 	return std::find(absolutedir.begin(), absolutedir.end(), path) != absolutedir.end();
 }
 
+vector<string> TWExclude::get_absolute_dirs_below(const string& path) {
+	vector<string> below;
+	string prefix = TWFunc::Remove_Trailing_Slashes(path) + "/";
+	for (size_t i = 0; i < absolutedir.size(); i++) {
+		if (absolutedir[i].size() > prefix.size() && absolutedir[i].compare(0, prefix.size(), prefix) == 0)
+			below.push_back(absolutedir[i].substr(prefix.size()));
+	}
+	return below;
+}
+
 bool TWExclude::check_skip_dirs(const string& path) {
 	string normalized = TWFunc::Remove_Trailing_Slashes(path);
 	size_t slashIdx = normalized.find_last_of('/');
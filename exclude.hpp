@@ -34,6 +34,7 @@ public:
 	bool check_relative_skip_dirs(const string& dir);
 	bool check_absolute_skip_dirs(const string& path);
 	bool check_skip_dirs(const string& path);
+	vector<string> get_absolute_dirs_below(const string& path);   // absolute dirs inside path, relative to it
 	void clear_relative_dir(string dir);
 private:
 	vector<string> absolutedir;
@@ -21,7 +21,12 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
 #include <cctype>
+#include <vector>
 #include "fixContexts.hpp"
 #include "twrp-functions.hpp"
 #include "twcommon.h"
@@ -32,12 +37,21 @@
 
 using namespace std;
 
+#define FIXCONTEXTS_MAX_THREADS 8
+
 struct selabel_handle *sehandle;
 struct selinux_opt selinux_options[] = {
 	{ SELABEL_OPT_PATH, "/file_contexts" }
 };
 
-int fixContexts::restorecon(string entry, struct stat *sb) {
+struct Relabel_Work {
+	TWWorkQueue* queue;
+	atomic<unsigned long long> entries;
+	atomic<unsigned long long> relabeled;
+};
+
+// selabel_lookup does not change the handle, so the threads share it without a lock
+int fixContexts::restorecon(const string& entry, const struct stat *sb) {
 	char *oldcontext, *newcontext;
 
 	if (lgetfilecon(entry.c_str(), &oldcontext) < 0) {
@@ -46,51 +60,88 @@ int fixContexts::restorecon(string entry, struct stat *sb) {
 	}
 	if (selabel_lookup(sehandle, &newcontext, entry.c_str(), sb->st_mode) < 0) {
 		LOGINFO("Couldn't lookup selinux context for %s\n", entry.c_str());
+		freecon(oldcontext);
 		return -1;
 	}
+	int ret = 0;
 	if (strcmp(oldcontext, newcontext) != 0) {
 		LOGINFO("Relabeling %s from %s to %s\n", entry.c_str(), oldcontext, newcontext);
 		if (lsetfilecon(entry.c_str(), newcontext) < 0) {
 			LOGINFO("Couldn't label %s with %s: %s\n", entry.c_str(), newcontext, strerror(errno));
+		} else {
+			ret = 1;
 		}
 	}
 	freecon(oldcontext);
 	freecon(newcontext);
-	return 0;
+	return ret;
 }
 
-int fixContexts::fixContextsRecursively(string name, int level) {
-	DIR *d;
+void fixContexts::relabelDirectory(Relabel_Work *work, const string& name) {
+	unsigned long long entries = 0, relabeled = 0;
+	int fd = open(name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	DIR *d = fd < 0 ? NULL : fdopendir(fd);
+	if (!d) {
+		LOGINFO("Unable to open '%s': %s\n", name.c_str(), strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
 	struct dirent *de;
-	struct stat sb;
-	string path;
+	while ((de = readdir(d))) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		string path = name + "/" + de->d_name;
+		struct stat sb;
+		if (fstatat(fd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+			LOGINFO("Unable to stat '%s': %s\n", path.c_str(), strerror(errno));
+			continue;
+		}
+		entries++;
+		if (restorecon(path, &sb) == 1)
+			relabeled++;
+		if (S_ISDIR(sb.st_mode))
+			work->queue->Add([work, path]() { relabelDirectory(work, path); });
+	}
+	closedir(d);
+	work->entries += entries;
+	work->relabeled += relabeled;
+}
 
-	if (!(d = opendir(name.c_str())))
-		return -1;
-	if (!(de = readdir(d)))
+int fixContexts::fixContextsRecursively(const vector<string>& roots) {
+	TWWorkQueue queue(TWWorkQueue::Cpu_Threads(FIXCONTEXTS_MAX_THREADS));
+	Relabel_Work work;
+	timespec start, stop;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	work.queue = &queue;
+	work.entries = 0;
+	work.relabeled = 0;
+	bool queued = false;
+	for (size_t i = 0; i < roots.size(); i++) {
+		struct stat sb;
+		if (lstat(roots[i].c_str(), &sb) != 0 || !S_ISDIR(sb.st_mode))
+			continue;
+		restorecon(roots[i], &sb);
+		string root = roots[i];
+		queue.Add([&work, root]() { relabelDirectory(&work, root); });
+		queued = true;
+	}
+	if (!queued)
 		return -1;
+	size_t thread_count = queue.Run();
 
-	do {
-		if (de->d_type ==  DT_DIR) {
-			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
-				continue;
-			path = name + "/" + de->d_name;
-			restorecon(path, &sb);
-			fixContextsRecursively(path, level + 1);
-		}
-		else {
-			path = name + "/" + de->d_name;
-			restorecon(path, &sb);
-		}
-	} while ((de = readdir(d)));
-	closedir(d);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	LOGINFO("Checked %llu entries on %zu threads in %dms: %llu relabeled\n",
+		work.entries.load(), thread_count, TWFunc::timespec_diff_ms(start, stop), work.relabeled.load());
 	return 0;
 }
 
 int fixContexts::fixDataMediaContexts(string Mount_Point) {
 	DIR *d;
 	struct dirent *de;
-	struct stat sb;
+	vector<string> roots;
 
 	LOGINFO("Fixing media contexts on '%s'\n", Mount_Point.c_str());
 
@@ -104,11 +155,13 @@ int fixContexts::fixDataMediaContexts(string Mount_Point) {
 		string dir = Mount_Point + "/media";
 		if (!(d = opendir(dir.c_str()))) {
 			LOGINFO("opendir failed (%s)\n", strerror(errno));
+			selabel_close(sehandle);
 			return -1;
 		}
 		if (!(de = readdir(d))) {
 			LOGINFO("readdir failed (%s)\n", strerror(errno));
 			closedir(d);
+			selabel_close(sehandle);
 			return -1;
 		}
 
@@ -128,18 +181,19 @@ int fixContexts::fixDataMediaContexts(string Mount_Point) {
 			if (is_numeric) {
 				dir = Mount_Point + "/media/";
 				dir += de->d_name;
-				restorecon(dir, &sb);
-				fixContextsRecursively(dir, 0);
+				roots.push_back(dir);
 			}
 		} while ((de = readdir(d)));
 		closedir(d);
 	} else if (TWFunc::Path_Exists(Mount_Point + "/media")) {
-		restorecon(Mount_Point + "/media", &sb);
-		fixContextsRecursively(Mount_Point + "/media", 0);
+		roots.push_back(Mount_Point + "/media");
 	} else {
 		LOGINFO("fixDataMediaContexts: %s/media does not exist!\n", Mount_Point.c_str());
+		selabel_close(sehandle);
 		return 0;
 	}
+	// all users are relabeled together, so a small user does not leave threads idle
+	fixContextsRecursively(roots);
 	selabel_close(sehandle);
 	return 0;
 }
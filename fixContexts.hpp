@@ -20,16 +20,20 @@
 #define __FIXCONTEXTS_HPP
 
 #include <string>
+#include <vector>
 
 using namespace std;
 
+struct Relabel_Work;
+
 class fixContexts {
 	public:
 		static int fixDataMediaContexts(string Mount_Point);
 
 	private:
-		static int restorecon(string entry, struct stat *sb);
-		static int fixContextsRecursively(string path, int level);
+		static int restorecon(const string& entry, const struct stat *sb);   // Returns 1 if the entry was relabeled, -1 on errors
+		static int fixContextsRecursively(const vector<string>& roots);   // Relabels roots and everything below them on several threads
+		static void relabelDirectory(Relabel_Work *work, const string& name);
 };
 
 #endif
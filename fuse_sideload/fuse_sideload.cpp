@@ -57,8 +57,14 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/stringprintf.h>
@@ -71,8 +77,87 @@ static constexpr uint64_t EXIT_FLAG_ID = FUSE_ROOT_ID + 2;
 static constexpr int NO_STATUS = 1;
 static constexpr int NO_STATUS_EXIT = 2;
 
+// When the reader walks the package sequentially, fetch up to this many blocks from the host in one
+// go and hash them on worker threads while the following blocks are still being transferred. The
+// window is further capped so that it never holds more than PREFETCH_MAX_BYTES of block data.
+static constexpr uint32_t PREFETCH_MAX_BLOCKS = 8;
+static constexpr uint32_t PREFETCH_MAX_BYTES = 2 * 1024 * 1024;
+static constexpr uint32_t PREFETCH_HASH_THREADS = 4;
+static constexpr uint32_t NO_BLOCK = static_cast<uint32_t>(-1);
+
 using SHA256Digest = std::array<uint8_t, SHA256_DIGEST_LENGTH>;
 
+// A fixed set of threads that hash blocks for the prefetch window. The threads are started once per
+// sideload session, so a window only pays for queueing its blocks and not for thread creation.
+class BlockHasher {
+ public:
+  explicit BlockHasher(uint32_t threads) {
+    for (uint32_t i = 0; i < threads; i++) {
+      workers_.emplace_back(&BlockHasher::Worker, this);
+    }
+  }
+
+  ~BlockHasher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Queues |len| bytes at |data| to be hashed into |digest|. Both must stay valid until Wait().
+  void Add(const uint8_t* data, size_t len, SHA256Digest* digest) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back({ data, len, digest });
+      pending_++;
+    }
+    work_cv_.notify_one();
+  }
+
+  // Blocks until every queued block has been hashed.
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+  }
+
+ private:
+  struct Job {
+    const uint8_t* data;
+    size_t len;
+    SHA256Digest* digest;
+  };
+
+  void Worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      work_cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      Job job = jobs_.front();
+      jobs_.pop_front();
+      lock.unlock();
+      SHA256(job.data, job.len, job.digest->data());
+      lock.lock();
+      if (--pending_ == 0) {
+        done_cv_.notify_all();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Job> jobs_;
+  size_t pending_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
 struct fuse_data {
   android::base::unique_fd ffd;  // file descriptor for the fuse socket
 
@@ -93,6 +178,12 @@ struct fuse_data {
 
   std::vector<SHA256Digest>
       hashes;  // SHA-256 hash of each block (all zeros if block hasn't been read yet)
+
+  uint32_t prefetch_slots;             // number of blocks held by the prefetch window
+  std::vector<uint8_t> prefetch_data;  // prefetch_slots * block_size bytes of verified blocks
+  std::vector<uint32_t> prefetch_ids;  // block held by each slot, or NO_BLOCK
+  uint32_t last_fetched;               // last block requested by the reader
+  std::unique_ptr<BlockHasher> hasher;  // hashes the blocks of a prefetch window
 };
 
 static void fuse_reply(const fuse_data* fd, uint64_t unique, const void* data, size_t len) {
@@ -223,6 +314,67 @@ static int handle_release(void* /* data */, fuse_data* /* fd */, const fuse_in_h
   return 0;
 }
 
+// Verify the hash of a block we just got from the host.
+//
+// - If the hash of the just-received data matches the stored hash for the block, accept it.
+// - If the stored hash is all zeroes, store the new hash and accept the block (this is the first
+//   time we've read this block).
+// - Otherwise, reject the block.
+static bool verify_block_hash(fuse_data* fd, uint32_t block, const SHA256Digest& hash) {
+  const SHA256Digest& blockhash = fd->hashes[block];
+  if (hash == blockhash) {
+    return true;
+  }
+
+  for (uint8_t i : blockhash) {
+    if (i != 0) {
+      return false;
+    }
+  }
+
+  fd->hashes[block] = hash;
+  return true;
+}
+
+// Read |count| consecutive blocks starting at |block| from the host into the prefetch window and
+// verify them. Blocks are read in order on the calling thread, while each received block is hashed
+// on one of the hasher threads, so that hashing overlaps with the transfer of the next block.
+// Nothing is placed in the window before every hash has been checked. Returns the number of blocks that
+// were read; blocks that fail verification are left out of the window.
+static uint32_t prefetch_blocks(fuse_data* fd, uint32_t block, uint32_t count) {
+  std::fill(fd->prefetch_ids.begin(), fd->prefetch_ids.end(), NO_BLOCK);
+
+  std::vector<SHA256Digest> digests(count);
+
+  uint32_t fetched = 0;
+  for (; fetched < count; fetched++) {
+    uint32_t cur = block + fetched;
+    uint8_t* slot = fd->prefetch_data.data() + static_cast<size_t>(fetched) * fd->block_size;
+
+    uint32_t fetch_size = fd->block_size;
+    if (static_cast<uint64_t>(cur) * fd->block_size + fetch_size > fd->file_size) {
+      // If we're reading the last (partial) block of the file, expect a shorter response from the
+      // host, and pad the rest of the block with zeroes.
+      fetch_size = fd->file_size - (static_cast<uint64_t>(cur) * fd->block_size);
+      memset(slot + fetch_size, 0, fd->block_size - fetch_size);
+    }
+
+    if (!fd->provider->ReadBlockAlignedData(slot, fetch_size, cur)) {
+      break;
+    }
+
+    fd->hasher->Add(slot, fd->block_size, &digests[fetched]);
+  }
+  fd->hasher->Wait();
+
+  for (uint32_t i = 0; i < fetched; i++) {
+    if (verify_block_hash(fd, block + i, digests[i])) {
+      fd->prefetch_ids[i] = block + i;
+    }
+  }
+  return fetched;
+}
+
 // Fetch a block from the host into fd->curr_block and fd->block_data.
 // Returns 0 on successful fetch, negative otherwise.
 static int fetch_block(fuse_data* fd, uint32_t block) {
@@ -236,43 +388,30 @@ static int fetch_block(fuse_data* fd, uint32_t block) {
     return 0;
   }
 
-  uint32_t fetch_size = fd->block_size;
-  if (block * fd->block_size + fetch_size > fd->file_size) {
-    // If we're reading the last (partial) block of the file, expect a shorter response from the
-    // host, and pad the rest of the block with zeroes.
-    fetch_size = fd->file_size - (block * fd->block_size);
-    memset(fd->block_data + fetch_size, 0, fd->block_size - fetch_size);
-  }
-
-  if (!fd->provider->ReadBlockAlignedData(fd->block_data, fetch_size, block)) {
-    return -EIO;
-  }
-
-  fd->curr_block = block;
-
-  // Verify the hash of the block we just got from the host.
-  //
-  // - If the hash of the just-received data matches the stored hash for the block, accept it.
-  // - If the stored hash is all zeroes, store the new hash and accept the block (this is the first
-  //   time we've read this block).
-  // - Otherwise, return -EINVAL for the read.
-
-  SHA256Digest hash;
-  SHA256(fd->block_data, fd->block_size, hash.data());
-
-  const SHA256Digest& blockhash = fd->hashes[block];
-  if (hash == blockhash) {
-    return 0;
-  }
+  bool sequential = (fd->last_fetched != NO_BLOCK && block == fd->last_fetched + 1);
+  fd->last_fetched = block;
 
-  for (uint8_t i : blockhash) {
-    if (i != 0) {
+  auto slot = std::find(fd->prefetch_ids.begin(), fd->prefetch_ids.end(), block);
+  if (slot == fd->prefetch_ids.end()) {
+    // Only read ahead when the reader is walking the file sequentially; random accesses (e.g. the
+    // signature check seeking to the end of the package) fetch just the block they asked for.
+    uint32_t count = 1;
+    if (sequential) {
+      count = std::min(fd->prefetch_slots, fd->file_blocks - block);
+    }
+    if (prefetch_blocks(fd, block, count) == 0) {
+      return -EIO;
+    }
+    if (fd->prefetch_ids[0] != block) {
       fd->curr_block = -1;
       return -EIO;
     }
+    slot = fd->prefetch_ids.begin();
   }
 
-  fd->hashes[block] = hash;
+  size_t index = slot - fd->prefetch_ids.begin();
+  memcpy(fd->block_data, fd->prefetch_data.data() + index * fd->block_size, fd->block_size);
+  fd->curr_block = block;
   return 0;
 }
 
@@ -378,6 +517,11 @@ int run_fuse_sideload(std::unique_ptr<FuseDataProvider>&& provider, const char*
   fd.gid = getgid();
 
   fd.curr_block = -1;
+  fd.last_fetched = NO_BLOCK;
+  fd.prefetch_slots = std::max(1U, std::min(PREFETCH_MAX_BLOCKS, PREFETCH_MAX_BYTES / block_size));
+  fd.prefetch_data.resize(static_cast<size_t>(fd.prefetch_slots) * block_size);
+  fd.prefetch_ids.assign(fd.prefetch_slots, NO_BLOCK);
+  fd.hasher = std::make_unique<BlockHasher>(std::min(PREFETCH_HASH_THREADS, fd.prefetch_slots));
   fd.block_data = static_cast<uint8_t*>(malloc(block_size));
   if (fd.block_data == nullptr) {
     fprintf(stderr, "failed to allocate %d bites for block_data\n", block_size);
@@ -13,6 +13,7 @@ LOCAL_SRC_FILES := \
     image.cpp \
     action.cpp \
     console.cpp \
+    logwriter.cpp \
     fill.cpp \
     button.cpp \
     gesture.cpp \
@@ -34,7 +35,8 @@ LOCAL_SRC_FILES := \
     patternpassword.cpp \
     textbox.cpp \
     terminal.cpp \
-    twmsg.cpp
+    twmsg.cpp \
+    themeblob.cpp
 
 ifneq ($(TW_DELAY_TOUCH_INIT_MS),)
     LOCAL_CFLAGS += -DTW_DELAY_TOUCH_INIT_MS=$(TW_DELAY_TOUCH_INIT_MS)
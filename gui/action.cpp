@@ -43,6 +43,8 @@
 #include "../partitions.hpp"
 #include "../twrp-functions.hpp"
 #include "../twrpRepacker.hpp"
+#include "../twrpProfiler.hpp"
+#include "../twrpWarmup.hpp"
 #include "../openrecoveryscript.hpp"
 
 #include "twinstall/adb_install.h"
@@ -169,6 +171,9 @@ void ActionThread::run(void *data)
   ThreadData *d = (ThreadData *) data;
   GUIAction *act = d->act;
 
+  // threaded actions mount, wipe and flash, the boot time warm-up has to be out of the way
+  twrpWarmup::Stop();
+
   std::vector < GUIAction::Action >::iterator it;
   for (it = act->mActions.begin(); it != act->mActions.end(); ++it)
     act->doAction(*it);
@@ -249,6 +254,7 @@ GUIAction::GUIAction(xml_node <> *node):GUIObject(node)
       ADD_ACTION(set_chmod);
       ADD_ACTION(setpassword);
       ADD_ACTION(passwordcheck);
+      ADD_ACTION(bootprofile);
  
       // remember actions that run in the caller thread
       for (mapFunc::const_iterator it = mf.begin(); it != mf.end(); ++it)
@@ -493,7 +499,7 @@ int GUIAction::flash_zip(std::string filename, int *wipe_cache)
     }
   else
     {
-      ret_val = TWinstall_zip(filename.c_str(), wipe_cache);
+      ret_val = TWinstall_zip(filename.c_str(), wipe_cache, DataManager::GetIntValue(TW_FORCE_DIGEST_CHECK_VAR) != 0);
       PartitionManager.Unlock_Block_Partitions();
 
       // Now, check if we need to ensure TWRP remains installed...
@@ -814,6 +820,7 @@ int GUIAction::check_and_reload(std::string arg __unused)
 
 int GUIAction::readBackup(std::string arg __unused)
 {
+  twrpWarmup::Stop();
   string Restore_Name;
   DataManager::GetValue("tw_restore", Restore_Name);
   PartitionManager.Set_Restore_Files(Restore_Name);
@@ -974,6 +981,7 @@ int GUIAction::fileextension(std::string arg)
 
 int GUIAction::mount(std::string arg)
 {
+  twrpWarmup::Stop();
   if (arg == "usb")
     {
       DataManager::SetValue(TW_ACTION_BUSY, 1);
@@ -994,6 +1002,7 @@ int GUIAction::mount(std::string arg)
 
 int GUIAction::unmount(std::string arg)
 {
+  twrpWarmup::Stop();
   if (arg == "usb")
     {
       if (!simulate)
@@ -1013,6 +1022,7 @@ int GUIAction::unmount(std::string arg)
 
 int GUIAction::restoredefaultsettings(std::string arg __unused)
 {
+  twrpWarmup::Stop();
   operation_start("Restore Defaults");
   if (simulate)			// Simulated so that people don't accidently wipe out the "simulation is on" setting
     gui_msg("simulating=Simulating actions...");
@@ -1028,6 +1038,7 @@ int GUIAction::restoredefaultsettings(std::string arg __unused)
 
 int GUIAction::copylog(std::string arg __unused)
 {
+  twrpWarmup::Stop();
   operation_start("Copy Log");
   if (!simulate)
     {
@@ -1374,6 +1385,7 @@ int GUIAction::getpartitiondetails(std::string arg)
 
 int GUIAction::screenshot(std::string arg __unused)
 {
+	twrpWarmup::Stop();
 	time_t tm;
 	char path[256];
 	int path_len;
@@ -1506,6 +1518,14 @@ int GUIAction::flash(std::string arg)
       DataManager::SetValue("tw_file", zip_filename);
       DataManager::SetValue(TW_ZIP_INDEX, (i + 1));
 
+      // let the next zip be checked and read while this one installs
+      if (i + 1 < zip_queue_index)
+	{
+	  string next_zip = zip_queue[i + 1];
+	  if (next_zip.size() < 4 || next_zip.substr(next_zip.size() - 4, 4) != "ozip")
+	    TWinstall_Queue_Next(next_zip, DataManager::GetIntValue(TW_FORCE_DIGEST_CHECK_VAR) != 0);
+	}
+
       TWFunc::SetPerformanceMode(true);
 
       // try to flash the zip
@@ -1530,6 +1550,7 @@ int GUIAction::flash(std::string arg)
        usleep(250000);
      } // for i
 
+   TWinstall_Clear_Queue();
    zip_queue_index = 0;
 
    if (wipe_cache)
@@ -1957,6 +1978,13 @@ int GUIAction::cmd(std::string arg)
   return 0;
 }
 
+int GUIAction::bootprofile(std::string arg __unused)
+{
+  twrpProfiler::Print_Summary();
+  gui_print("Trace: %s\n", BOOT_TRACE_FILE);
+  return 0;
+}
+
 int GUIAction::ftls(std::string arg)
 {
   int op_status = 0;
@@ -2385,6 +2413,7 @@ int GUIAction::changefilesystem(std::string arg __unused)
 
 int GUIAction::startmtp(std::string arg __unused)
 {
+  twrpWarmup::Stop();
   int op_status = 0;
 
   operation_start("Start MTP");
@@ -2399,6 +2428,7 @@ int GUIAction::startmtp(std::string arg __unused)
 
 int GUIAction::stopmtp(std::string arg __unused)
 {
+  twrpWarmup::Stop();
   int op_status = 0;
 
   operation_start("Stop MTP");
@@ -2493,6 +2523,7 @@ int GUIAction::checkpartitionlifetimewrites(std::string arg)
 
 int GUIAction::mountsystemtoggle(std::string arg)
 {
+	twrpWarmup::Stop();
 	int op_status = 0;
 	bool remount_system = PartitionManager.Is_Mounted_By_Path(PartitionManager.Get_Android_Root_Path());
 	bool remount_vendor = PartitionManager.Is_Mounted_By_Path("/vendor");
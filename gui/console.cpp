@@ -34,6 +34,7 @@ extern "C" {
 #include "../twcommon.h"
 }
 #include "../minuitwrp/minui.h"
+#include "../minuitwrp/truetype.hpp"
 
 #include "rapidxml.hpp"
 #include "objects.hpp"
@@ -41,30 +42,77 @@ extern "C" {
 #include "twmsg.h"
 
 #define GUI_CONSOLE_BUFFER_SIZE 512
+// The console keeps the newest lines that fit both limits, older ones are dropped
+#define GUI_CONSOLE_MAX_LINES 4096
+#define GUI_CONSOLE_MAX_BYTES (512 * 1024)
 
 static pthread_mutex_t console_lock;
 static size_t last_message_count = 0;
 static std::vector<Message> gMessages;
 
-static std::vector<std::string> gConsole;
-static std::vector<std::string> gConsoleColor;
-static FILE* ors_file = NULL;
+struct ConsoleLine
+{
+	std::string text;
+	std::string color;
+};
+
+// Ring buffer of console lines. Lines are numbered in the order they were printed
+// and line n lives in slot n % GUI_CONSOLE_MAX_LINES while gConsoleFirst <= n < gConsoleEnd.
+static std::vector<ConsoleLine> gConsole;
+static size_t gConsoleFirst = 0;
+static size_t gConsoleEnd = 0;
+static size_t gConsoleBytes = 0;
 
 struct InitMutex
 {
-	InitMutex() { pthread_mutex_init(&console_lock, NULL); }
+	InitMutex() {
+		// recursive so that anything printed while a console renders cannot deadlock
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&console_lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
 } initMutex;
 
+static void console_drop_oldest()
+{
+	ConsoleLine& line = gConsole[gConsoleFirst % GUI_CONSOLE_MAX_LINES];
+	gConsoleBytes -= line.text.size() + line.color.size();
+	std::string().swap(line.text);
+	std::string().swap(line.color);
+	gConsoleFirst++;
+}
+
+// console_lock must be held
+static void console_add_line(const char* text, const char* color)
+{
+	if (gConsole.empty())
+		gConsole.resize(GUI_CONSOLE_MAX_LINES);
+
+	size_t bytes = strlen(text) + strlen(color);
+	while (gConsoleFirst < gConsoleEnd &&
+		(gConsoleEnd - gConsoleFirst >= GUI_CONSOLE_MAX_LINES || gConsoleBytes + bytes > GUI_CONSOLE_MAX_BYTES))
+		console_drop_oldest();
+
+	ConsoleLine& line = gConsole[gConsoleEnd % GUI_CONSOLE_MAX_LINES];
+	line.text = text;
+	line.color = color;
+	gConsoleBytes += bytes;
+	gConsoleEnd++;
+}
+
 static void internal_gui_print(const char *color, char *buf)
 {
 	// make sure to flush any outstanding messages first to preserve order of outputs
 	GUIConsole::Translate_Now();
 
-	fputs(buf, stdout);
-	if (ors_file) {
-		fprintf(ors_file, "%s", buf);
-		fflush(ors_file);
-	}
+	char severity = 'P';
+	if (strcmp(color, "error") == 0)
+		severity = 'E';
+	else if (strcmp(color, "warning") == 0)
+		severity = 'W';
+	gui_log_write(severity, 1, buf, strlen(buf));
 
 	char *start, *next;
 
@@ -79,8 +127,7 @@ static void internal_gui_print(const char *color, char *buf)
 		if (*next == '\n')
 		{
 			*next = '\0';
-			gConsole.push_back(start);
-			gConsoleColor.push_back(color);
+			console_add_line(start, color);
 
 			start = ++next;
 		}
@@ -89,10 +136,8 @@ static void internal_gui_print(const char *color, char *buf)
 	}
 
 	// The text after last \n (or whole string if there is no \n)
-	if (*start) {
-		gConsole.push_back(start);
-		gConsoleColor.push_back(color);
-	}
+	if (*start)
+		console_add_line(start, color);
 	pthread_mutex_unlock(&console_lock);
 }
 
@@ -120,11 +165,6 @@ extern "C" void gui_print_color(const char *color, const char *fmt, ...)
 	internal_gui_print(color, buf);
 }
 
-extern "C" void gui_set_FILE(FILE* f)
-{
-	ors_file = f;
-}
-
 void gui_msg(const char* text)
 {
 	if (text) {
@@ -161,11 +201,12 @@ void gui_msg(Message msg)
 {
 	std::string output = msg;
 	output += "\n";
-	fputs(output.c_str(), stdout);
-	if (ors_file) {
-		fprintf(ors_file, "%s", output.c_str());
-		fflush(ors_file);
-	}
+	char severity = 'P';
+	if (msg.GetKind() == msg::kError)
+		severity = 'E';
+	else if (msg.GetKind() == msg::kWarning)
+		severity = 'W';
+	gui_log_write(severity, 1, output.data(), output.size());
 	pthread_mutex_lock(&console_lock);
 	gMessages.push_back(msg);
 	pthread_mutex_unlock(&console_lock);
@@ -183,15 +224,14 @@ void GUIConsole::Translate_Now()
 
 	for (size_t m = last_message_count; m < message_count; m++) {
 		std::string message = gMessages[m];
-		std::string color = "normal";
+		const char* color = "normal";
 		if (gMessages[m].GetKind() == msg::kError)
 			color = "error";
 		else if (gMessages[m].GetKind() == msg::kHighlight)
 			color = "highlight";
 		else if (gMessages[m].GetKind() == msg::kWarning)
 			color = "warning";
-		gConsole.push_back(message);
-		gConsoleColor.push_back(color);
+		console_add_line(message.c_str(), color);
 	}
 	last_message_count = message_count;
 	pthread_mutex_unlock(&console_lock);
@@ -201,8 +241,8 @@ void GUIConsole::Clear_For_Retranslation()
 {
 	pthread_mutex_lock(&console_lock);
 	last_message_count = 0;
-	gConsole.clear();
-	gConsoleColor.clear();
+	while (gConsoleFirst < gConsoleEnd)
+		console_drop_oldest();
 	pthread_mutex_unlock(&console_lock);
 }
 
@@ -211,6 +251,8 @@ GUIConsole::GUIConsole(xml_node<>* node) : GUIScrollList(node)
 	xml_node<>* child;
 
 	mLastCount = 0;
+	mWrapWidth = 0;
+	mWrapFont = NULL;
 	scrollToEnd = true;
 	mSlideoutX = mSlideoutY = mSlideoutW = mSlideoutH = 0;
 	mSlideout = 0;
@@ -268,13 +310,88 @@ int GUIConsole::RenderSlideout(void)
 	return 0;
 }
 
+// WrapLines - Split the console lines added since the last call into display rows
+//  console_lock must be held. Return true if the rows changed
+bool GUIConsole::WrapLines(void)
+{
+	if (!mFont || !mFont->GetResource())
+		return false;
+
+	bool changed = false;
+	void* font = mFont->GetResource();
+	if (mWrapWidth != mRenderW || mWrapFont != font) {
+		// wrap everything the buffer still holds again for the new width or font
+		rConsole.clear();
+		mLastCount = gConsoleFirst;
+		mWrapWidth = mRenderW;
+		mWrapFont = font;
+		changed = true;
+	}
+
+	// forget the rows of lines that were dropped from the buffer
+	size_t dropped = 0;
+	while (!rConsole.empty() && rConsole.front().line < gConsoleFirst) {
+		rConsole.pop_front();
+		dropped++;
+	}
+	if (dropped) {
+		if ((size_t)firstDisplayedItem > dropped) {
+			firstDisplayedItem -= dropped;
+		} else {
+			firstDisplayedItem = 0;
+			y_offset = 0;
+		}
+		changed = true;
+	}
+	if (mLastCount < gConsoleFirst)
+		mLastCount = gConsoleFirst;
+
+	// Note, that multiple consoles on different GUI pages may be different widths or use different fonts, so the word wrapping
+	// may different in different console windows
+	for (; mLastCount < gConsoleEnd; mLastCount++) {
+		const std::string& text = gConsole[mLastCount % GUI_CONSOLE_MAX_LINES].text;
+		ConsoleRow row;
+		row.line = mLastCount;
+		row.start = 0;
+		for (;;) {
+			size_t remaining = text.size() - row.start;
+			size_t line_char_width = twrpTruetype::gr_ttf_maxExW(text.c_str() + row.start, font, mRenderW);
+			if (line_char_width == 0)
+				line_char_width = 1;
+			if (line_char_width < remaining) {
+				size_t wrap_pos = text.find_last_of(" ,./:-_;", row.start + line_char_width - 1);
+				if (wrap_pos == std::string::npos || wrap_pos < row.start)
+					wrap_pos = line_char_width;
+				else if (wrap_pos - row.start < line_char_width - 1)
+					wrap_pos = wrap_pos - row.start + 1;
+				else
+					wrap_pos -= row.start;
+				row.length = wrap_pos;
+				rConsole.push_back(row);
+				/* After word wrapping, skip any leading spaces. Note that the word wrapping is not smart enough to know not
+				 * to wrap in the middle of something like ... so some of the ... could appear on the following line. */
+				row.start += wrap_pos;
+				while (row.start < text.size() && text[row.start] == ' ')
+					row.start++;
+			} else {
+				row.length = remaining;
+				rConsole.push_back(row);
+				break;
+			}
+		}
+		changed = true;
+	}
+	return changed;
+}
+
 int GUIConsole::RenderConsole(void)
 {
 	Translate_Now();
+	// hold the lock while rendering so that no row can refer to a line that is being dropped
 	pthread_mutex_lock(&console_lock);
-	AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor);
-	pthread_mutex_unlock(&console_lock);
+	WrapLines();
 	GUIScrollList::Render();
+	pthread_mutex_unlock(&console_lock);
 
 	// if last line is fully visible, keep tracking the last line when new lines are added
 	int bottom_offset = GetDisplayRemainder() - actualItemHeight;
@@ -319,13 +436,13 @@ int GUIConsole::Update(void)
 			mSlideoutState = visible;
 
 		// Any time we activate the console, we reset the position
-		SetVisibleListLocation(rConsole.size() - 1);
+		SetVisibleListLocation(GetItemCount() - 1);
 		mUpdate = 1;
 		scrollToEnd = true;
 	}
 
 	pthread_mutex_lock(&console_lock);
-	bool addedNewText = AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor);
+	bool addedNewText = WrapLines();
 	pthread_mutex_unlock(&console_lock);
 	if (addedNewText) {
 		// someone added new text
@@ -335,7 +452,7 @@ int GUIConsole::Update(void)
 
 	if (scrollToEnd) {
 		// keep the last line in view
-		SetVisibleListLocation(rConsole.size() - 1);
+		SetVisibleListLocation(GetItemCount() - 1);
 	}
 
 	GUIScrollList::Update();
@@ -392,20 +509,25 @@ size_t GUIConsole::GetItemCount()
 
 void GUIConsole::RenderItem(size_t itemindex, int yPos, bool selected __unused)
 {
+	const ConsoleRow& row = rConsole[itemindex];
+	if (row.line < gConsoleFirst || row.line >= gConsoleEnd)
+		return; // dropped while rendering
+	const ConsoleLine& line = gConsole[row.line % GUI_CONSOLE_MAX_LINES];
+
 	// Set the color for the font
-	if (rConsoleColor[itemindex] == "normal") {
+	if (line.color == "normal") {
 		gr_color(mFontColor.red, mFontColor.green, mFontColor.blue, mFontColor.alpha);
 	} else {
 		COLOR FontColor;
-		std::string color = rConsoleColor[itemindex];
+		std::string color = line.color;
 		ConvertStrToColor(color, &FontColor);
 		FontColor.alpha = 255;
 		gr_color(FontColor.red, FontColor.green, FontColor.blue, FontColor.alpha);
 	}
 
 	// render text
-	const char* text = rConsole[itemindex].c_str();
-	gr_textEx_scaleW(mRenderX, yPos, text, mFont->GetResource(), mRenderW, TOP_LEFT, 0);
+	std::string text = line.text.substr(row.start, row.length);
+	gr_textEx_scaleW(mRenderX, yPos, text.c_str(), mFont->GetResource(), mRenderW, TOP_LEFT, 0);
 }
 
 void GUIConsole::NotifySelect(size_t item_selected __unused)
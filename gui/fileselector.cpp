@@ -19,7 +19,10 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <algorithm>
+#include <atomic>
+#include <list>
 #ifdef __ANDROID_API_M__
 #include <vector>
 #ifdef __ANDROID_API_N__
@@ -40,7 +43,271 @@ extern "C" {
 #include "../twrp-functions.hpp"
 #include "../adbbu/libtwadbbu.hpp"
 
-int GUIFileSelector::mSortOrder = 0;
+// Directory listings are read on a background thread so large folders don't
+// stall the UI. Matching entries are handed over in sorted batches that double
+// in size, and Update() merges each batch into the visible list.
+#define FILE_LIST_FIRST_BATCH 256
+
+// Raw listings of the most recently read directories, reused as long as the
+// directory's mtime hasn't changed
+#define DIR_CACHE_MAX_DIRS 8
+
+struct DirEntry {
+	std::string name;
+	unsigned char type;		// d_type, resolved through stat if the fs doesn't report it
+	struct stat st;
+};
+
+struct DirListing {
+	std::string path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	std::shared_ptr<const std::vector<DirEntry> > entries;
+};
+
+static std::list<DirListing> dir_cache; // most recently used first
+static pthread_mutex_t dir_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool dir_listing_matches(const DirListing& listing, const std::string& path, const struct stat& st)
+{
+	return listing.path == path && listing.dev == st.st_dev && listing.ino == st.st_ino &&
+		listing.mtime.tv_sec == st.st_mtim.tv_sec && listing.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+static std::shared_ptr<const std::vector<DirEntry> > dir_cache_get(const std::string& path, const struct stat& st)
+{
+	std::shared_ptr<const std::vector<DirEntry> > entries;
+
+	pthread_mutex_lock(&dir_cache_lock);
+	for (std::list<DirListing>::iterator it = dir_cache.begin(); it != dir_cache.end(); ++it) {
+		if (it->path != path)
+			continue;
+		if (dir_listing_matches(*it, path, st)) {
+			entries = it->entries;
+			dir_cache.splice(dir_cache.begin(), dir_cache, it);
+		} else {
+			dir_cache.erase(it);
+		}
+		break;
+	}
+	pthread_mutex_unlock(&dir_cache_lock);
+	return entries;
+}
+
+static void dir_cache_put(const std::string& path, const struct stat& st, std::shared_ptr<const std::vector<DirEntry> > entries)
+{
+	DirListing listing;
+	listing.path = path;
+	listing.dev = st.st_dev;
+	listing.ino = st.st_ino;
+	listing.mtime = st.st_mtim;
+	listing.entries = entries;
+
+	pthread_mutex_lock(&dir_cache_lock);
+	for (std::list<DirListing>::iterator it = dir_cache.begin(); it != dir_cache.end(); ++it) {
+		if (it->path == path) {
+			dir_cache.erase(it);
+			break;
+		}
+	}
+	dir_cache.push_front(listing);
+	if (dir_cache.size() > DIR_CACHE_MAX_DIRS)
+		dir_cache.pop_back();
+	pthread_mutex_unlock(&dir_cache_lock);
+}
+
+struct GUIFileSelector::FileListJob {
+	// Set up by the UI thread before the loader starts
+	std::string folder;
+	std::vector<std::string> extensions; // empty string matches every file
+	std::string searchString;
+	bool hideHidden;
+	int showNavFolders;
+	int sortOrder;
+	bool merged; // UI thread only, set once the first batch replaced the old list
+
+	std::atomic<bool> cancel;
+
+	// Handed over to the UI thread, guarded by lock
+	pthread_mutex_t lock;
+	std::vector<FileData> folders, files;
+	bool done, failed, hasFiles, hasHiddenFiles;
+
+	// Loader thread only
+	std::vector<FileData> batchFolders, batchFiles;
+	size_t published, nextBatch;
+	bool foundFiles, foundHidden;
+
+	FileListJob() : hideHidden(false), showNavFolders(1), sortOrder(0), merged(false), cancel(false),
+		done(false), failed(false), hasFiles(false), hasHiddenFiles(false),
+		published(0), nextBatch(FILE_LIST_FIRST_BATCH), foundFiles(false), foundHidden(false)
+	{
+		pthread_mutex_init(&lock, NULL);
+	}
+
+	~FileListJob()
+	{
+		pthread_mutex_destroy(&lock);
+	}
+
+	void Run();
+	void Add(const DirEntry& entry);
+	void Publish(bool last);
+};
+
+void GUIFileSelector::FileListJob::Run()
+{
+	struct stat dir_st;
+
+	if (stat(folder.c_str(), &dir_st) != 0 || !S_ISDIR(dir_st.st_mode)) {
+		pthread_mutex_lock(&lock);
+		failed = done = true;
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	std::shared_ptr<const std::vector<DirEntry> > cached = dir_cache_get(folder, dir_st);
+	if (cached) {
+		for (const DirEntry& entry : *cached) {
+			if (cancel)
+				return;
+			Add(entry);
+		}
+	} else {
+		DIR* d = opendir(folder.c_str());
+		if (d == NULL) {
+			pthread_mutex_lock(&lock);
+			failed = done = true;
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+
+		std::shared_ptr<std::vector<DirEntry> > entries = std::make_shared<std::vector<DirEntry> >();
+		struct dirent* de;
+		while ((de = readdir(d)) != NULL) {
+			if (cancel) {
+				closedir(d);
+				return;
+			}
+			DirEntry entry;
+			entry.name = de->d_name;
+			entry.type = de->d_type;
+			std::string path = folder + "/" + entry.name;
+			if (stat(path.c_str(), &entry.st) != 0)
+				memset(&entry.st, 0, sizeof(entry.st));
+			if (entry.type == DT_UNKNOWN)
+				entry.type = TWFunc::Get_D_Type_From_Stat(path);
+			entries->push_back(entry);
+			Add(entries->back());
+		}
+		closedir(d);
+
+		// Only keep the listing if nothing changed while it was read
+		struct stat after;
+		if (stat(folder.c_str(), &after) == 0 && after.st_mtim.tv_sec == dir_st.st_mtim.tv_sec &&
+				after.st_mtim.tv_nsec == dir_st.st_mtim.tv_nsec)
+			dir_cache_put(folder, after, entries);
+	}
+	Publish(true);
+}
+
+void GUIFileSelector::FileListJob::Add(const DirEntry& entry)
+{
+	FileData data;
+
+	data.fileName = entry.name;
+	if (data.fileName == ".")
+		return;
+	if (data.fileName == ".." && folder == "/")
+		return;
+
+	// [f/d] filter files by name
+	if (!searchString.empty() && data.fileName != ".." && data.fileName.find(searchString) == string::npos) {
+		string fileLower = TWFunc::lowercase(data.fileName);
+		if (fileLower.find(searchString) == string::npos)
+			return;
+	}
+
+	// [f/d] Remove hidden files/folders when tw_hidden_files = 0
+	if (hideHidden) {
+		if ( (folder == "/" && (data.fileName == "twres" || data.fileName == "tmp"))
+		||   (data.fileName != ".." && data.fileName.substr(0, 1) == ".")
+		||    data.fileName == "lost+found" ) {
+			foundHidden = true;
+			return;
+		}
+	}
+
+	if (data.fileName != "..")
+		foundFiles = true;
+
+	data.sortName = TWFunc::lowercase(data.fileName);
+	data.fileType = entry.type;
+	data.protection = entry.st.st_mode;
+	data.userId = entry.st.st_uid;
+	data.groupId = entry.st.st_gid;
+	data.fileSize = entry.st.st_size;
+	data.lastAccess = entry.st.st_atime;
+	data.lastModified = entry.st.st_mtime;
+	data.lastStatChange = entry.st.st_ctime;
+
+	if (data.fileType == DT_DIR) {
+		if (showNavFolders || (data.fileName != "." && data.fileName != ".."))
+			batchFolders.push_back(data);
+	} else if (data.fileType == DT_REG || data.fileType == DT_LNK || data.fileType == DT_BLK) {
+		for (const std::string& extn : extensions) {
+			if (extn.empty() || (data.fileName.length() > extn.length() && data.sortName.compare(data.sortName.length() - extn.length(), string::npos, extn) == 0)) {
+				if (extn == ".ab" && twadbbu::Check_ADB_Backup_File(folder + "/" + data.fileName)) {
+					batchFolders.push_back(data);
+				} else {
+					// [f/d] Get file extension
+					data.fileExt = data.sortName.substr(data.sortName.find_last_of(".") + 1);
+					batchFiles.push_back(data);
+				}
+				break;
+			}
+		}
+	}
+
+	if (batchFolders.size() + batchFiles.size() >= nextBatch)
+		Publish(false);
+}
+
+void GUIFileSelector::FileListJob::Publish(bool last)
+{
+	int order = sortOrder;
+	auto compare = [order](const FileData& d1, const FileData& d2) { return fileSort(d1, d2, order); };
+
+	std::sort(batchFolders.begin(), batchFolders.end(), compare);
+	std::sort(batchFiles.begin(), batchFiles.end(), compare);
+	published += batchFolders.size() + batchFiles.size();
+	nextBatch = std::max((size_t)FILE_LIST_FIRST_BATCH, published);
+
+	pthread_mutex_lock(&lock);
+	// Keep what the UI thread hasn't picked up yet sorted as a whole
+	size_t count = folders.size();
+	folders.insert(folders.end(), std::make_move_iterator(batchFolders.begin()), std::make_move_iterator(batchFolders.end()));
+	std::inplace_merge(folders.begin(), folders.begin() + count, folders.end(), compare);
+	count = files.size();
+	files.insert(files.end(), std::make_move_iterator(batchFiles.begin()), std::make_move_iterator(batchFiles.end()));
+	std::inplace_merge(files.begin(), files.begin() + count, files.end(), compare);
+	hasFiles = foundFiles;
+	hasHiddenFiles = foundHidden;
+	done = last;
+	pthread_mutex_unlock(&lock);
+
+	batchFolders.clear();
+	batchFiles.clear();
+}
+
+void* GUIFileSelector::FileListThread(void* cookie)
+{
+	std::shared_ptr<FileListJob>* job = (std::shared_ptr<FileListJob>*)cookie;
+	(*job)->Run();
+	delete job;
+	return NULL;
+}
 
 GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIScrollList(node)
 {
@@ -50,6 +317,7 @@ GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIScrollList(node)
 	mFolderIcon = mFileIcon = mUpIcon = mExZipIcon = mExImgIcon = mExTxtIcon = mExUnselectedIcon = mExSelectedIcon = mExPngIcon = mExLinkIcon = mExBlockIcon = NULL;
 	mShowFolders = mShowFiles = mShowNavFolders = 1;
 	mUpdate = 0;
+	mSortOrder = 0;
 	mPathVar = "cwd";
 	mFileFilterVar = "";
 	ignoreHideVar = updateFileList = false;
@@ -196,6 +464,8 @@ GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIScrollList(node)
 
 GUIFileSelector::~GUIFileSelector()
 {
+	if (mFileListJob)
+		mFileListJob->cancel = true;
 }
 
 int GUIFileSelector::Update(void)
@@ -209,13 +479,14 @@ int GUIFileSelector::Update(void)
 	if (updateFileList) {
 		string value;
 		DataManager::GetValue(mPathVar, value);
-		if (GetFileList(value) == 0) {
-			updateFileList = false;
-			mUpdate = 1;
-		} else
-			return 0;
+		GetFileList(value);
+		updateFileList = false;
 	}
 
+	// Pick up whatever the loader thread has read so far
+	if (mFileListJob && MergeFileList())
+		mUpdate = 1;
+
 	if (mUpdate) {
 		mUpdate = 0;
 		if (Render() == 0)
@@ -254,183 +525,157 @@ int GUIFileSelector::NotifyVarChange(const std::string& varName, const std::stri
 	return 0;
 }
 
-bool GUIFileSelector::fileSort(FileData d1, FileData d2)
+bool GUIFileSelector::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetVarSubscriptions(vars);
+	vars.push_back(mPathVar);
+	vars.push_back(mSortVariable);
+	vars.push_back(mExtnVar);
+	return true;
+}
+
+bool GUIFileSelector::fileSort(const FileData& d1, const FileData& d2, int sortOrder)
 {
-	if (d1.fileName == ".")
-		return -1;
-	if (d2.fileName == ".")
-		return 0;
 	if (d1.fileName == "..")
-		return -1;
+		return d2.fileName != "..";
 	if (d2.fileName == "..")
-		return 0;
+		return false;
 
-	switch (mSortOrder) {
+	switch (sortOrder) {
 		case 3: // by size largest first
 			if (d1.fileSize == d2.fileSize || d1.fileType == DT_DIR) // some directories report a different size than others - but this is not the size of the files inside the directory, so we just sort by name on directories
-				return (strcasecmp(d1.fileName.c_str(), d2.fileName.c_str()) < 0);
+				return d1.sortName < d2.sortName;
 			return d1.fileSize < d2.fileSize;
 		case -3: // by size smallest first
 			if (d1.fileSize == d2.fileSize || d1.fileType == DT_DIR) // some directories report a different size than others - but this is not the size of the files inside the directory, so we just sort by name on directories
-				return (strcasecmp(d1.fileName.c_str(), d2.fileName.c_str()) > 0);
+				return d1.sortName > d2.sortName;
 			return d1.fileSize > d2.fileSize;
 		case 2: // by last modified date newest first
 			if (d1.lastModified == d2.lastModified)
-				return (strcasecmp(d1.fileName.c_str(), d2.fileName.c_str()) < 0);
+				return d1.sortName < d2.sortName;
 			return d1.lastModified < d2.lastModified;
 		case -2: // by date oldest first
 			if (d1.lastModified == d2.lastModified)
-				return (strcasecmp(d1.fileName.c_str(), d2.fileName.c_str()) > 0);
+				return d1.sortName > d2.sortName;
 			return d1.lastModified > d2.lastModified;
 		case -1: // by name descending
-			return (strcasecmp(d1.fileName.c_str(), d2.fileName.c_str()) > 0);
+			return d1.sortName > d2.sortName;
 		default: // should be a 1 - sort by name ascending
-			return (strcasecmp(d1.fileName.c_str(), d2.fileName.c_str()) < 0);
+			return d1.sortName < d2.sortName;
 	}
 	return 0;
 }
 
+// Starts loading the listing of folder on a background thread, the current
+// list stays visible until the first batch of the new one arrives
 int GUIFileSelector::GetFileList(const std::string folder)
 {
-	DIR* d;
-	struct dirent* de;
-	struct stat st;
-
-	hasHiddenFiles = false;
-	hasFiles = false;
-
-	// Clear all data
-	mFolderList.clear();
-	mFileList.clear();
-
-	d = opendir(folder.c_str());
-	if (d == NULL) {
-		LOGINFO("Unable to open '%s'\n", folder.c_str());
-		if (folder != "/" && (mShowNavFolders != 0 || mShowFiles != 0)) {
-			size_t found;
-			found = folder.find_last_of('/');
-			if (found != string::npos) {
-				string new_folder = folder.substr(0, found);
+	if (mFileListJob)
+		mFileListJob->cancel = true;
 
-				if (new_folder.length() < 2)
-					new_folder = "/";
-				DataManager::SetValue(mPathVar, new_folder);
-			}
-		}
-		return -1;
-	}
+	std::shared_ptr<FileListJob> job = std::make_shared<FileListJob>();
+	job->folder = folder;
+	job->showNavFolders = mShowNavFolders;
+	job->sortOrder = mSortOrder;
 
 	if (allowDouble)
 		DataManager::GetValue("list_font", doubleLine);
 	
-	string reloadfm, searchString, showHiddenFiles;
+	string reloadfm, showHiddenFiles;
 	if (mFileFilterVar != "") {
-		searchString = TWFunc::lowercase(DataManager::GetStrValue(mFileFilterVar));
+		job->searchString = TWFunc::lowercase(DataManager::GetStrValue(mFileFilterVar));
 		showHiddenFiles = "1";
 	} else
 		if (ignoreHideVar)
 			showHiddenFiles = "0";
 		else
 			DataManager::GetValue("tw_hidden_files", showHiddenFiles);
+	job->hideHidden = (showHiddenFiles == "0");
 	DataManager::GetValue("tw_reload_fm", reloadfm);
 	if (reloadfm == "1") {
 		SetVisibleListLocation(0); // Scrolls to top
 		DataManager::SetValue("tw_reload_fm", "0");
 	}
-	
-	while ((de = readdir(d)) != NULL) {
-		FileData data;
 
-		data.fileName = de->d_name;
-		if (data.fileName == ".")
-			continue;
-		if (data.fileName == ".." && folder == "/")
-			continue;
-		
-		// [f/d] filter files by name
-		if (searchString != "" && mFileFilterVar != "") {
-			if (data.fileName != ".." && data.fileName.find(searchString) == string::npos){
-				string fileLower = TWFunc::lowercase(data.fileName);
-				if (fileLower.find(searchString) == string::npos)
-					continue;
-			}
-		}
-		
-		// [f/d] Remove hidden files/folders when tw_hidden_files = 0
-		if (showHiddenFiles == "0") {
-			if ( (folder == "/" && (data.fileName == "twres" || data.fileName == "tmp"))
-			||   (data.fileName != ".." && data.fileName.substr(0, 1) == ".")
-			||    data.fileName == "lost+found" ) {
-				hasHiddenFiles = true;
-				continue;
-			}
-		}
-		
-		if (data.fileName != "..")
-			hasFiles = true;
-		
-		data.fileType = de->d_type;
-
-		std::string path = folder + "/" + data.fileName;
-		stat(path.c_str(), &st);
-		data.protection = st.st_mode;
-		data.userId = st.st_uid;
-		data.groupId = st.st_gid;
-		data.fileSize = st.st_size;
-		data.lastAccess = st.st_atime;
-		data.lastModified = st.st_mtime;
-		data.lastStatChange = st.st_ctime;
-
-		if (data.fileType == DT_UNKNOWN) {
-			data.fileType = TWFunc::Get_D_Type_From_Stat(path);
-		}
-		if (data.fileType == DT_DIR) {
-			if (mShowNavFolders || (data.fileName != "." && data.fileName != ".."))
-				mFolderList.push_back(data);
-		} else if (data.fileType == DT_REG || data.fileType == DT_LNK || data.fileType == DT_BLK) {
 #ifdef __ANDROID_API_M__
-			std::vector<std::string> mExtnResults = android::base::Split(mExtn, ";");
-			for (const std::string& mExtnElement : mExtnResults)
-			{
-				std::string mExtnName = android::base::Trim(mExtnElement);
-				if (mExtnName.empty() || (data.fileName.length() > mExtnName.length() && TWFunc::lowercase(data.fileName.substr(data.fileName.length() - mExtnName.length())) == mExtnName)) {
-					if (mExtnName == ".ab" && twadbbu::Check_ADB_Backup_File(path)) {
-						mFolderList.push_back(data);
-					} else {
-						// [f/d] Get file extension
-						data.fileExt = TWFunc::lowercase(data.fileName.substr(data.fileName.find_last_of(".") + 1));
-						mFileList.push_back(data);
-					}
-				}
-			}
+	std::vector<std::string> mExtnResults = android::base::Split(mExtn, ";");
+	for (const std::string& mExtnElement : mExtnResults)
+		job->extensions.push_back(android::base::Trim(mExtnElement));
 #else //On android 5.1 we can't use android::base::Trim and Split so just use the first extension written in the list
-			std::size_t seppos = mExtn.find_first_of(";");
-			std::string mExtnf;
-			if (seppos!=std::string::npos){
-				mExtnf = mExtn.substr(0, seppos);
-			} else {
-				mExtnf = mExtn;
-			}
-			if (mExtnf.empty() || (data.fileName.length() > mExtnf.length() && TWFunc::lowercase(data.fileName.substr(data.fileName.length() - mExtnf.length())) == mExtnf)) {
-				if (mExtnf == ".ab" && twadbbu::Check_ADB_Backup_File(path)) {
-					mFolderList.push_back(data);
-				} else {
-					// [f/d] Get file extension
-					data.fileExt = TWFunc::lowercase(data.fileName.substr(data.fileName.find_last_of(".") + 1));
-					mFileList.push_back(data);
-				}
-			}
+	std::size_t seppos = mExtn.find_first_of(";");
+	job->extensions.push_back(seppos != std::string::npos ? mExtn.substr(0, seppos) : mExtn);
 #endif
-		}
- 	}
-	closedir(d);
 
-	std::sort(mFolderList.begin(), mFolderList.end(), fileSort);
-	std::sort(mFileList.begin(), mFileList.end(), fileSort);
+	std::shared_ptr<FileListJob>* cookie = new std::shared_ptr<FileListJob>(job);
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, &GUIFileSelector::FileListThread, cookie) == 0) {
+		pthread_detach(thread);
+	} else {
+		LOGINFO("Unable to start file list thread, reading '%s' directly\n", folder.c_str());
+		FileListThread(cookie);
+	}
+	mFileListJob = job;
+	return 0;
+}
+
+// Merges the batches read by the loader thread into the visible lists,
+// returns true if the lists changed
+bool GUIFileSelector::MergeFileList()
+{
+	std::shared_ptr<FileListJob> job = mFileListJob;
+	std::vector<FileData> folders, files;
+	bool done, failed;
+
+	pthread_mutex_lock(&job->lock);
+	folders.swap(job->folders);
+	files.swap(job->files);
+	done = job->done;
+	failed = job->failed;
+	hasFiles = job->hasFiles;
+	hasHiddenFiles = job->hasHiddenFiles;
+	pthread_mutex_unlock(&job->lock);
+
+	if (!done && folders.empty() && files.empty())
+		return false;
+
+	if (!job->merged) {
+		mFolderList.clear();
+		mFileList.clear();
+		job->merged = true;
+	}
+
+	if (failed) {
+		mFileListJob.reset();
+		const std::string& folder = job->folder;
+		LOGINFO("Unable to open '%s'\n", folder.c_str());
+		if (folder != "/" && (mShowNavFolders != 0 || mShowFiles != 0)) {
+			size_t found;
+			found = folder.find_last_of('/');
+			if (found != string::npos) {
+				string new_folder = folder.substr(0, found);
 
-	DataManager::SetValue("of_empty_dir", hasFiles ? 0 : hasHiddenFiles ? 2 : 1);
+				if (new_folder.length() < 2)
+					new_folder = "/";
+				DataManager::SetValue(mPathVar, new_folder);
+			}
+		}
+		return true;
+	}
 
-	return 0;
+	int order = job->sortOrder;
+	auto compare = [order](const FileData& d1, const FileData& d2) { return fileSort(d1, d2, order); };
+	size_t count = mFolderList.size();
+	mFolderList.insert(mFolderList.end(), std::make_move_iterator(folders.begin()), std::make_move_iterator(folders.end()));
+	std::inplace_merge(mFolderList.begin(), mFolderList.begin() + count, mFolderList.end(), compare);
+	count = mFileList.size();
+	mFileList.insert(mFileList.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+	std::inplace_merge(mFileList.begin(), mFileList.begin() + count, mFileList.end(), compare);
+
+	if (done) {
+		mFileListJob.reset();
+		DataManager::SetValue("of_empty_dir", hasFiles ? 0 : hasHiddenFiles ? 2 : 1);
+	}
+	return true;
 }
 
 void GUIFileSelector::SetPageFocus(int inFocus)
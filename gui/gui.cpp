@@ -660,7 +660,7 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 
 #ifndef PRINT_RENDER_TIME
 			if (ret > 1)
-				PageManager::Render();
+				PageManager::Render(true);
 
 			if (ret > 0)
 				flip();
@@ -670,7 +670,7 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 				timespec start, end;
 				int32_t render_t, flip_t;
 				clock_gettime(CLOCK_MONOTONIC, &start);
-				PageManager::Render();
+				PageManager::Render(true);
 				clock_gettime(CLOCK_MONOTONIC, &end);
 				render_t = TWFunc::timespec_diff_ms(start, end);
 
@@ -735,10 +735,9 @@ int gui_changeOverlay(std::string overlay)
 	return 0;
 }
 
-std::string gui_parse_text(std::string str)
+// Replaces string resources ({@resource_name} and {@resource_name=default})
+static std::string gui_parse_resources(std::string str)
 {
-	// This function parses text for DataManager values encompassed by %value% in the XML
-	// and string resources (%@resource_name%)
 	size_t pos = 0, next, end;
 
 	while (1)
@@ -764,7 +763,16 @@ std::string gui_parse_text(std::string str)
 			str.insert(next, PageManager::GetResources()->FindString(lookup, default_string));
 		}
 	}
-	pos = 0;
+	return str;
+}
+
+std::string gui_parse_text(std::string str)
+{
+	// This function parses text for DataManager values encompassed by %value% in the XML
+	// and string resources (%@resource_name%)
+	size_t pos = 0, next, end;
+
+	str = gui_parse_resources(str);
 	while (1)
 	{
 		next = str.find('%', pos);
@@ -797,6 +805,24 @@ std::string gui_parse_text(std::string str)
 	}
 }
 
+void gui_parse_text_vars(std::string str, std::vector<std::string>& vars)
+{
+	size_t pos = 0, next, end;
+
+	str = gui_parse_resources(str);
+	while ((next = str.find('%', pos)) != std::string::npos)
+	{
+		end = str.find('%', next + 1);
+		if (end == std::string::npos)
+			break;
+
+		// "%%" is a literal percent sign, "%@name%" a string resource
+		if (next + 1 != end && str[next + 1] != '@')
+			vars.push_back(str.substr(next + 1, (end - next) - 1));
+		pos = end + 1;
+	}
+}
+
 std::string gui_lookup(const std::string& resource_name, const std::string& default_value) {
 	return PageManager::GetResources()->FindString(resource_name, default_value);
 }
@@ -868,6 +894,10 @@ extern "C" int gui_loadResources(void)
 			}
 		}
 
+		// Compiled themes and decoded images are kept on settings storage so later boots skip that work
+		if (!check)
+			PageManager::SetCacheDir(theme_path + "/Fox/.cache");
+
 		theme_path += "/Fox/.bin./pa.zip"; 
 		if (check || PageManager::LoadPackage("OrangeFox", theme_path, "main"))
 		{
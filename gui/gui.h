@@ -30,6 +30,12 @@ void gui_print(const char *fmt, ...);
 void gui_print_color(const char *color, const char *fmt, ...);
 void gui_set_FILE(FILE* f);
 
+// Recovery log, see logwriter.cpp
+void gui_log_start();
+void gui_log_write(char severity, int ors, const char* text, size_t len);
+void gui_log_printf(char severity, const char *fmt, ...);
+void gui_log_flush();
+
 void set_scale_values(float w, float h);
 int scale_theme_x(int initial_x);
 int scale_theme_y(int initial_y);
@@ -19,6 +19,8 @@
 #ifndef _GUI_HPP_HEADER
 #define _GUI_HPP_HEADER
 
+#include <string>
+#include <vector>
 #include "twmsg.h"
 
 void set_select_fd();
@@ -32,6 +34,8 @@ void gui_err(Message msg);
 
 extern long mime;
 std::string gui_parse_text(std::string inText);
+// Adds the names of the %variables% gui_parse_text() would look up in inText
+void gui_parse_text_vars(std::string inText, std::vector<std::string>& vars);
 std::string gui_lookup(const std::string& resource_name, const std::string& default_value);
 
 #endif //_GUI_HPP_HEADER
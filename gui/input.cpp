@@ -435,6 +435,13 @@ int GUIInput::NotifyVarChange(const std::string& varName, const std::string& val
 	return 0;
 }
 
+bool GUIInput::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIObject::GetVarSubscriptions(vars);
+	vars.push_back(mVariable);
+	return true;
+}
+
 int GUIInput::NotifyKey(int key, bool down)
 {
 	if (!HasInputFocus || !down)
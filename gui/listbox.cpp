@@ -371,6 +371,21 @@ int GUIListBox::NotifyVarChange(const std::string& varName, const std::string& v
 	return 0;
 }
 
+bool GUIListBox::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetVarSubscriptions(vars);
+	vars.push_back(mVariable);
+	for (size_t i = 0; i < mListItems.size(); i++) {
+		const ListItem& item = mListItems[i];
+		GetConditionVars(item.mConditions, vars);
+		if (isCheckList)
+			vars.push_back(item.variableName);
+		if (requireReload)
+			gui_parse_text_vars(item.unparsedName, vars);
+	}
+	return true;
+}
+
 void GUIListBox::SetPageFocus(int inFocus)
 {
 	GUIScrollList::SetPageFocus(inFocus);
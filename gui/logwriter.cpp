@@ -0,0 +1,310 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// logwriter.cpp - Asynchronous writer for the recovery log
+//
+// Producers push records onto a lock-free multi-producer queue and return.
+// One writer thread drains the queue and writes whole batches to stdout (the
+// tmp log) and to the ORS output file. Until the writer is started, and in
+// forked children where it does not exist, records are written directly.
+
+#include <errno.h>
+#include <new>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+
+extern "C" {
+#include "../twcommon.h"
+}
+
+#define LOG_PRINTF_BUFFER_SIZE 1024
+#define LOG_WRITE_BATCH_SIZE (64 * 1024)
+
+struct LogRecord
+{
+	std::atomic<LogRecord*> next;
+	char severity;
+	bool ors;
+	size_t len;
+	char text[1];
+};
+
+// Vyukov style intrusive queue: producers swap themselves into log_head,
+// only the writer thread touches log_tail
+static LogRecord log_stub;
+static std::atomic<LogRecord*> log_head(&log_stub);
+static LogRecord* log_tail = &log_stub;
+
+static sem_t log_sem;
+static std::atomic<bool> log_running(false);
+static std::atomic<unsigned long long> log_queued(0);
+static unsigned long long log_written = 0; // protected by log_flush_lock
+static pthread_mutex_t log_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_flush_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t log_direct_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* ors_file = NULL;
+static bool log_line_start = true; // writer thread, or log_direct_lock when not running
+
+static void log_push(LogRecord* rec)
+{
+	rec->next.store(NULL, std::memory_order_relaxed);
+	LogRecord* prev = log_head.exchange(rec, std::memory_order_acq_rel);
+	prev->next.store(rec, std::memory_order_release);
+}
+
+// Return the oldest record, or NULL if the queue is empty or a push is still in progress
+static LogRecord* log_pop()
+{
+	LogRecord* tail = log_tail;
+	LogRecord* next = tail->next.load(std::memory_order_acquire);
+	if (tail == &log_stub) {
+		if (!next)
+			return NULL;
+		log_tail = tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next) {
+		log_tail = next;
+		return tail;
+	}
+	if (tail != log_head.load(std::memory_order_acquire))
+		return NULL; // the writer will be woken again once that push completes
+	log_push(&log_stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next) {
+		log_tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+// Errors and warnings get the same "E:"/"W:" marker LOGERR puts in its text, unless
+// the line already starts with it. Other lines are written as they are, like the
+// output of child processes and scripts that end up in the same log.
+static void log_format(std::string& out, const LogRecord* rec)
+{
+	const char* text = rec->text;
+	const char* end = rec->text + rec->len;
+	while (text < end) {
+		if (log_line_start) {
+			if ((rec->severity == 'E' || rec->severity == 'W') && (end - text < 2 || text[0] != rec->severity || text[1] != ':')) {
+				out += rec->severity;
+				out += ':';
+			}
+			log_line_start = false;
+		}
+		const char* nl = (const char*)memchr(text, '\n', end - text);
+		if (!nl) {
+			out.append(text, end - text);
+			break;
+		}
+		out.append(text, nl + 1 - text);
+		log_line_start = true;
+		text = nl + 1;
+	}
+}
+
+static void log_write_fd(int fd, const std::string& data)
+{
+	size_t done = 0;
+	while (done < data.size()) {
+		ssize_t ret = write(fd, data.data() + done, data.size() - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		done += ret;
+	}
+}
+
+static void log_write_ors(const std::string& data)
+{
+	if (ors_file && !data.empty()) {
+		fwrite(data.data(), 1, data.size(), ors_file);
+		fflush(ors_file);
+	}
+}
+
+static void* log_writer_thread(void* cookie __unused)
+{
+	std::string out, ors;
+	for (;;) {
+		while (sem_wait(&log_sem) != 0 && errno == EINTR)
+			;
+
+		unsigned long long count = 0;
+		LogRecord* rec;
+		while ((rec = log_pop()) != NULL) {
+			log_format(out, rec);
+			if (rec->ors)
+				ors.append(rec->text, rec->len);
+			free(rec);
+			count++;
+			if (out.size() >= LOG_WRITE_BATCH_SIZE) {
+				log_write_fd(STDOUT_FILENO, out);
+				out.clear();
+			}
+		}
+		log_write_fd(STDOUT_FILENO, out);
+		out.clear();
+		if (count == 0)
+			continue;
+
+		pthread_mutex_lock(&log_flush_lock);
+		log_write_ors(ors);
+		log_written += count;
+		pthread_cond_broadcast(&log_flush_cond);
+		pthread_mutex_unlock(&log_flush_lock);
+		ors.clear();
+	}
+	return NULL;
+}
+
+static void log_write_direct(LogRecord* rec)
+{
+	std::string out;
+	pthread_mutex_lock(&log_direct_lock);
+	log_format(out, rec);
+	log_write_fd(STDOUT_FILENO, out);
+	if (rec->ors)
+		log_write_ors(std::string(rec->text, rec->len));
+	pthread_mutex_unlock(&log_direct_lock);
+	free(rec);
+}
+
+static void log_fork_prepare()
+{
+	// keep the parent's output ahead of anything the child writes
+	gui_log_flush();
+}
+
+static void log_fork_child()
+{
+	// the writer thread does not exist in the child, records still queued belong to the parent
+	log_running.store(false);
+	pthread_mutex_init(&log_flush_lock, NULL);
+	pthread_mutex_init(&log_direct_lock, NULL);
+	log_stub.next.store(NULL);
+	log_head.store(&log_stub);
+	log_tail = &log_stub;
+}
+
+static void log_exit()
+{
+	gui_log_flush();
+}
+
+extern "C" void gui_log_start()
+{
+	if (log_running.load())
+		return;
+
+	sem_init(&log_sem, 0, 0);
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, log_writer_thread, NULL) != 0) {
+		pthread_attr_destroy(&attr);
+		return; // keep writing directly
+	}
+	pthread_attr_destroy(&attr);
+	pthread_atfork(log_fork_prepare, NULL, log_fork_child);
+	atexit(log_exit);
+	log_running.store(true);
+}
+
+extern "C" void gui_log_write(char severity, int ors, const char* text, size_t len)
+{
+	LogRecord* rec = (LogRecord*)malloc(sizeof(LogRecord) + len);
+	if (!rec)
+		return;
+	new (rec) LogRecord;
+	rec->severity = severity;
+	rec->ors = ors != 0;
+	rec->len = len;
+	memcpy(rec->text, text, len);
+	rec->text[len] = '\0';
+
+	if (!log_running.load(std::memory_order_acquire)) {
+		log_write_direct(rec);
+		return;
+	}
+
+	log_queued.fetch_add(1, std::memory_order_acq_rel);
+	log_push(rec);
+	sem_post(&log_sem);
+
+	// errors are written through so they are never lost if something goes wrong next
+	if (severity == 'E')
+		gui_log_flush();
+}
+
+extern "C" void gui_log_printf(char severity, const char *fmt, ...)
+{
+	char buf[LOG_PRINTF_BUFFER_SIZE];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len < (int)sizeof(buf)) {
+		gui_log_write(severity, 0, buf, len);
+		return;
+	}
+
+	std::string big(len, '\0');
+	va_start(ap, fmt);
+	vsnprintf(&big[0], len + 1, fmt, ap);
+	va_end(ap);
+	gui_log_write(severity, 0, big.data(), len);
+}
+
+extern "C" void gui_log_flush()
+{
+	if (!log_running.load(std::memory_order_acquire))
+		return;
+
+	// every record counted before this point has been pushed once this many records are written
+	unsigned long long target = log_queued.load(std::memory_order_acquire);
+	pthread_mutex_lock(&log_flush_lock);
+	while (log_written < target && log_running.load())
+		pthread_cond_wait(&log_flush_cond, &log_flush_lock);
+	pthread_mutex_unlock(&log_flush_lock);
+}
+
+extern "C" void gui_set_FILE(FILE* f)
+{
+	gui_log_flush();
+	pthread_mutex_lock(&log_flush_lock);
+	pthread_mutex_lock(&log_direct_lock);
+	ors_file = f;
+	pthread_mutex_unlock(&log_direct_lock);
+	pthread_mutex_unlock(&log_flush_lock);
+}
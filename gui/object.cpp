@@ -20,7 +20,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <set>
+#include <sstream>
 #include <string>
 
 extern "C" {
@@ -61,6 +67,12 @@ void GUIObject::LoadConditions(xml_node<>* node, std::vector<Condition>& conditi
 		attr = condition->first_attribute("var2");
 		if (attr)   cond.mVar2 = attr->value();
 
+		cond.mVar1Id = DataManager::GetVarId(cond.mVar1);
+		cond.mVar2Id = DataManager::GetVarId(cond.mVar2);
+		// "modified" depends on mLastVal and files can change at any time
+		cond.mCacheable = cond.mCompareOp != "modified" && cond.mVar1 != "fileexists"
+			&& !DataManager::IsDynamicVar(cond.mVar1Id) && !DataManager::IsDynamicVar(cond.mVar2Id);
+
 		conditions.push_back(cond);
 
 		condition = condition->next_sibling("condition");
@@ -88,6 +100,28 @@ bool GUIObject::isConditionTrue()
 }
 
 bool GUIObject::isConditionTrue(Condition* condition)
+{
+	if (!condition->mCacheable)
+		return EvaluateCondition(condition);
+
+	// Reuse the last result while neither variable nor (for "mounted") the mount table changed
+	unsigned var1Version = DataManager::GetVarVersion(condition->mVar1Id);
+	unsigned var2Version = DataManager::GetVarVersion(condition->mVar2Id);
+	unsigned mountsVersion = condition->mVar1 == "mounted" ? GetMountsVersion() : 0;
+	if (condition->mEvaluated && var1Version == condition->mVar1Version
+		&& var2Version == condition->mVar2Version && mountsVersion == condition->mMountsVersion)
+		return condition->mLastResult;
+
+	bool result = EvaluateCondition(condition);
+	condition->mVar1Version = var1Version;
+	condition->mVar2Version = var2Version;
+	condition->mMountsVersion = mountsVersion;
+	condition->mEvaluated = true;
+	condition->mLastResult = result;
+	return result;
+}
+
+bool GUIObject::EvaluateCondition(Condition* condition)
 {
 	// This is used to hold the proper value of "true" based on the '!' NOT flag
 	bool bTrue = true;
@@ -100,16 +134,16 @@ bool GUIObject::isConditionTrue(Condition* condition)
 
 	if (condition->mVar2.empty() && condition->mCompareOp != "modified")
 	{
-		if (!DataManager::GetStrValue(condition->mVar1).empty())
+		if (!DataManager::GetStrValue(condition->mVar1Id).empty())
 			return bTrue;
 
 		return !bTrue;
 	}
 
 	string var1, var2;
-	if (DataManager::GetValue(condition->mVar1, var1))
+	if (DataManager::GetValue(condition->mVar1Id, var1))
 		var1 = condition->mVar1;
-	if (DataManager::GetValue(condition->mVar2, var2))
+	if (DataManager::GetValue(condition->mVar2Id, var2))
 		var2 = condition->mVar2;
 
 	if (var2.substr(0, 2) == "{@")
@@ -169,6 +203,24 @@ int GUIObject::NotifyVarChange(const std::string& varName, const std::string& va
 	return 0;
 }
 
+bool GUIObject::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GetConditionVars(mConditions, vars);
+	return true;
+}
+
+void GUIObject::GetConditionVars(const std::vector<Condition>& conditions, std::vector<std::string>& vars)
+{
+	std::vector<Condition>::const_iterator iter;
+	for (iter = conditions.begin(); iter != conditions.end(); ++iter)
+	{
+		if (!iter->mVar1.empty())
+			vars.push_back(iter->mVar1);
+		if (!iter->mVar2.empty())
+			vars.push_back(iter->mVar2);
+	}
+}
+
 bool GUIObject::UpdateConditions(std::vector<Condition>& conditions, const std::string& varName)
 {
 	bool result = true;
@@ -182,10 +234,10 @@ bool GUIObject::UpdateConditions(std::vector<Condition>& conditions, const std::
 			string val;
 
 			// If this fails, val will not be set, which is perfect
-			if (DataManager::GetValue(iter->mVar1, val))
+			if (DataManager::GetValue(iter->mVar1Id, val))
 			{
 				DataManager::SetValue(iter->mVar1, "");
-				DataManager::GetValue(iter->mVar1, val);
+				DataManager::GetValue(iter->mVar1Id, val);
 			}
 			iter->mLastVal = val;
 		}
@@ -199,26 +251,64 @@ bool GUIObject::UpdateConditions(std::vector<Condition>& conditions, const std::
 	return result;
 }
 
-bool GUIObject::isMounted(string vol)
+// /proc/mounts reports POLLPRI after every mount or unmount, so the mount
+// points are only read again after the mount table changed
+static pthread_mutex_t mounts_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mounts_fd = -1;
+static unsigned mounts_version = 0;
+static std::set<std::string> mount_points;
+
+static void read_mount_points()
 {
-	FILE *fp;
-	char tmpOutput[255];
+	std::string mounts;
+	char buf[4096];
+	ssize_t len;
+
+	lseek(mounts_fd, 0, SEEK_SET);
+	while ((len = read(mounts_fd, buf, sizeof(buf))) > 0)
+		mounts.append(buf, len);
+
+	mount_points.clear();
+	std::istringstream lines(mounts);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		std::istringstream fields(line);
+		std::string device, mnt;
+		if (fields >> device >> mnt)
+			mount_points.insert(mnt);
+	}
+	mounts_version++;
+}
 
-	fp = fopen("/proc/mounts", "rt");
-	while (fgets(tmpOutput,255,fp) != NULL)
+unsigned GUIObject::GetMountsVersion()
+{
+	pthread_mutex_lock(&mounts_lock);
+	if (mounts_fd < 0)
 	{
-		char* mnt = tmpOutput;
-		while (*mnt > 32)			mnt++;
-		while (*mnt > 0 && *mnt <= 32)	mnt++;
-		char* pos = mnt;
-		while (*pos > 32)   pos++;
-		*pos = 0;
-		if (vol == mnt)
-		{
-			fclose(fp);
-			return true;
-		}
+		mounts_fd = open("/proc/mounts", O_RDONLY | O_CLOEXEC);
+		if (mounts_fd >= 0)
+			read_mount_points();
 	}
-	fclose(fp);
-	return false;
+	else
+	{
+		struct pollfd pfd;
+		pfd.fd = mounts_fd;
+		pfd.events = POLLPRI;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR)))
+			read_mount_points();
+	}
+	unsigned version = mounts_version;
+	pthread_mutex_unlock(&mounts_lock);
+	return version;
+}
+
+bool GUIObject::isMounted(string vol)
+{
+	GetMountsVersion();
+	pthread_mutex_lock(&mounts_lock);
+	bool mounted = mount_points.count(vol) != 0;
+	pthread_mutex_unlock(&mounts_lock);
+	return mounted;
 }
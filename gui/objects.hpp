@@ -22,9 +22,11 @@
 #define _OBJECTS_HEADER
 
 #include "rapidxml.hpp"
+#include <deque>
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
 #include <set>
 #include <time.h>
 //#include <openssl/sha.h>
@@ -72,6 +74,10 @@ public:
 	//  Return 0 on success, <0 on error
 	virtual int SetRenderPos(int x, int y, int w = 0, int h = 0) { mRenderX = x; mRenderY = y; if (w || h) { mRenderW = w; mRenderH = h; } return 0; }
 
+	// GetDamageRect - Returns the screen area covered by everything Render() may draw
+	//  Return 0 on success, <0 if unknown, in which case a render request redraws the whole page
+	virtual int GetDamageRect(int& x __unused, int& y __unused, int& w __unused, int& h __unused) { return -1; }
+
 	// GetPlacement - Returns the current placement
 	virtual int GetPlacement(Placement& placement) { placement = mPlacement; return 0; }
 
@@ -130,19 +136,37 @@ public:
 	//  Returns 0 on success, <0 on error
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
 
+	// GetVarSubscriptions - Adds the variables NotifyVarChange reacts to
+	//  Return false to be notified of every variable change instead
+	//  Changes to "" (reload everything) always reach every object
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
+
 protected:
 	class Condition
 	{
 	public:
 		Condition() {
 			mLastResult = true;
+			mVar1Id = mVar2Id = -1;
+			mCacheable = false;
+			mEvaluated = false;
+			mVar1Version = mVar2Version = mMountsVersion = 0;
 		}
 
 		std::string mVar1;
 		std::string mVar2;
+		int mVar1Id; // DataManager ids of mVar1 and mVar2
+		int mVar2Id;
 		std::string mCompareOp;
 		std::string mLastVal;
 		bool mLastResult;
+
+		// mLastResult stays valid until one of these inputs changes
+		bool mCacheable; // false if the result depends on something we can't track
+		bool mEvaluated;
+		unsigned mVar1Version;
+		unsigned mVar2Version;
+		unsigned mMountsVersion;
 	};
 
 	std::vector<Condition> mConditions;
@@ -150,8 +174,11 @@ protected:
 protected:
 	static void LoadConditions(xml_node<>* node, std::vector<Condition>& conditions);
 	static bool isMounted(std::string vol);
+	static unsigned GetMountsVersion();
 	static bool isConditionTrue(Condition* condition);
+	static bool EvaluateCondition(Condition* condition);
 	static bool UpdateConditions(std::vector<Condition>& conditions, const std::string& varName);
+	static void GetConditionVars(const std::vector<Condition>& conditions, std::vector<std::string>& vars);
 
 	bool mConditionsResult;
 };
@@ -193,8 +220,12 @@ public:
 	// Retrieve the size of the current string (dynamic strings may change per call)
 	virtual int GetCurrentBounds(int& w, int& h);
 
+	// Returns the area any value of the text may cover
+	virtual int GetDamageRect(int& x, int& y, int& w, int& h);
+
 	// Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// Set maximum width in pixels
 	virtual int SetMaxWidth(unsigned width);
@@ -432,6 +463,7 @@ protected:
 	int repackimage(std::string arg);
 	int fixabrecoverybootloop(std::string arg);
 	int ftls(std::string arg);
+	int bootprofile(std::string arg);
 
 	int enableadb(std::string arg);
 	int enablefastboot(std::string arg);
@@ -556,6 +588,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// SetPos - Update the position of the render object
 	//  Return 0 on success, <0 on error
@@ -564,6 +597,9 @@ public:
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
 
+	// GetDamageRect - The list, header and scrollbar are all drawn inside the render box
+	virtual int GetDamageRect(int& x, int& y, int& w, int& h) { return GetRenderPos(x, y, w, h); }
+
 protected:
 	// derived classes need to implement these
 	// get number of items
@@ -667,6 +703,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -678,6 +715,7 @@ public:
 protected:
 	struct FileData {
 		std::string fileName;
+		std::string sortName;		// lowercase fileName, precomputed for sorting
 		std::string fileExt;
 		unsigned char fileType;	 // Uses d_type format from struct dirent
 		mode_t protection;		  // Uses mode_t format from stat
@@ -689,9 +727,14 @@ protected:
 		time_t lastStatChange;	  // Uses time_t format from stat
 	};
 
+	// Directory listing loaded on a background thread, see fileselector.cpp
+	struct FileListJob;
+
 protected:
 	virtual int GetFileList(const std::string folder);
-	static bool fileSort(FileData d1, FileData d2);
+	bool MergeFileList();
+	static void* FileListThread(void* cookie);
+	static bool fileSort(const FileData& d1, const FileData& d2, int sortOrder);
 
 protected:
 	std::vector<FileData> mFolderList;
@@ -706,7 +749,7 @@ protected:
 	int mShowFolders, mShowFiles; // indicates if the list should show folders and/or files
 	int mShowNavFolders; // indicates if the list should include the "up a level" item and allow you to traverse folders (nav folders are disabled for the restore list, for instance)
 	bool ignoreHideVar; // [f/d] show or hide hidden files (., temp, twres, lost+found). Ignores tw_hidden_files
-	static int mSortOrder; // must be static because it is used by the static function fileSort
+	int mSortOrder; // sort order applied to the next listing, see fileSort
 	ImageResource* mFolderIcon;
 	ImageResource* mFileIcon;
 	ImageResource* mUpIcon;
@@ -719,6 +762,7 @@ protected:
 	ImageResource* mExSelectedIcon;
 	ImageResource* mExUnselectedIcon;
 	bool updateFileList;
+	std::shared_ptr<FileListJob> mFileListJob; // listing currently being loaded
 	bool hasFiles, hasHiddenFiles;
 	int doubleLine = 0;
 	bool mSelListEnabled; // [f/d] is multiselection enabled
@@ -741,6 +785,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -790,6 +835,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -828,6 +874,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// ScrollList interface
 	virtual size_t GetItemCount();
@@ -865,6 +912,9 @@ public:
 	//  Return 0 on success, >0 to ignore remainder of touch, and <0 on error (Return error to allow other handlers)
 	virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
 
+	// GetDamageRect - The slideout button lives outside the console box
+	virtual int GetDamageRect(int& x, int& y, int& w, int& h) { return mSlideout ? -1 : GUIScrollList::GetDamageRect(x, y, w, h); }
+
 	// ScrollList interface
 	virtual size_t GetItemCount();
 	virtual void RenderItem(size_t itemindex, int yPos, bool selected);
@@ -881,16 +931,26 @@ protected:
 		request_show
 	};
 
+	// One display row: part of a console line as wrapped for this console's width
+	struct ConsoleRow
+	{
+		size_t line;  // number of the console line
+		size_t start; // offset of the row in the line
+		size_t length;
+	};
+
 	ImageResource* mSlideoutImage;
-	size_t mLastCount; // lines from gConsole that are already split and copied into rConsole
+	size_t mLastCount; // console lines below this number are already split into rConsole
+	int mWrapWidth; // width and font rConsole was wrapped for
+	void* mWrapFont;
 	bool scrollToEnd; // true if we want to keep tracking the last line
 	int mSlideoutX, mSlideoutY, mSlideoutW, mSlideoutH;
 	int mSlideout;
 	SlideoutState mSlideoutState;
-	std::vector<std::string> rConsole;
-	std::vector<std::string> rConsoleColor;
+	std::deque<ConsoleRow> rConsole;
 
 protected:
+	bool WrapLines(void);
 	int RenderSlideout(void);
 	int RenderConsole(void);
 };
@@ -950,6 +1010,9 @@ public:
 	//  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
 	virtual int Update(void);
 
+	// GetDamageRect - Frames are blitted at the render position
+	virtual int GetDamageRect(int& x, int& y, int& w, int& h) { return GetRenderPos(x, y, w, h); }
+
 protected:
 	AnimationResource* mAnimation;
 	int mFrame;
@@ -976,6 +1039,10 @@ public:
 	// NotifyVarChange - Notify of a variable change
 	//  Returns 0 on success, <0 on error
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
+
+	// GetDamageRect - Both bars are blitted inside the render box
+	virtual int GetDamageRect(int& x, int& y, int& w, int& h) { return GetRenderPos(x, y, w, h); }
 
 protected:
 	ImageResource* mEmptyBar;
@@ -1128,6 +1195,7 @@ public:
 
 	// Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// NotifyTouch - Notify of a touch event
 	//  Return 0 on success, >0 to ignore remainder of touch, and <0 on error
@@ -1227,6 +1295,7 @@ public:
 
 	// Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -1308,6 +1377,7 @@ public:
 	virtual int Update(void);
 	virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetVarSubscriptions(std::vector<std::string>& vars);
 	virtual int SetRenderPos(int x, int y, int w = 0, int h = 0);
 
 protected:
@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <android-base/properties.h>
 #include "../twrp-functions.hpp"
 #include "../partitions.hpp"
 
@@ -62,6 +63,8 @@ extern "C" {
 #include "rapidxml.hpp"
 #include "objects.hpp"
 #include "blanktimer.hpp"
+#include "themeblob.hpp"
+#include "../twrpProfiler.hpp"
 
 // version 2 requires theme to handle power button as action togglebacklight
 #define TW_THEME_VERSION 3
@@ -77,6 +80,8 @@ MouseCursor *PageManager::mMouseCursor = NULL;
 HardwareKeyboard *PageManager::mHardwareKeyboard = NULL;
 bool PageManager::mReloadTheme = false;
 std::string PageManager::mStartPage = "main";
+DamageRect PageManager::mDamage;
+std::string PageManager::mCacheDir;
 std::vector<language_struct> Language_List;
 long mime;
 
@@ -85,6 +90,38 @@ int tw_y_offset = 0;
 int tw_w_offset = 0;
 int tw_h_offset = 0;
 
+void DamageRect::Add(int ax, int ay, int aw, int ah)
+{
+	if (full || aw <= 0 || ah <= 0)
+		return;
+
+	if (IsEmpty()) {
+		x = ax; y = ay; w = aw; h = ah;
+		return;
+	}
+
+	int x1 = std::max(x + w, ax + aw);
+	int y1 = std::max(y + h, ay + ah);
+	x = std::min(x, ax);
+	y = std::min(y, ay);
+	w = x1 - x;
+	h = y1 - y;
+}
+
+bool DamageRect::Intersects(int ax, int ay, int aw, int ah) const
+{
+	if (full)
+		return true;
+	return ax < x + w && x < ax + aw && ay < y + h && y < ay + ah;
+}
+
+bool DamageRect::Contains(int ax, int ay, int aw, int ah) const
+{
+	if (full)
+		return true;
+	return ax >= x && ay >= y && ax + aw <= x + w && ay + ah <= y + h;
+}
+
 // Helper routine to convert a string to a color declaration
 int ConvertStrToColor(std::string str, COLOR* color)
 {
@@ -296,6 +333,8 @@ int ActionObject::SetActionPos(int x, int y, int w, int h)
 Page::Page(xml_node<>* page, std::vector<xml_node<>*> *templates)
 {
 	mTouchStart = NULL;
+	mConditionsChanged = false;
+	mVarSubscribersValid = false;
 
 	// We can memset the whole structure, because the alpha channel is ignored
 	memset(&mBackground, 0, sizeof(COLOR));
@@ -545,7 +584,7 @@ bool Page::ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, in
 	return true;
 }
 
-int Page::Render(void)
+int Page::Render(const DamageRect* damage)
 {
 	// Render background
 	gr_color(mBackground.red, mBackground.green, mBackground.blue, mBackground.alpha);
@@ -555,13 +594,33 @@ int Page::Render(void)
 	std::vector<RenderObject*>::iterator iter;
 	for (iter = mRenders.begin(); iter != mRenders.end(); iter++)
 	{
+		int x, y, w, h;
+		if (damage && (*iter)->GetDamageRect(x, y, w, h) == 0 && !damage->Intersects(x, y, w, h))
+			continue;
+
 		if ((*iter)->Render())
 			LOGERR("A render request has failed.\n");
 	}
 	return 0;
 }
 
-int Page::Update(void)
+bool Page::GrowDamage(DamageRect& damage)
+{
+	bool grown = false;
+
+	std::vector<RenderObject*>::iterator iter;
+	for (iter = mRenders.begin(); iter != mRenders.end(); iter++)
+	{
+		int x, y, w, h;
+		if ((*iter)->GetDamageRect(x, y, w, h) == 0 && damage.Intersects(x, y, w, h) && !damage.Contains(x, y, w, h)) {
+			damage.Add(x, y, w, h);
+			grown = true;
+		}
+	}
+	return grown;
+}
+
+int Page::Update(DamageRect* damage)
 {
 	int retCode = 0;
 
@@ -573,6 +632,22 @@ int Page::Update(void)
 			LOGERR("An update request has failed.\n");
 		else if (ret > retCode)
 			retCode = ret;
+
+		// Objects returning 1 have already drawn themselves, their area still has to be flipped
+		if (ret > 0 && damage) {
+			int x, y, w, h;
+			if ((*iter)->GetDamageRect(x, y, w, h) == 0)
+				damage->Add(x, y, w, h);
+			else
+				damage->SetFull();
+		}
+	}
+
+	// Objects shown or hidden by a condition can be anywhere on the page
+	if (mConditionsChanged && retCode > 1) {
+		mConditionsChanged = false;
+		if (damage)
+			damage->SetFull();
 	}
 
 	return retCode;
@@ -677,14 +752,70 @@ void Page::SetPageFocus(int inFocus)
 	return;
 }
 
-int Page::NotifyVarChange(std::string varName, std::string value)
+void Page::BuildVarSubscribers()
 {
-	std::vector<GUIObject*>::iterator iter;
-	for (iter = mObjects.begin(); iter != mObjects.end(); ++iter)
+	mVarSubscribers.clear();
+	mAnyVarSubscribers.clear();
+
+	std::vector<std::string> vars;
+	for (std::vector<GUIObject*>::iterator iter = mObjects.begin(); iter != mObjects.end(); ++iter)
 	{
-		if ((*iter)->NotifyVarChange(varName, value))
-			LOGERR("An action handler errored on NotifyVarChange.\n");
+		vars.clear();
+		bool subscribed = (*iter)->GetVarSubscriptions(vars);
+		// Dynamic values like the time never get notified, objects showing them
+		// used to refresh on whatever else changed, so keep doing that
+		for (std::vector<std::string>::iterator var = vars.begin(); subscribed && var != vars.end(); ++var)
+			if (DataManager::IsDynamicVar(DataManager::GetVarId(*var)))
+				subscribed = false;
+		if (!subscribed) {
+			// Keep page order: it goes after everything already subscribed to any variable
+			for (auto& subscribers : mVarSubscribers)
+				subscribers.second.push_back(*iter);
+			mAnyVarSubscribers.push_back(*iter);
+			continue;
+		}
+		for (std::vector<std::string>::iterator var = vars.begin(); var != vars.end(); ++var)
+		{
+			if (var->empty())
+				continue;
+			std::unordered_map<std::string, std::vector<GUIObject*> >::iterator it = mVarSubscribers.find(*var);
+			if (it == mVarSubscribers.end())
+				it = mVarSubscribers.insert(std::make_pair(*var, mAnyVarSubscribers)).first;
+			if (it->second.empty() || it->second.back() != *iter)
+				it->second.push_back(*iter);
+		}
 	}
+	mVarSubscribersValid = true;
+}
+
+void Page::NotifyObjectVarChange(GUIObject* object, const std::string& varName, const std::string& value)
+{
+	bool wasTrue = object->isConditionTrue();
+	if (object->NotifyVarChange(varName, value))
+		LOGERR("An action handler errored on NotifyVarChange.\n");
+	if (object->isConditionTrue() != wasTrue)
+		mConditionsChanged = true;
+}
+
+int Page::NotifyVarChange(std::string varName, std::string value)
+{
+	if (varName.empty()) {
+		// Everything gets reloaded, which may also change what objects depend on
+		mVarSubscribersValid = false;
+		std::vector<GUIObject*>::iterator iter;
+		for (iter = mObjects.begin(); iter != mObjects.end(); ++iter)
+			NotifyObjectVarChange(*iter, varName, value);
+		return 0;
+	}
+
+	if (!mVarSubscribersValid)
+		BuildVarSubscribers();
+
+	// Copy the list, objects may set variables and cause a rebuild while we go through it
+	std::unordered_map<std::string, std::vector<GUIObject*> >::const_iterator it = mVarSubscribers.find(varName);
+	std::vector<GUIObject*> subscribers(it != mVarSubscribers.end() ? it->second : mAnyVarSubscribers);
+	for (std::vector<GUIObject*>::iterator iter = subscribers.begin(); iter != subscribers.end(); ++iter)
+		NotifyObjectVarChange(*iter, varName, value);
 	return 0;
 }
 
@@ -699,14 +830,20 @@ struct LoadingContext
 	std::vector<char*> xmlbuffers; // text buffers with xml content
 	std::vector<xml_node<>*> styles; // refer to <styles> nodes inside xmldocs
 	std::vector<xml_node<>*> templates; // refer to <templates> nodes inside xmldocs
+	ThemeBlob* blob; // compiled theme to load documents from instead of XML, or NULL
+	ThemeBlob* recorder; // collects parsed documents to compile the theme, or NULL
 
 	LoadingContext()
 	{
 		zip = NULL;
+		blob = NULL;
+		recorder = NULL;
 	}
 
 	~LoadingContext()
 	{
+		for (std::vector<xml_document<>*>::iterator it = xmldocs.begin(); it != xmldocs.end(); ++it)
+			delete *it;
 		// free all xml buffers
 		for (std::vector<char*>::iterator it = xmlbuffers.begin(); it != xmlbuffers.end(); ++it)
 			free(*it);
@@ -737,21 +874,32 @@ PageSet::~PageSet()
 
 int PageSet::Load(LoadingContext& ctx, const std::string& filename)
 {
-	bool isMain = ctx.xmlbuffers.empty(); // if we have no files yet, remember that this is the main XML file
+	bool isMain = ctx.xmldocs.empty(); // if we have no files yet, remember that this is the main XML file
 
 	if (!ctx.filenames.insert(filename).second)
 		// ignore already loaded files to prevent crash with cyclic includes
 		return 0;
 
-	// load XML into buffer
-	char* xmlbuffer = PageManager::LoadFileToBuffer(filename, ctx.zip);
-	if (!xmlbuffer)
-		return -1; // error already displayed by LoadFileToBuffer
-	ctx.xmlbuffers.push_back(xmlbuffer);
-
-	// parse XML
-	xml_document<>* doc = new xml_document<>();
-	doc->parse<0>(xmlbuffer);
+	xml_document<>* doc;
+	if (ctx.blob) {
+		doc = ctx.blob->GetDocument(filename);
+		if (!doc) {
+			LOGINFO("'%s' is not part of the compiled theme\n", filename.c_str());
+			return -1;
+		}
+	} else {
+		// load XML into buffer
+		char* xmlbuffer = PageManager::LoadFileToBuffer(filename, ctx.zip);
+		if (!xmlbuffer)
+			return -1; // error already displayed by LoadFileToBuffer
+		ctx.xmlbuffers.push_back(xmlbuffer);
+
+		// parse XML
+		doc = new xml_document<>();
+		doc->parse<0>(xmlbuffer);
+		if (ctx.recorder)
+			ctx.recorder->AddDocument(filename, doc);
+	}
 	ctx.xmldocs.push_back(doc);
 
 	xml_node<>* root = doc->first_node("recovery");
@@ -1157,36 +1305,56 @@ std::string PageSet::GetCurrentPage() const
 	return mCurrentPage ? mCurrentPage->GetName() : "";
 }
 
-int PageSet::Render(void)
+int PageSet::Render(const DamageRect* damage)
 {
 	int ret;
+	DamageRect area;
+
+	if (damage) {
+		// Objects that track their own state in Render() must never be drawn partially,
+		// so grow the area until it fully covers every known object it touches
+		area = *damage;
+		bool grown = true;
+		while (grown && !area.full) {
+			grown = (mCurrentPage && mCurrentPage->GrowDamage(area));
+			std::vector<Page*>::iterator iter;
+			for (iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
+				if ((*iter) && (*iter)->GrowDamage(area))
+					grown = true;
+			}
+		}
+		if (area.full || gr_set_damage(area.x, area.y, area.w, area.h) != 0)
+			damage = NULL;
+		else
+			damage = &area;
+	}
 
-	ret = (mCurrentPage ? mCurrentPage->Render() : -1);
+	ret = (mCurrentPage ? mCurrentPage->Render(damage) : -1);
 	if (ret < 0)
 		return ret;
 
 	std::vector<Page*>::iterator iter;
 
 	for (iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
-		ret = ((*iter) ? (*iter)->Render() : -1);
+		ret = ((*iter) ? (*iter)->Render(damage) : -1);
 		if (ret < 0)
 			return ret;
 	}
 	return ret;
 }
 
-int PageSet::Update(void)
+int PageSet::Update(DamageRect* damage)
 {
 	int ret;
 
-	ret = (mCurrentPage ? mCurrentPage->Update() : -1);
+	ret = (mCurrentPage ? mCurrentPage->Update(damage) : -1);
 	if (ret < 0 || ret > 1)
 		return ret;
 
 	std::vector<Page*>::iterator iter;
 
 	for (iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
-		ret = ((*iter) ? (*iter)->Update() : -1);
+		ret = ((*iter) ? (*iter)->Update(damage) : -1);
 		if (ret < 0)
 			return ret;
 	}
@@ -1392,6 +1560,10 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 	PageSet* pageSet = NULL;
 	int ret;
 	MemMapping map;
+	ThemeBlob blob, recorder; // must outlive ctx, its documents may point into blob
+	std::string blob_path;
+	uint64_t blob_key = 0;
+	twrpProfilerScope scope("load_package " + name);
 
 	mReloadTheme = false;
 	mStartPage = startpage;
@@ -1459,11 +1631,27 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 		free(languageFile);
 	}
 
+	// Use the compiled theme if it matches, otherwise compile it while parsing the XML
+	blob_path = GetThemeBlobPath(package, &blob_key);
+	if (!blob_path.empty()) {
+		if (blob.Open(blob_path, blob_key)) {
+			LOGINFO("Loading compiled theme '%s'\n", blob_path.c_str());
+			ctx.blob = &blob;
+		} else {
+			ctx.recorder = &recorder;
+		}
+	}
+
 	// Load and parse the XML and all includes
 	currentLoadingContext = &ctx; // required to find styles
 	ret = mCurrentSet->Load(ctx, mainxmlfilename);
 	currentLoadingContext = NULL;
 
+	if (ret == 0 && ctx.recorder)
+		recorder.Save(blob_path, blob_key);
+	else if (ret != 0 && ctx.blob)
+		unlink(blob_path.c_str()); // compile it again on the next load
+
 	if (ret == 0) {
 		mCurrentSet->SetPage(startpage);
 		mPageSets.insert(std::pair<std::string, PageSet*>(name, mCurrentSet));
@@ -1625,6 +1813,36 @@ void PageManager::RequestReload() {
 	mReloadTheme = true;
 }
 
+void PageManager::SetCacheDir(const std::string& dir) {
+	mCacheDir.clear();
+	if (!dir.empty() && TWFunc::Recursive_Mkdir(dir, false))
+		mCacheDir = dir;
+	Resource::SetImageCacheDir(mCacheDir.empty() ? "" : mCacheDir + "/images");
+}
+
+std::string PageManager::GetThemeBlobPath(const std::string& package, uint64_t* key) {
+	if (mCacheDir.empty())
+		return "";
+
+	// The zip (or the stock ui.xml) plus the recovery build identify the sources;
+	// stock theme includes only change with a new build
+	struct stat st;
+	if (stat(package.c_str(), &st) != 0)
+		return "";
+	std::string build = android::base::GetProperty("ro.build.date.utc", "");
+	int64_t file_id[4] = { (int64_t)st.st_size, (int64_t)st.st_ino, (int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec };
+	int theme_version = TW_THEME_VERSION;
+
+	uint64_t hash = ThemeBlob::Hash(package.data(), package.size());
+	*key = ThemeBlob::Hash(file_id, sizeof(file_id), hash);
+	*key = ThemeBlob::Hash(&theme_version, sizeof(theme_version), *key);
+	*key = ThemeBlob::Hash(build.data(), build.size(), *key);
+
+	char name[40];
+	snprintf(name, sizeof(name), "/theme-%016llx.bin", (unsigned long long)hash);
+	return mCacheDir + name;
+}
+
 void PageManager::SetStartPage(const std::string& page_name) {
 	mStartPage = page_name;
 }
@@ -1662,12 +1880,12 @@ int PageManager::IsCurrentPage(Page* page)
 	return (mCurrentSet ? mCurrentSet->IsCurrentPage(page) : 0);
 }
 
-int PageManager::Render(void)
+int PageManager::Render(bool damageOnly)
 {
 	if (blankTimer.isScreenOff())
 		return 0;
 
-	int res = (mCurrentSet ? mCurrentSet->Render() : -1);
+	int res = (mCurrentSet ? mCurrentSet->Render(damageOnly && !mDamage.full ? &mDamage : NULL) : -1);
 	if (mMouseCursor)
 		mMouseCursor->Render();
 	return res;
@@ -1726,13 +1944,16 @@ int PageManager::Update(void)
 	if (RunReload())
 		return -2;
 
-	int res = (mCurrentSet ? mCurrentSet->Update() : -1);
+	mDamage.Clear();
+	int res = (mCurrentSet ? mCurrentSet->Update(&mDamage) : -1);
 
 	if (mMouseCursor)
 	{
 		int c_res = mMouseCursor->Update();
 		if (c_res > res)
 			res = c_res;
+		if (c_res > 0)
+			mDamage.SetFull();
 	}
 	return res;
 }
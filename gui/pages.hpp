@@ -25,6 +25,7 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include "rapidxml.hpp"
 #include "gui.hpp"
 using namespace rapidxml;
@@ -47,6 +48,20 @@ struct COLOR {
 		: red(r), green(g), blue(b), alpha(a) {}
 };
 
+// Bounding box of the screen area that changed since the last render
+struct DamageRect {
+	int x, y, w, h;
+	bool full; // the area is unknown, the whole screen has to be redrawn
+	DamageRect() : x(0), y(0), w(0), h(0), full(false) {}
+
+	bool IsEmpty() const { return !full && (w <= 0 || h <= 0); }
+	void Clear() { x = y = w = h = 0; full = false; }
+	void SetFull() { full = true; }
+	void Add(int ax, int ay, int aw, int ah);
+	bool Intersects(int ax, int ay, int aw, int ah) const;
+	bool Contains(int ax, int ay, int aw, int ah) const;
+};
+
 struct language_struct {
 	std::string filename;
 	std::string displayvalue;
@@ -83,8 +98,12 @@ public:
 	std::string GetName(void)   { return mName; }
 
 public:
-	virtual int Render(void);
-	virtual int Update(void);
+	// Render - Render the page, or only the area in damage if one is given
+	virtual int Render(const DamageRect* damage = NULL);
+	// Update - Adds the area of every object that requested a render to damage
+	virtual int Update(DamageRect* damage = NULL);
+	// GrowDamage - Extends damage to fully cover every object it touches, returns true if it grew
+	virtual bool GrowDamage(DamageRect& damage);
 	virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
 	virtual int NotifyKey(int key, bool down);
 	virtual int NotifyCharInput(int ch);
@@ -101,9 +120,17 @@ protected:
 
 	ActionObject* mTouchStart;
 	COLOR mBackground;
+	bool mConditionsChanged; // an object was shown or hidden since the last Update
+
+	// Objects to notify per variable, in page order, see GUIObject::GetVarSubscriptions
+	std::unordered_map<std::string, std::vector<GUIObject*> > mVarSubscribers;
+	std::vector<GUIObject*> mAnyVarSubscribers; // notified of variables nobody subscribed to
+	bool mVarSubscribersValid;
 
 protected:
 	bool ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, int depth);
+	void BuildVarSubscribers();
+	void NotifyObjectVarChange(GUIObject* object, const std::string& varName, const std::string& value);
 };
 
 struct LoadingContext;
@@ -129,8 +156,8 @@ public:
 	std::string GetCurrentPage() const;
 
 	// These are routing routines
-	int Render(void);
-	int Update(void);
+	int Render(const DamageRect* damage = NULL);
+	int Update(DamageRect* damage = NULL);
 	int NotifyTouch(TOUCH_STATE state, int x, int y);
 	int NotifyKey(int key, bool down);
 	int NotifyCharInput(int ch);
@@ -165,6 +192,8 @@ public:
 	static int RunReload();
 	static void RequestReload();
 	static void SetStartPage(const std::string& page_name);
+	// Where compiled themes and decoded images are cached, empty to disable
+	static void SetCacheDir(const std::string& dir);
 
 	// Used for actions and pages
 	static int ChangePage(std::string name);
@@ -176,7 +205,8 @@ public:
 	static int IsCurrentPage(Page* page);
 
 	// These are routing routines
-	static int Render(void);
+	// Render - With damageOnly, redraw only what changed during the last Update
+	static int Render(bool damageOnly = false);
 	static int Update(void);
 	static int NotifyTouch(TOUCH_STATE state, int x, int y);
 	static int NotifyKey(int key, bool down);
@@ -198,6 +228,7 @@ protected:
 	static void Translate_Partition(const char* path, const char* resource_name, const char* default_value);
 	static void Translate_Partition(const char* path, const char* resource_name, const char* default_value, const char* storage_resource_name, const char* storage_default_value);
 	static void Translate_Partition_Display_Names();
+	static std::string GetThemeBlobPath(const std::string& package, uint64_t* key);
 
 protected:
 	static std::map<std::string, PageSet*> mPageSets;
@@ -207,6 +238,8 @@ protected:
 	static bool mReloadTheme;
 	static std::string mStartPage;
 	static LoadingContext* currentLoadingContext;
+	static DamageRect mDamage;
+	static std::string mCacheDir;
 };
 
 #endif  // _PAGES_HEADER_HPP
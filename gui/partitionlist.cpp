@@ -166,6 +166,13 @@ int GUIPartitionList::NotifyVarChange(const std::string& varName, const std::str
 	return 0;
 }
 
+bool GUIPartitionList::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetVarSubscriptions(vars);
+	vars.push_back(mVariable);
+	return true;
+}
+
 void GUIPartitionList::SetPageFocus(int inFocus)
 {
 	GUIScrollList::SetPageFocus(inFocus);
@@ -430,6 +430,13 @@ int GUIPatternPassword::NotifyVarChange(const std::string& varName, const std::s
 	return 0;
 }
 
+bool GUIPatternPassword::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIObject::GetVarSubscriptions(vars);
+	vars.push_back(mSizeVar);
+	return true;
+}
+
 static unsigned int getSDKVersion(void) {
 	unsigned int sdkver = 23;
 	string sdkverstr = TWFunc::System_Property_Get("ro.build.version.sdk");
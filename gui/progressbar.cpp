@@ -245,3 +245,11 @@ int GUIProgressBar::NotifyVarChange(const std::string& varName, const std::strin
 	}
 	return 0;
 }
+
+bool GUIProgressBar::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIObject::GetVarSubscriptions(vars);
+	vars.push_back("ui_progress_portion");
+	vars.push_back("ui_progress_frames");
+	return true;
+}
@@ -29,6 +29,8 @@
 #include <iostream>
 #include <iomanip>
 #include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "zipwrap.hpp"
 extern "C" {
@@ -41,8 +43,24 @@ extern "C" {
 
 #include "rapidxml.hpp"
 #include "objects.hpp"
+#include "../twrp-functions.hpp"
+#include "../twrpProfiler.hpp"
 
-#define TMP_RESOURCE_NAME   "/tmp/extract.bin"
+// Bump when the way images are decoded or scaled changes, to invalidate the cache
+#define IMAGE_CACHE_VERSION 1
+// The cache is cleared when it grows beyond this, e.g. after several theme changes
+#define IMAGE_CACHE_MAX_FILES 1024
+#define IMAGE_DECODE_MAX_THREADS 4
+
+struct ImageLoadJob {
+	std::string file;
+	std::vector<unsigned char> data; // encoded PNG/JPG
+	int retain_aspect;
+	gr_surface* surface;
+};
+
+static std::vector<ImageLoadJob*> image_queue;
+static std::string image_cache_dir;
 
 Resource::Resource(xml_node<>* node, ZipWrap* pZip __unused)
 {
@@ -61,27 +79,138 @@ int Resource::ExtractResource(ZipWrap* pZip, std::string folderName, std::string
 	return 0;
 }
 
-void Resource::LoadImage(ZipWrap* pZip, std::string file, gr_surface* surface)
+static bool read_image_file(const std::string& path, std::vector<unsigned char>& data)
 {
-	int rc = 0;
-	if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0)
-	{
-		rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-		unlink(TMP_RESOURCE_NAME);
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	struct stat st;
+	bool ok = fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+	if (ok) {
+		data.resize(st.st_size);
+		ok = fread(data.data(), 1, data.size(), fp) == data.size();
 	}
-	else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0)
-	{
+	fclose(fp);
+	return ok;
+}
+
+// Reads the encoded image straight from the theme zip (or TWRES for the stock theme)
+bool Resource::ReadImage(ZipWrap* pZip, std::string file, std::vector<unsigned char>& data)
+{
+	if (pZip) {
 		// JPG includes the .jpg extension in the filename so extension should be blank
-		rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-		unlink(TMP_RESOURCE_NAME);
+		const char* extns[] = { ".png", "" };
+		for (const char* extn : extns) {
+			std::string src = "images/" + file + extn;
+			if (!pZip->EntryExists(src))
+				continue;
+			long size = pZip->GetUncompressedSize(src);
+			if (size <= 0)
+				continue;
+			data.resize(size);
+			if (pZip->ExtractToBuffer(src, data.data()))
+				return true;
+		}
+		return false;
 	}
-	else if (!pZip)
-	{
-		// File name in xml may have included .png so try without adding .png
-		rc = res_create_surface(file.c_str(), surface);
+
+	// File name in xml may have included .png so try without adding .png
+	return read_image_file(TWRES "images/" + file + ".png", data) ||
+		read_image_file(file, data) ||
+		read_image_file(TWRES "images/" + file, data);
+}
+
+void Resource::QueueImage(std::string file, std::vector<unsigned char>& data, int retain_aspect, gr_surface* surface)
+{
+	ImageLoadJob* job = new ImageLoadJob;
+	job->file = file;
+	job->data.swap(data);
+	job->retain_aspect = retain_aspect;
+	job->surface = surface;
+	*surface = NULL;
+	image_queue.push_back(job);
+}
+
+// FNV-1a over the encoded image and everything that affects the decoded result
+static uint64_t image_cache_key(const ImageLoadJob* job)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	auto add = [&hash](const void* data, size_t size) {
+		const unsigned char* p = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= p[i];
+			hash *= 1099511628211ULL;
+		}
+	};
+	float scale[2] = { get_scale_w(), get_scale_h() };
+	int params[2] = { IMAGE_CACHE_VERSION, job->retain_aspect };
+	add(job->data.data(), job->data.size());
+	add(scale, sizeof(scale));
+	add(params, sizeof(params));
+	return hash;
+}
+
+static void decode_image(ImageLoadJob* job)
+{
+	std::string cache_file;
+	uint64_t key = 0;
+
+	if (!image_cache_dir.empty()) {
+		char name[32];
+		key = image_cache_key(job);
+		snprintf(name, sizeof(name), "/%016llx.surf", (unsigned long long)key);
+		cache_file = image_cache_dir + name;
+		if (res_load_surface(cache_file.c_str(), key, job->surface) == 0)
+			return;
+	}
+
+	gr_surface temp_surface = NULL;
+	int rc = res_create_surface_mem(job->data.data(), job->data.size(), &temp_surface);
+	if (rc != 0) {
+		LOGINFO("Failed to load image from %s, error %d\n", job->file.c_str(), rc);
+		return;
+	}
+	Resource::CheckAndScaleImage(temp_surface, job->surface, job->retain_aspect);
+	if (!cache_file.empty() && *job->surface)
+		res_save_surface(*job->surface, cache_file.c_str(), key);
+}
+
+void Resource::LoadQueuedImages()
+{
+	if (image_queue.empty())
+		return;
+
+	twrpProfilerScope scope("decode_images");
+	TWWorkQueue queue(std::min(TWWorkQueue::Cpu_Threads(IMAGE_DECODE_MAX_THREADS), image_queue.size()));
+	for (ImageLoadJob* job : image_queue)
+		queue.Add([job]() { decode_image(job); });
+	queue.Run();
+
+	for (ImageLoadJob* job : image_queue)
+		delete job;
+	image_queue.clear();
+}
+
+void Resource::SetImageCacheDir(const std::string& dir)
+{
+	image_cache_dir.clear();
+	if (dir.empty() || !TWFunc::Recursive_Mkdir(dir, false))
+		return;
+
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		return;
+	size_t count = 0;
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL)
+		count++;
+	closedir(d);
+	if (count > IMAGE_CACHE_MAX_FILES) {
+		LOGINFO("Clearing image cache in %s\n", dir.c_str());
+		TWFunc::removeDir(dir, true);
 	}
-	if (rc != 0)
-		LOGINFO("Failed to load image from %s%s, error %d\n", file.c_str(), pZip ? " (zip)" : "", rc);
+	image_cache_dir = dir;
 }
 
 void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect)
@@ -218,8 +347,12 @@ ImageResource::ImageResource(xml_node<>* node, ZipWrap* pZip)
 
 	bool retain_aspect = (node->first_attribute("retainaspect") != NULL);
 	// the value does not matter, if retainaspect is present, we assume that we want to retain it
-	LoadImage(pZip, file, &temp_surface);
-	CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+	// mSurface is filled in by LoadQueuedImages()
+	std::vector<unsigned char> data;
+	if (ReadImage(pZip, file, data))
+		QueueImage(file, data, retain_aspect, &mSurface);
+	else
+		LOGINFO("Failed to load image from %s%s\n", file.c_str(), pZip ? " (zip)" : "");
 }
 
 ImageResource::~ImageResource()
@@ -246,19 +379,38 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipWrap* pZip)
 
 	bool retain_aspect = (node->first_attribute("retainaspect") != NULL);
 	// the value does not matter, if retainaspect is present, we assume that we want to retain it
+	std::vector<std::vector<unsigned char> > frames;
+	std::vector<std::string> names;
 	for (;;)
 	{
 		std::ostringstream fileName;
 		fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
 
-		gr_surface surface, temp_surface = NULL;
-		LoadImage(pZip, fileName.str(), &temp_surface);
-		CheckAndScaleImage(temp_surface, &surface, retain_aspect);
-		if (surface) {
-			mSurfaces.push_back(surface);
-			fileNum++;
-		} else
+		std::vector<unsigned char> data;
+		if (!ReadImage(pZip, fileName.str(), data))
 			break; // Done loading animation images
+		frames.push_back(std::vector<unsigned char>());
+		frames.back().swap(data);
+		names.push_back(fileName.str());
+		fileNum++;
+	}
+
+	// The surfaces are filled in by LoadQueuedImages(), mSurfaces must not be resized until then
+	mSurfaces.resize(frames.size(), NULL);
+	for (size_t i = 0; i < frames.size(); i++)
+		QueueImage(names[i], frames[i], retain_aspect, &mSurfaces[i]);
+}
+
+void AnimationResource::TrimFrames()
+{
+	for (size_t i = 0; i < mSurfaces.size(); i++) {
+		if (!mSurfaces[i]) {
+			for (size_t j = i + 1; j < mSurfaces.size(); j++)
+				if (mSurfaces[j])
+					res_free_surface(mSurfaces[j]);
+			mSurfaces.resize(i);
+			break;
+		}
 	}
 }
 
@@ -354,6 +506,9 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipWrap* pZip, std::str
 	if (!resList)
 		return;
 
+	// Images and animations are only usable once LoadQueuedImages() decoded them
+	std::vector<std::pair<xml_node<>*, Resource*> > pending;
+
 	for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling())
 	{
 		std::string type = child->name();
@@ -396,23 +551,11 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipWrap* pZip, std::str
 		}
 		else if (type == "image")
 		{
-			ImageResource* res = new ImageResource(child, pZip);
-			if (res && res->GetResource())
-				mImages.push_back(res);
-			else {
-				error = true;
-				delete res;
-			}
+			pending.push_back(std::make_pair(child, (Resource*)new ImageResource(child, pZip)));
 		}
 		else if (type == "animation")
 		{
-			AnimationResource* res = new AnimationResource(child, pZip);
-			if (res && res->GetResourceCount())
-				mAnimations.push_back(res);
-			else {
-				error = true;
-				delete res;
-			}
+			pending.push_back(std::make_pair(child, (Resource*)new AnimationResource(child, pZip)));
 		}
 		else if (type == "string")
 		{
@@ -431,21 +574,53 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipWrap* pZip, std::str
 		}
 
 		if (error)
-		{
-			std::string res_name;
-			if (child->first_attribute("name"))
-				res_name = child->first_attribute("name")->value();
-			if (res_name.empty() && child->first_attribute("filename"))
-				res_name = child->first_attribute("filename")->value();
-
-			if (!res_name.empty()) {
-				LOGERR("Resource (%s)-(%s) failed to load\n", type.c_str(), res_name.c_str());
-			} else
-				LOGERR("Resource type (%s) failed to load\n", type.c_str());
+			LogResourceError(child, type);
+	}
+
+	Resource::LoadQueuedImages();
+
+	for (size_t i = 0; i < pending.size(); i++) {
+		xml_node<>* child = pending[i].first;
+		std::string type = child->name();
+		if (type == "resource") {
+			xml_attribute<>* attr = child->first_attribute("type");
+			type = attr ? attr->value() : "*unspecified*";
 		}
+
+		if (type == "image") {
+			ImageResource* res = static_cast<ImageResource*>(pending[i].second);
+			if (res->GetResource()) {
+				mImages.push_back(res);
+				continue;
+			}
+			delete res;
+		} else {
+			AnimationResource* res = static_cast<AnimationResource*>(pending[i].second);
+			res->TrimFrames();
+			if (res->GetResourceCount()) {
+				mAnimations.push_back(res);
+				continue;
+			}
+			delete res;
+		}
+		LogResourceError(child, type);
 	}
 }
 
+void ResourceManager::LogResourceError(xml_node<>* child, const std::string& type)
+{
+	std::string res_name;
+	if (child->first_attribute("name"))
+		res_name = child->first_attribute("name")->value();
+	if (res_name.empty() && child->first_attribute("filename"))
+		res_name = child->first_attribute("filename")->value();
+
+	if (!res_name.empty()) {
+		LOGERR("Resource (%s)-(%s) failed to load\n", type.c_str(), res_name.c_str());
+	} else
+		LOGERR("Resource type (%s) failed to load\n", type.c_str());
+}
+
 ResourceManager::~ResourceManager()
 {
 	for (std::vector<FontResource*>::iterator it = mFonts.begin(); it != mFonts.end(); ++it)
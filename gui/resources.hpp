@@ -42,13 +42,19 @@ public:
 public:
 	std::string GetName() { return mName; }
 
+	// Decode and scale all images queued by resource constructors, in parallel
+	static void LoadQueuedImages();
+	// Where decoded and scaled images are cached across boots, empty to disable
+	static void SetImageCacheDir(const std::string& dir);
+	static void CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect);
+
 private:
 	std::string mName;
 
 protected:
 	static int ExtractResource(ZipWrap* pZip, std::string folderName, std::string fileName, std::string fileExtn, std::string destFile);
-	static void LoadImage(ZipWrap* pZip, std::string file, gr_surface* surface);
-	static void CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect);
+	static bool ReadImage(ZipWrap* pZip, std::string file, std::vector<unsigned char>& data);
+	static void QueueImage(std::string file, std::vector<unsigned char>& data, int retain_aspect, gr_surface* surface);
 };
 
 class FontResource : public Resource
@@ -101,6 +107,8 @@ public:
 	int GetWidth() { return gr_get_width(GetResource()); }
 	int GetHeight() { return gr_get_height(GetResource()); }
 	int GetResourceCount() { return mSurfaces.size(); }
+	// Drop frames that failed to load, along with everything after them
+	void TrimFrames();
 
 protected:
 	std::vector<gr_surface> mSurfaces;
@@ -122,6 +130,9 @@ public:
 	std::string FindString(const std::string& name, const std::string& default_string) const;
 	void DumpStrings() const;
 
+private:
+	static void LogResourceError(xml_node<>* child, const std::string& type);
+
 private:
 	struct string_resource_struct {
 		std::string value;
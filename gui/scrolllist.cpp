@@ -626,6 +626,14 @@ int GUIScrollList::NotifyVarChange(const std::string& varName, const std::string
 	return 0;
 }
 
+bool GUIScrollList::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIObject::GetVarSubscriptions(vars);
+	if (!mHeaderIsStatic)
+		gui_parse_text_vars(mHeaderText, vars);
+	return true;
+}
+
 int GUIScrollList::SetRenderPos(int x, int y, int w /* = 0 */, int h /* = 0 */)
 {
 	mRenderX = x;
@@ -437,6 +437,15 @@ int GUISliderValue::NotifyVarChange(const std::string& varName, const std::strin
 	return 0;
 }
 
+bool GUISliderValue::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIObject::GetVarSubscriptions(vars);
+	vars.push_back(mVariable);
+	if (mLabel)
+		mLabel->GetVarSubscriptions(vars);
+	return true;
+}
+
 void GUISliderValue::SetPageFocus(int inFocus)
 {
 	if (inFocus)
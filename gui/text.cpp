@@ -177,6 +177,31 @@ int GUIText::GetCurrentBounds(int& w, int& h)
 	return 0;
 }
 
+int GUIText::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+	// The string is scaled down to maxWidth; without a limit it may run across the whole row
+	w = maxWidth ? (int)maxWidth : gr_fb_width();
+	h = mFontHeight;
+
+	if (!maxWidth || mPlacement == TOP_LEFT || mPlacement == BOTTOM_LEFT || mPlacement == TEXT_ONLY_RIGHT)
+		x = maxWidth ? mRenderX : 0;
+	else if (mPlacement == CENTER || mPlacement == CENTER_X_ONLY)
+		x = mRenderX - w / 2;
+	else
+		x = mRenderX - w;
+
+	if (mPlacement == CENTER || mPlacement == TEXT_ONLY_RIGHT)
+		y = mRenderY - h / 2;
+	else if (mPlacement == BOTTOM_LEFT || mPlacement == BOTTOM_RIGHT)
+		y = mRenderY - h;
+	else
+		y = mRenderY;
+
+	// Leave some room for rounding in the placement math
+	x -= 1; y -= 1; w += 2; h += 2;
+	return 0;
+}
+
 int GUIText::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIObject::NotifyVarChange(varName, value);
@@ -185,6 +210,14 @@ int GUIText::NotifyVarChange(const std::string& varName, const std::string& valu
 	return 0;
 }
 
+bool GUIText::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIObject::GetVarSubscriptions(vars);
+	if (!mIsStatic)
+		gui_parse_text_vars(mText, vars);
+	return true;
+}
+
 int GUIText::SetMaxWidth(unsigned width)
 {
 	maxWidth = width;
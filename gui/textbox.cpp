@@ -121,3 +121,13 @@ int GUITextBox::NotifyVarChange(const std::string& varName, const std::string& v
 	}
 	return 0;
 }
+
+bool GUITextBox::GetVarSubscriptions(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetVarSubscriptions(vars);
+	if (!mIsStatic) {
+		for (size_t i = 0; i < mText.size(); i++)
+			gui_parse_text_vars(mText[i], vars);
+	}
+	return true;
+}
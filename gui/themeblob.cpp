@@ -0,0 +1,310 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// themeblob.cpp - Compiled form of a theme's XML files
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "themeblob.hpp"
+extern "C" {
+#include "../twcommon.h"
+}
+
+#define THEME_BLOB_MAGIC 0x42544854 // "THTB"
+// Bump whenever the layout below or the rapidxml parse flags change
+#define THEME_BLOB_VERSION 1
+#define THEME_BLOB_MAX_SIZE (64 << 20)
+
+ThemeBlob::ThemeBlob()
+{
+	mData = NULL;
+	mSize = 0;
+	mHeader = NULL;
+	mDocuments = NULL;
+	mNodes = NULL;
+	mAttributes = NULL;
+	mStrings = NULL;
+}
+
+ThemeBlob::~ThemeBlob()
+{
+	Close();
+}
+
+uint64_t ThemeBlob::Hash(const void* data, size_t size, uint64_t hash)
+{
+	// FNV-1a
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool ThemeBlob::Open(const std::string& path, uint64_t key)
+{
+	Close();
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header) || st.st_size > THEME_BLOB_MAX_SIZE) {
+		close(fd);
+		return false;
+	}
+
+	// Private and writable since rapidxml hands out non-const pointers to names and values
+	void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		LOGINFO("ThemeBlob failed to map '%s' - (%s)\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	mData = (unsigned char*)data;
+	mSize = st.st_size;
+	mHeader = (const Header*)mData;
+
+	if (mHeader->magic != THEME_BLOB_MAGIC || mHeader->version != THEME_BLOB_VERSION || mHeader->key != key) {
+		LOGINFO("Compiled theme '%s' is out of date\n", path.c_str());
+		Close();
+		return false;
+	}
+	if (!Validate()) {
+		LOGINFO("Compiled theme '%s' is damaged\n", path.c_str());
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool ThemeBlob::Validate()
+{
+	uint64_t size = sizeof(Header);
+	size += (uint64_t)mHeader->document_count * sizeof(Document);
+	size += (uint64_t)mHeader->node_count * sizeof(Node);
+	size += (uint64_t)mHeader->attribute_count * sizeof(Attribute);
+	size += mHeader->strings_size;
+	if (size != mSize || mHeader->strings_size == 0)
+		return false;
+	if (Hash(mData + sizeof(Header), mSize - sizeof(Header)) != mHeader->hash)
+		return false;
+
+	mDocuments = (const Document*)(mData + sizeof(Header));
+	mNodes = (const Node*)(mDocuments + mHeader->document_count);
+	mAttributes = (const Attribute*)(mNodes + mHeader->node_count);
+	mStrings = (char*)(mAttributes + mHeader->attribute_count);
+
+	auto valid_string = [this](uint32_t offset, uint32_t len) {
+		return (uint64_t)offset + len < mHeader->strings_size && mStrings[offset + len] == 0;
+	};
+
+	for (uint32_t i = 0; i < mHeader->attribute_count; i++) {
+		const Attribute& attr = mAttributes[i];
+		if (!valid_string(attr.name, attr.name_size) || !valid_string(attr.value, attr.value_size))
+			return false;
+	}
+
+	for (uint32_t i = 0; i < mHeader->node_count; i++) {
+		const Node& node = mNodes[i];
+		if (node.type > node_pi || !valid_string(node.name, node.name_size) || !valid_string(node.value, node.value_size))
+			return false;
+		if ((uint64_t)node.first_attribute + node.attribute_count > mHeader->attribute_count)
+			return false;
+	}
+
+	mDocumentIndex.clear();
+	for (uint32_t i = 0; i < mHeader->document_count; i++) {
+		const Document& doc = mDocuments[i];
+		if ((uint64_t)doc.first_node + doc.node_count > mHeader->node_count || doc.node_count == 0)
+			return false;
+		if (mNodes[doc.first_node].type != node_document || doc.filename >= mHeader->strings_size)
+			return false;
+		// strnlen stays inside the string table, valid_string then rejects a name without its terminator
+		if (!valid_string(doc.filename, strnlen(mStrings + doc.filename, mHeader->strings_size - doc.filename)))
+			return false;
+
+		// The child counts have to add up to exactly the nodes of this document
+		std::vector<uint32_t> pending;
+		pending.push_back(1);
+		for (uint32_t n = doc.first_node; n < doc.first_node + doc.node_count; n++) {
+			while (!pending.empty() && pending.back() == 0)
+				pending.pop_back();
+			if (pending.empty())
+				return false;
+			pending.back()--;
+			pending.push_back(mNodes[n].child_count);
+		}
+		while (!pending.empty() && pending.back() == 0)
+			pending.pop_back();
+		if (!pending.empty())
+			return false;
+
+		mDocumentIndex[mStrings + doc.filename] = i;
+	}
+	return true;
+}
+
+void ThemeBlob::Close()
+{
+	if (mData)
+		munmap(mData, mSize);
+	mData = NULL;
+	mSize = 0;
+	mHeader = NULL;
+	mDocuments = NULL;
+	mNodes = NULL;
+	mAttributes = NULL;
+	mStrings = NULL;
+	mDocumentIndex.clear();
+}
+
+xml_document<>* ThemeBlob::GetDocument(const std::string& filename)
+{
+	std::map<std::string, uint32_t>::iterator it = mDocumentIndex.find(filename);
+	if (it == mDocumentIndex.end())
+		return NULL;
+
+	const Document& src = mDocuments[it->second];
+	xml_document<>* doc = new xml_document<>();
+
+	// parent nodes and how many children they are still waiting for
+	std::vector<std::pair<xml_node<>*, uint32_t> > parents;
+	parents.push_back(std::make_pair((xml_node<>*)doc, mNodes[src.first_node].child_count));
+
+	for (uint32_t n = src.first_node + 1; n < src.first_node + src.node_count; n++) {
+		while (parents.back().second == 0)
+			parents.pop_back();
+		parents.back().second--;
+
+		const Node& node = mNodes[n];
+		xml_node<>* xnode = doc->allocate_node((node_type)node.type,
+			mStrings + node.name, mStrings + node.value, node.name_size, node.value_size);
+		for (uint32_t a = node.first_attribute; a < node.first_attribute + node.attribute_count; a++) {
+			const Attribute& attr = mAttributes[a];
+			xnode->append_attribute(doc->allocate_attribute(mStrings + attr.name,
+				mStrings + attr.value, attr.name_size, attr.value_size));
+		}
+		parents.back().first->append_node(xnode);
+		if (node.child_count)
+			parents.push_back(std::make_pair(xnode, node.child_count));
+	}
+	return doc;
+}
+
+uint32_t ThemeBlob::Intern(const char* str, size_t size)
+{
+	std::string s(str, size);
+	std::unordered_map<std::string, uint32_t>::iterator it = mInterned.find(s);
+	if (it != mInterned.end())
+		return it->second;
+
+	uint32_t offset = mNewStrings.size();
+	mNewStrings.append(s);
+	mNewStrings.push_back('\0');
+	mInterned[s] = offset;
+	return offset;
+}
+
+void ThemeBlob::AddNode(xml_node<>* node)
+{
+	Node n;
+	n.type = node->type();
+	n.name = Intern(node->name(), node->name_size());
+	n.name_size = node->name_size();
+	n.value = Intern(node->value(), node->value_size());
+	n.value_size = node->value_size();
+	n.first_attribute = mNewAttributes.size();
+	n.attribute_count = 0;
+	n.child_count = 0;
+
+	for (xml_attribute<>* attr = node->first_attribute(); attr; attr = attr->next_attribute()) {
+		Attribute a;
+		a.name = Intern(attr->name(), attr->name_size());
+		a.name_size = attr->name_size();
+		a.value = Intern(attr->value(), attr->value_size());
+		a.value_size = attr->value_size();
+		mNewAttributes.push_back(a);
+		n.attribute_count++;
+	}
+	for (xml_node<>* child = node->first_node(); child; child = child->next_sibling())
+		n.child_count++;
+
+	mNewNodes.push_back(n);
+	for (xml_node<>* child = node->first_node(); child; child = child->next_sibling())
+		AddNode(child);
+}
+
+void ThemeBlob::AddDocument(const std::string& filename, xml_node<>* doc)
+{
+	Document d;
+	d.filename = Intern(filename.c_str(), filename.size());
+	d.first_node = mNewNodes.size();
+	AddNode(doc);
+	d.node_count = mNewNodes.size() - d.first_node;
+	mNewDocuments.push_back(d);
+}
+
+bool ThemeBlob::Save(const std::string& path, uint64_t key)
+{
+	if (mNewDocuments.empty())
+		return false;
+
+	std::string body;
+	body.append((const char*)mNewDocuments.data(), mNewDocuments.size() * sizeof(Document));
+	body.append((const char*)mNewNodes.data(), mNewNodes.size() * sizeof(Node));
+	body.append((const char*)mNewAttributes.data(), mNewAttributes.size() * sizeof(Attribute));
+	body.append(mNewStrings);
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = THEME_BLOB_MAGIC;
+	header.version = THEME_BLOB_VERSION;
+	header.key = key;
+	header.hash = Hash(body.data(), body.size());
+	header.document_count = mNewDocuments.size();
+	header.node_count = mNewNodes.size();
+	header.attribute_count = mNewAttributes.size();
+	header.strings_size = mNewStrings.size();
+
+	// Write a temporary file first so an interrupted save never leaves a half written blob
+	std::string tmp = path + ".tmp";
+	FILE* fp = fopen(tmp.c_str(), "wb");
+	if (!fp) {
+		LOGINFO("ThemeBlob failed to create '%s' - (%s)\n", tmp.c_str(), strerror(errno));
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(body.data(), 1, body.size(), fp) == body.size();
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		LOGINFO("ThemeBlob failed to write '%s'\n", path.c_str());
+		unlink(tmp.c_str());
+		return false;
+	}
+	LOGINFO("Compiled theme to '%s' (%zu bytes)\n", path.c_str(), sizeof(header) + body.size());
+	return true;
+}
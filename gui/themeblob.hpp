@@ -0,0 +1,115 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// themeblob.hpp - Compiled form of a theme's XML files
+
+#ifndef _THEMEBLOB_HEADER_HPP
+#define _THEMEBLOB_HEADER_HPP
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rapidxml.hpp"
+
+using namespace rapidxml;
+
+#define THEME_BLOB_HASH_INIT 14695981039346656037ULL
+
+// Every XML file loaded for a theme, stored as flat node and attribute tables
+// over one table of interned strings. Opening a blob maps it and builds the
+// rapidxml trees directly on top of the mapping, so nothing is read from the
+// zip and no XML is parsed. The key identifies the sources the blob was
+// compiled from; a blob with a different key is ignored.
+class ThemeBlob
+{
+public:
+	ThemeBlob();
+	~ThemeBlob();
+
+	// Map a compiled theme, false if it is missing, stale or damaged
+	bool Open(const std::string& path, uint64_t key);
+	bool IsOpen() const { return mData != NULL; }
+	// Build the document compiled from filename, NULL if it was not part of the theme.
+	// The document points into the mapping and must be deleted before Close().
+	xml_document<>* GetDocument(const std::string& filename);
+	void Close();
+
+	// Record a parsed document, before anything else touches it
+	void AddDocument(const std::string& filename, xml_node<>* doc);
+	bool Save(const std::string& path, uint64_t key);
+
+	static uint64_t Hash(const void* data, size_t size, uint64_t hash = THEME_BLOB_HASH_INIT);
+
+private:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint64_t hash; // of everything after the header
+		uint32_t document_count;
+		uint32_t node_count;
+		uint32_t attribute_count;
+		uint32_t strings_size;
+	};
+
+	// Strings are offsets into the string table, NUL terminated
+	struct Document {
+		uint32_t filename;
+		uint32_t first_node; // the document node itself
+		uint32_t node_count;
+	};
+
+	// Nodes are stored depth first, a node's children follow it directly
+	struct Node {
+		uint32_t type;
+		uint32_t name, name_size;
+		uint32_t value, value_size;
+		uint32_t first_attribute, attribute_count;
+		uint32_t child_count;
+	};
+
+	struct Attribute {
+		uint32_t name, name_size;
+		uint32_t value, value_size;
+	};
+
+	uint32_t Intern(const char* str, size_t size);
+	void AddNode(xml_node<>* node);
+	bool Validate();
+
+	// mapped blob
+	unsigned char* mData;
+	size_t mSize;
+	const Header* mHeader;
+	const Document* mDocuments;
+	const Node* mNodes;
+	const Attribute* mAttributes;
+	char* mStrings;
+	std::map<std::string, uint32_t> mDocumentIndex;
+
+	// recorded documents
+	std::vector<Document> mNewDocuments;
+	std::vector<Node> mNewNodes;
+	std::vector<Attribute> mNewAttributes;
+	std::string mNewStrings;
+	std::unordered_map<std::string, uint32_t> mInterned;
+};
+
+#endif // _THEMEBLOB_HEADER_HPP
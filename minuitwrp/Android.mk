@@ -5,6 +5,7 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
     graphics.cpp \
     graphics_fbdev.cpp \
+    graphics_kernels.cpp \
     resources.cpp \
     truetype.cpp \
     graphics_utils.cpp \
@@ -222,3 +223,19 @@ LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE := libminuitwrp
 
 include $(BUILD_SHARED_LIBRARY)
+
+# minuitwrp_kernel_bench (static executable)
+# ==========================================
+# Checks the fill/blit/blend row kernels against their portable versions
+# and times both, e.g. adb shell minuitwrp_kernel_bench 1080 2340 20
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := graphics_kernels.cpp kernels_bench.cpp
+LOCAL_MODULE_TAGS := tests
+LOCAL_MODULE := minuitwrp_kernel_bench
+LOCAL_CFLAGS := -Werror
+LOCAL_CLANG := true
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+LOCAL_STATIC_LIBRARIES := libc++_static libc
+
+include $(BUILD_EXECUTABLE)
@@ -36,6 +36,7 @@
 #include "../gui/placement.h"
 #include "minui.h"
 #include "graphics.h"
+#include "graphics_kernels.h"
 // For std::min and std::max
 #include <algorithm>
 #include "truetype.hpp"
@@ -64,6 +65,19 @@ static int gr_is_curr_clr_opaque = 0;
 
 unsigned int gr_rotation = 0;
 
+// Area of the frame that is being redrawn, in minuitwrp API coordinates.
+// While set, all drawing is clipped to it and gr_flip() only pushes it out.
+static bool gr_has_damage = false;
+static int gr_damage_x, gr_damage_y, gr_damage_w, gr_damage_h;
+
+// Mirror of the pixelflinger color and scissor state for the 32bpp fast
+// paths below, which write the draw surface directly. The color channels
+// are stored the way they are handed to pixelflinger (r and b already
+// swapped for RECOVERY_ABGR/BGRA), the scissor in display coordinates.
+static unsigned char gr_fast_color[4] = { 255, 255, 255, 255 };
+static bool gr_fast_scissor = false;
+static int gr_fast_scissor_x, gr_fast_scissor_y, gr_fast_scissor_w, gr_fast_scissor_h;
+
 int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, int placement, int scale)
 {
     GGLContext *gl = gr_context;
@@ -114,34 +128,87 @@ int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, in
     return twrpTruetype::gr_ttf_textExWH(gl, x, y + y_scale, s, vfont, measured_width + x, -1, gr_draw);
 }
 
-void gr_clip(int x, int y, int w, int h)
+// Transform a rectangle from minuitwrp API coordinates into display coordinates
+static void gr_rect_to_disp(int& x, int& y, int& w, int& h)
 {
-    GGLContext *gl = gr_context;
+    int rx = x, ry = y, rw = w, rh = h;
 
     switch (gr_rotation) {
         case 90:
-            gl->scissor(gl, gr_draw->width - y - h, x, h, w);
+            x = gr_draw->width - ry - rh; y = rx; w = rh; h = rw;
             break;
         case 180:
-            gl->scissor(gl, gr_draw->width - x - w, gr_draw->height - y - h, w, h);
+            x = gr_draw->width - rx - rw; y = gr_draw->height - ry - rh;
             break;
         case 270:
-            gl->scissor(gl, y, gr_draw->height - x - w, h, w);
+            x = ry; y = gr_draw->height - rx - rw; w = rh; h = rw;
             break;
         default:
-            gl->scissor(gl, x, y, w, h);
             break;
     }
+}
+
+static void gr_scissor(int x, int y, int w, int h)
+{
+    GGLContext *gl = gr_context;
+
+    gr_rect_to_disp(x, y, w, h);
+    gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+
+    gr_fast_scissor = true;
+    gr_fast_scissor_x = x;
+    gr_fast_scissor_y = y;
+    gr_fast_scissor_w = w;
+    gr_fast_scissor_h = h;
+}
+
+void gr_clip(int x, int y, int w, int h)
+{
+    if (gr_has_damage) {
+        int x1 = std::min(x + w, gr_damage_x + gr_damage_w);
+        int y1 = std::min(y + h, gr_damage_y + gr_damage_h);
+        x = std::max(x, gr_damage_x);
+        y = std::max(y, gr_damage_y);
+        w = std::max(x1 - x, 0);
+        h = std::max(y1 - y, 0);
+    }
+    gr_scissor(x, y, w, h);
 }
 
 void gr_noclip()
 {
     GGLContext *gl = gr_context;
+
+    if (gr_has_damage) {
+        gr_scissor(gr_damage_x, gr_damage_y, gr_damage_w, gr_damage_h);
+        return;
+    }
+
     gl->scissor(gl, 0, 0,
                 gr_draw->width - 2 * overscan_offset_x,
                 gr_draw->height - 2 * overscan_offset_y);
     gl->disable(gl, GGL_SCISSOR_TEST);
+    gr_fast_scissor = false;
+}
+
+// Limit drawing and the next gr_flip() to the given rectangle.
+// Returns 0 if the backend supports partial updates, -1 otherwise; in the
+// latter case nothing is changed and the whole frame must be redrawn.
+int gr_set_damage(int x, int y, int w, int h)
+{
+    if (!gr_backend->flip_rect)
+        return -1;
+
+    int x1 = std::min(x + w, gr_fb_width());
+    int y1 = std::min(y + h, gr_fb_height());
+    gr_damage_x = std::max(x, 0);
+    gr_damage_y = std::max(y, 0);
+    gr_damage_w = std::max(x1 - gr_damage_x, 0);
+    gr_damage_h = std::max(y1 - gr_damage_y, 0);
+    gr_has_damage = true;
+    gr_noclip();
+    return 0;
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -217,6 +284,53 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
     gl->color4xv(gl, color);
 
     gr_is_curr_clr_opaque = (a == 255);
+    for (int i = 0; i < 4; i++)
+        gr_fast_color[i] = (color[i] - 1) >> 8;
+}
+
+static bool gr_fast_format(int format)
+{
+    return format == GGL_PIXEL_FORMAT_RGBA_8888 ||
+           format == GGL_PIXEL_FORMAT_RGBX_8888 ||
+           format == GGL_PIXEL_FORMAT_BGRA_8888;
+}
+
+// The fast paths only handle unrotated 32bpp draw surfaces, everything
+// else keeps going through pixelflinger.
+static bool gr_fast_available()
+{
+    return gr_rotation == 0 && gr_draw->pixel_bytes == 4 && gr_fast_format(gr_draw->format);
+}
+
+// Clip a display rectangle [l, r) x [t, b) to the draw surface and the scissor
+static bool gr_fast_clip(int& l, int& t, int& r, int& b)
+{
+    l = std::max(l, 0);
+    t = std::max(t, 0);
+    r = std::min(r, (int)gr_draw->width);
+    b = std::min(b, (int)gr_draw->height);
+    if (gr_fast_scissor) {
+        l = std::max(l, gr_fast_scissor_x);
+        t = std::max(t, gr_fast_scissor_y);
+        r = std::min(r, gr_fast_scissor_x + gr_fast_scissor_w);
+        b = std::min(b, gr_fast_scissor_y + gr_fast_scissor_h);
+    }
+    return l < r && t < b;
+}
+
+// Current color in the byte order of the draw surface
+static void gr_fast_pixel(unsigned char* px)
+{
+    bool bgr = gr_draw->format == GGL_PIXEL_FORMAT_BGRA_8888;
+    px[0] = gr_fast_color[bgr ? 2 : 0];
+    px[1] = gr_fast_color[1];
+    px[2] = gr_fast_color[bgr ? 0 : 2];
+    px[3] = gr_fast_color[3];
+}
+
+static unsigned char* gr_fast_row(int x, int y)
+{
+    return gr_draw->data + y * gr_draw->row_bytes + x * 4;
 }
 
 void gr_clear()
@@ -249,6 +363,24 @@ void gr_fill(int x, int y, int w, int h)
     int x0_disp, y0_disp, x1_disp, y1_disp;
     int l_disp, r_disp, t_disp, b_disp;
 
+    if (gr_fast_available()) {
+        l_disp = x; t_disp = y; r_disp = x + w; b_disp = y + h;
+        if (!gr_fast_clip(l_disp, t_disp, r_disp, b_disp))
+            return;
+        unsigned char px[4];
+        gr_fast_pixel(px);
+        for (int row = t_disp; row < b_disp; row++) {
+            if (gr_is_curr_clr_opaque) {
+                uint32_t pixel;
+                memcpy(&pixel, px, 4);
+                gr_kernel_fill32(gr_fast_row(l_disp, row), pixel, r_disp - l_disp);
+            } else {
+                gr_kernel_blend_fill32(gr_fast_row(l_disp, row), px, r_disp - l_disp);
+            }
+        }
+        return;
+    }
+
     if(gr_is_curr_clr_opaque)
         gl->disable(gl, GGL_BLEND);
 
@@ -276,6 +408,28 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    if (gr_fast_available() && gr_fast_format(surface->format)) {
+        int l = dx, t = dy, r = dx + w, b = dy + h;
+        // Stay inside the source surface as well
+        l = std::max(l, dx - sx);
+        t = std::max(t, dy - sy);
+        r = std::min(r, dx - sx + (int)surface->width);
+        b = std::min(b, dy - sy + (int)surface->height);
+        if (!gr_fast_clip(l, t, r, b))
+            return;
+        bool swap_rb = (surface->format == GGL_PIXEL_FORMAT_BGRA_8888) !=
+                       (gr_draw->format == GGL_PIXEL_FORMAT_BGRA_8888);
+        for (int row = t; row < b; row++) {
+            const unsigned char* src = (const unsigned char*)surface->data +
+                    ((row - dy + sy) * surface->stride + (l - dx + sx)) * 4;
+            if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888)
+                gr_kernel_copy32(gr_fast_row(l, row), src, r - l, swap_rb);
+            else
+                gr_kernel_blend32(gr_fast_row(l, row), src, r - l, swap_rb);
+        }
+        return;
+    }
+
     if(surface->format == GGL_PIXEL_FORMAT_RGBX_8888)
         gl->disable(gl, GGL_BLEND);
 
@@ -327,6 +481,28 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
         gl->enable(gl, GGL_BLEND);
 }
 
+int gr_blit_a8(gr_surface coverage, int sx, int sy, int w, int h, int dx, int dy)
+{
+    GGLSurface *surface = (GGLSurface*)coverage;
+
+    if (!gr_fast_available() || surface->format != GGL_PIXEL_FORMAT_A_8)
+        return -1;
+
+    int l = std::max(dx, dx - sx), t = std::max(dy, dy - sy);
+    int r = std::min(dx + w, dx - sx + (int)surface->width);
+    int b = std::min(dy + h, dy - sy + (int)surface->height);
+    if (!gr_fast_clip(l, t, r, b))
+        return 0;
+    unsigned char px[4];
+    gr_fast_pixel(px);
+    for (int row = t; row < b; row++) {
+        const unsigned char* src = (const unsigned char*)surface->data +
+                (row - dy + sy) * surface->stride + (l - dx + sx);
+        gr_kernel_blend_a8(gr_fast_row(l, row), src, px, r - l);
+    }
+    return 0;
+}
+
 unsigned int gr_get_width(gr_surface surface) {
     if (surface == NULL) {
         return 0;
@@ -342,7 +518,14 @@ unsigned int gr_get_height(gr_surface surface) {
 }
 
 void gr_flip() {
-    gr_draw = gr_backend->flip(gr_backend);
+    if (gr_has_damage) {
+        int x = gr_damage_x, y = gr_damage_y, w = gr_damage_w, h = gr_damage_h;
+        gr_rect_to_disp(x, y, w, h);
+        gr_has_damage = false;
+        gr_draw = gr_backend->flip_rect(gr_backend, x, y, w, h);
+        gr_noclip();
+    } else
+        gr_draw = gr_backend->flip(gr_backend);
     // On double buffered back ends, when we flip, we need to tell
     // pixel flinger to draw to the other buffer
     gr_mem_surface.data = (GGLubyte*)gr_draw->data;
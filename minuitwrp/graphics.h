@@ -34,6 +34,12 @@ struct minui_backend {
 
     // Device cleanup when drawing is done.
     void (*exit)(minui_backend*);
+
+    // Optional. Like flip(), but only the given rectangle (in display
+    // coordinates) changed since the previous flip. Backends may only
+    // provide this if they always return the same, persistent drawing
+    // surface, since partial rendering relies on its contents.
+    GRSurface* (*flip_rect)(minui_backend*, int x, int y, int w, int h);
 };
 
 minui_backend* open_fbdev();
@@ -31,6 +31,8 @@
 #include "minui.h"
 #include "graphics.h"
 #include <pixelflinger/pixelflinger.h>
+// For std::min and std::max
+#include <algorithm>
 
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(*(A)))
 
@@ -44,6 +46,28 @@ static drm_surface *drm_surfaces[2];
 static int current_buffer;
 static GRSurface *draw_buf = NULL;
 
+// Bounding box of the area of each scanout buffer that is out of date
+// relative to draw_buf (x1/y1 exclusive, empty when x0 >= x1).
+struct drm_dirty_rect {
+    int x0, y0, x1, y1;
+};
+static drm_dirty_rect drm_dirty[2];
+
+static void drm_dirty_add(drm_dirty_rect *dirty, int x0, int y0, int x1, int y1) {
+    if (dirty->x0 >= dirty->x1 || dirty->y0 >= dirty->y1) {
+        *dirty = { x0, y0, x1, y1 };
+        return;
+    }
+    dirty->x0 = std::min(dirty->x0, x0);
+    dirty->y0 = std::min(dirty->y0, y0);
+    dirty->x1 = std::max(dirty->x1, x1);
+    dirty->y1 = std::max(dirty->y1, y1);
+}
+
+static void drm_dirty_full(drm_dirty_rect *dirty) {
+    *dirty = { 0, 0, draw_buf->width, draw_buf->height };
+}
+
 static drmModeCrtc *main_monitor_crtc;
 static drmModeConnector *main_monitor_connector;
 
@@ -474,19 +498,16 @@ static GRSurface* drm_init(minui_backend* backend __unused) {
     }
 
     current_buffer = 0;
+    drm_dirty_full(&drm_dirty[0]);
+    drm_dirty_full(&drm_dirty[1]);
 
     drm_enable_crtc(drm_fd, main_monitor_crtc, drm_surfaces[1]);
 
     return draw_buf;
 }
 
-static GRSurface* drm_flip(minui_backend* backend __unused) {
-    int ret;
-    memcpy(drm_surfaces[current_buffer]->base.data,
-            draw_buf->data, draw_buf->height * draw_buf->row_bytes);
-
-
-    ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
+static GRSurface* drm_page_flip() {
+    int ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
                           drm_surfaces[current_buffer]->fb_id, 0, NULL);
     if (ret < 0) {
         printf("drmModePageFlip failed ret=%d\n", ret);
@@ -496,6 +517,44 @@ static GRSurface* drm_flip(minui_backend* backend __unused) {
     return draw_buf;
 }
 
+static GRSurface* drm_flip(minui_backend* backend __unused) {
+    memcpy(drm_surfaces[current_buffer]->base.data,
+            draw_buf->data, draw_buf->height * draw_buf->row_bytes);
+
+    drm_dirty[current_buffer] = {};
+    drm_dirty_full(&drm_dirty[1 - current_buffer]);
+    return drm_page_flip();
+}
+
+static GRSurface* drm_flip_rect(minui_backend* backend __unused,
+                                int x, int y, int w, int h) {
+    int x1 = std::min(x + w, draw_buf->width);
+    int y1 = std::min(y + h, draw_buf->height);
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+
+    // The buffer we are about to show has also missed whatever changed
+    // while the other buffer was on screen, so copy both areas into it.
+    if (x < x1 && y < y1) {
+        drm_dirty_add(&drm_dirty[0], x, y, x1, y1);
+        drm_dirty_add(&drm_dirty[1], x, y, x1, y1);
+    }
+
+    drm_dirty_rect *dirty = &drm_dirty[current_buffer];
+    if (dirty->x0 < dirty->x1 && dirty->y0 < dirty->y1) {
+        int offset = dirty->x0 * draw_buf->pixel_bytes;
+        int len = (dirty->x1 - dirty->x0) * draw_buf->pixel_bytes;
+        for (int row = dirty->y0; row < dirty->y1; ++row) {
+            int start = row * draw_buf->row_bytes + offset;
+            memcpy(drm_surfaces[current_buffer]->base.data + start,
+                    draw_buf->data + start, len);
+        }
+    }
+    *dirty = {};
+
+    return drm_page_flip();
+}
+
 static void drm_exit(minui_backend* backend __unused) {
     drm_disable_crtc(drm_fd, main_monitor_crtc);
     drm_destroy_surface(drm_surfaces[0]);
@@ -511,6 +570,7 @@ static minui_backend drm_backend = {
     .flip = drm_flip,
     .blank = drm_blank,
     .exit = drm_exit,
+    .flip_rect = drm_flip_rect,
 };
 
 minui_backend* open_drm() {
@@ -0,0 +1,344 @@
+/*
+		Copyright 2013 to 2020 TeamWin
+		This file is part of TWRP/TeamWin Recovery Project.
+
+		TWRP is free software: you can redistribute it and/or modify
+		it under the terms of the GNU General Public License as published by
+		the Free Software Foundation, either version 3 of the License, or
+		(at your option) any later version.
+
+		TWRP is distributed in the hope that it will be useful,
+		but WITHOUT ANY WARRANTY; without even the implied warranty of
+		MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+		GNU General Public License for more details.
+
+		You should have received a copy of the GNU General Public License
+		along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GR_KERNEL_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GR_KERNEL_SSE2
+#endif
+
+#include "graphics_kernels.h"
+
+// Exact x / 255 for x <= 255 * 255
+static inline uint8_t div255(unsigned x)
+{
+	x += 128;
+	return (uint8_t)((x + (x >> 8)) >> 8);
+}
+
+static inline void blend_pixel(uint8_t* d, uint8_t s0, uint8_t s1, uint8_t s2, uint8_t a)
+{
+	unsigned ia = 255 - a;
+	d[0] = div255(s0 * a + d[0] * ia);
+	d[1] = div255(s1 * a + d[1] * ia);
+	d[2] = div255(s2 * a + d[2] * ia);
+	d[3] = div255(a * a + d[3] * ia);
+}
+
+void gr_kernel_fill32_ref(uint8_t* dst, uint32_t pixel, int n)
+{
+	for (int i = 0; i < n; i++, dst += 4)
+		memcpy(dst, &pixel, 4);
+}
+
+void gr_kernel_blend_fill32_ref(uint8_t* dst, const uint8_t* color, int n)
+{
+	for (int i = 0; i < n; i++, dst += 4)
+		blend_pixel(dst, color[0], color[1], color[2], color[3]);
+}
+
+void gr_kernel_copy32_ref(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	if (!swap_rb) {
+		memcpy(dst, src, n * 4);
+		return;
+	}
+	for (int i = 0; i < n; i++, dst += 4, src += 4) {
+		uint8_t r = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = src[3];
+		dst[0] = r;
+	}
+}
+
+void gr_kernel_blend32_ref(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	int c0 = swap_rb ? 2 : 0, c2 = swap_rb ? 0 : 2;
+	for (int i = 0; i < n; i++, dst += 4, src += 4) {
+		uint8_t a = src[3];
+		if (a == 255) {
+			dst[0] = src[c0];
+			dst[1] = src[1];
+			dst[2] = src[c2];
+			dst[3] = 255;
+		} else if (a) {
+			blend_pixel(dst, src[c0], src[1], src[c2], a);
+		}
+	}
+}
+
+void gr_kernel_blend_a8_ref(uint8_t* dst, const uint8_t* coverage, const uint8_t* color, int n)
+{
+	for (int i = 0; i < n; i++, dst += 4) {
+		uint8_t a = coverage[i];
+		if (a)
+			blend_pixel(dst, color[0], color[1], color[2], a);
+	}
+}
+
+#if defined(GR_KERNEL_NEON)
+
+// (x + 128 + ((x + 128) >> 8)) >> 8, done with rounding shifts
+static inline uint8x8_t div255_neon(uint16x8_t x)
+{
+	return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+
+static inline uint8x8_t blend_neon(uint8x8_t s, uint8x8_t d, uint8x8_t a, uint8x8_t ia)
+{
+	return div255_neon(vmlal_u8(vmull_u8(s, a), d, ia));
+}
+
+static inline void blend_px8_neon(uint8_t* dst, uint8x8_t s0, uint8x8_t s1, uint8x8_t s2, uint8x8_t a)
+{
+	uint8x8x4_t d = vld4_u8(dst);
+	uint8x8_t ia = vmvn_u8(a);
+	d.val[0] = blend_neon(s0, d.val[0], a, ia);
+	d.val[1] = blend_neon(s1, d.val[1], a, ia);
+	d.val[2] = blend_neon(s2, d.val[2], a, ia);
+	d.val[3] = blend_neon(a, d.val[3], a, ia);
+	vst4_u8(dst, d);
+}
+
+void gr_kernel_fill32(uint8_t* dst, uint32_t pixel, int n)
+{
+	uint32x4_t v = vdupq_n_u32(pixel);
+	int i = 0;
+	for (; i + 4 <= n; i += 4, dst += 16)
+		vst1q_u8(dst, vreinterpretq_u8_u32(v));
+	gr_kernel_fill32_ref(dst, pixel, n - i);
+}
+
+void gr_kernel_blend_fill32(uint8_t* dst, const uint8_t* color, int n)
+{
+	uint8x8_t s0 = vdup_n_u8(color[0]), s1 = vdup_n_u8(color[1]);
+	uint8x8_t s2 = vdup_n_u8(color[2]), a = vdup_n_u8(color[3]);
+	int i = 0;
+	for (; i + 8 <= n; i += 8, dst += 32)
+		blend_px8_neon(dst, s0, s1, s2, a);
+	gr_kernel_blend_fill32_ref(dst, color, n - i);
+}
+
+void gr_kernel_copy32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	if (!swap_rb) {
+		memcpy(dst, src, n * 4);
+		return;
+	}
+	int i = 0;
+	for (; i + 16 <= n; i += 16, dst += 64, src += 64) {
+		uint8x16x4_t p = vld4q_u8(src);
+		uint8x16_t t = p.val[0];
+		p.val[0] = p.val[2];
+		p.val[2] = t;
+		vst4q_u8(dst, p);
+	}
+	gr_kernel_copy32_ref(dst, src, n - i, true);
+}
+
+void gr_kernel_blend32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8, dst += 32, src += 32) {
+		uint8x8x4_t s = vld4_u8(src);
+		uint64_t alpha = vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0);
+		if (alpha == 0)
+			continue;
+		if (swap_rb) {
+			uint8x8_t t = s.val[0];
+			s.val[0] = s.val[2];
+			s.val[2] = t;
+		}
+		if (alpha == ~0ULL)
+			vst4_u8(dst, s);
+		else
+			blend_px8_neon(dst, s.val[0], s.val[1], s.val[2], s.val[3]);
+	}
+	gr_kernel_blend32_ref(dst, src, n - i, swap_rb);
+}
+
+void gr_kernel_blend_a8(uint8_t* dst, const uint8_t* coverage, const uint8_t* color, int n)
+{
+	uint8x8_t s0 = vdup_n_u8(color[0]), s1 = vdup_n_u8(color[1]), s2 = vdup_n_u8(color[2]);
+	int i = 0;
+	for (; i + 8 <= n; i += 8, dst += 32) {
+		uint8x8_t a = vld1_u8(coverage + i);
+		if (vget_lane_u64(vreinterpret_u64_u8(a), 0) == 0)
+			continue;
+		blend_px8_neon(dst, s0, s1, s2, a);
+	}
+	gr_kernel_blend_a8_ref(dst, coverage + i, color, n - i);
+}
+
+const char* gr_kernel_isa(void)
+{
+	return "neon";
+}
+
+#elif defined(GR_KERNEL_SSE2)
+
+// Blend two pixels held as 16-bit channels, a holds the alpha of each pixel in all 4 lanes
+static inline __m128i blend_sse2(__m128i s, __m128i d, __m128i a)
+{
+	__m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, ia));
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i swap_rb_sse2(__m128i p)
+{
+	const __m128i ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i lo = _mm_set1_epi32(0x000000ff);
+	return _mm_or_si128(_mm_and_si128(p, ga),
+			_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), lo), _mm_slli_epi32(_mm_and_si128(p, lo), 16)));
+}
+
+// Broadcast the alpha lane of each of the two 16-bit pixels
+static inline __m128i alpha_sse2(__m128i p)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+void gr_kernel_fill32(uint8_t* dst, uint32_t pixel, int n)
+{
+	__m128i v = _mm_set1_epi32((int)pixel);
+	int i = 0;
+	for (; i + 4 <= n; i += 4, dst += 16)
+		_mm_storeu_si128((__m128i*)dst, v);
+	gr_kernel_fill32_ref(dst, pixel, n - i);
+}
+
+void gr_kernel_blend_fill32(uint8_t* dst, const uint8_t* color, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i s = _mm_setr_epi16(color[0], color[1], color[2], color[3], color[0], color[1], color[2], color[3]);
+	const __m128i a = _mm_set1_epi16(color[3]);
+	int i = 0;
+	for (; i + 4 <= n; i += 4, dst += 16) {
+		__m128i d = _mm_loadu_si128((const __m128i*)dst);
+		__m128i lo = blend_sse2(s, _mm_unpacklo_epi8(d, zero), a);
+		__m128i hi = blend_sse2(s, _mm_unpackhi_epi8(d, zero), a);
+		_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+	}
+	gr_kernel_blend_fill32_ref(dst, color, n - i);
+}
+
+void gr_kernel_copy32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	if (!swap_rb) {
+		memcpy(dst, src, n * 4);
+		return;
+	}
+	int i = 0;
+	for (; i + 4 <= n; i += 4, dst += 16, src += 16)
+		_mm_storeu_si128((__m128i*)dst, swap_rb_sse2(_mm_loadu_si128((const __m128i*)src)));
+	gr_kernel_copy32_ref(dst, src, n - i, true);
+}
+
+void gr_kernel_blend32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i amask = _mm_set1_epi32(0xff000000);
+	int i = 0;
+	for (; i + 4 <= n; i += 4, dst += 16, src += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i*)src);
+		int alpha = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(s, amask), amask)) & 0x8888;
+		int transparent = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(s, amask), zero)) & 0x8888;
+		if (transparent == 0x8888)
+			continue;
+		if (swap_rb)
+			s = swap_rb_sse2(s);
+		if (alpha == 0x8888) {
+			_mm_storeu_si128((__m128i*)dst, s);
+			continue;
+		}
+		__m128i d = _mm_loadu_si128((const __m128i*)dst);
+		__m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+		__m128i lo = blend_sse2(slo, _mm_unpacklo_epi8(d, zero), alpha_sse2(slo));
+		__m128i hi = blend_sse2(shi, _mm_unpackhi_epi8(d, zero), alpha_sse2(shi));
+		_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+	}
+	gr_kernel_blend32_ref(dst, src, n - i, swap_rb);
+}
+
+void gr_kernel_blend_a8(uint8_t* dst, const uint8_t* coverage, const uint8_t* color, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rgb = _mm_setr_epi16(color[0], color[1], color[2], 0, color[0], color[1], color[2], 0);
+	const __m128i amask = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+	int i = 0;
+	for (; i + 4 <= n; i += 4, dst += 16) {
+		uint32_t cov;
+		memcpy(&cov, coverage + i, 4);
+		if (cov == 0)
+			continue;
+		__m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)cov), zero);
+		c = _mm_unpacklo_epi16(c, c);
+		__m128i alo = _mm_unpacklo_epi32(c, c), ahi = _mm_unpackhi_epi32(c, c);
+		__m128i d = _mm_loadu_si128((const __m128i*)dst);
+		__m128i lo = blend_sse2(_mm_or_si128(rgb, _mm_and_si128(alo, amask)), _mm_unpacklo_epi8(d, zero), alo);
+		__m128i hi = blend_sse2(_mm_or_si128(rgb, _mm_and_si128(ahi, amask)), _mm_unpackhi_epi8(d, zero), ahi);
+		_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+	}
+	gr_kernel_blend_a8_ref(dst, coverage + i, color, n - i);
+}
+
+const char* gr_kernel_isa(void)
+{
+	return "sse2";
+}
+
+#else
+
+void gr_kernel_fill32(uint8_t* dst, uint32_t pixel, int n)
+{
+	gr_kernel_fill32_ref(dst, pixel, n);
+}
+
+void gr_kernel_blend_fill32(uint8_t* dst, const uint8_t* color, int n)
+{
+	gr_kernel_blend_fill32_ref(dst, color, n);
+}
+
+void gr_kernel_copy32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	gr_kernel_copy32_ref(dst, src, n, swap_rb);
+}
+
+void gr_kernel_blend32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb)
+{
+	gr_kernel_blend32_ref(dst, src, n, swap_rb);
+}
+
+void gr_kernel_blend_a8(uint8_t* dst, const uint8_t* coverage, const uint8_t* color, int n)
+{
+	gr_kernel_blend_a8_ref(dst, coverage, color, n);
+}
+
+const char* gr_kernel_isa(void)
+{
+	return "scalar";
+}
+
+#endif
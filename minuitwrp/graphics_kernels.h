@@ -0,0 +1,59 @@
+/*
+		Copyright 2013 to 2020 TeamWin
+		This file is part of TWRP/TeamWin Recovery Project.
+
+		TWRP is free software: you can redistribute it and/or modify
+		it under the terms of the GNU General Public License as published by
+		the Free Software Foundation, either version 3 of the License, or
+		(at your option) any later version.
+
+		TWRP is distributed in the hope that it will be useful,
+		but WITHOUT ANY WARRANTY; without even the implied warranty of
+		MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+		GNU General Public License for more details.
+
+		You should have received a copy of the GNU General Public License
+		along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _GRAPHICS_KERNELS_H
+#define _GRAPHICS_KERNELS_H
+
+#include <stdint.h>
+
+// Row kernels for 32bpp surfaces (RGBA_8888, RGBX_8888 and BGRA_8888).
+// All of them keep alpha (or the unused X channel) in byte 3 of each pixel,
+// so converting between the formats only means swapping bytes 0 and 2.
+//
+// Blending follows the GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA setup used by
+// pixelflinger: out = (src * a + dst * (255 - a)) / 255 on every channel.
+//
+// Each kernel has a NEON or SSE2 implementation when available and falls back
+// to the portable *_ref version otherwise (and for the tail of a row).
+
+// Fill n pixels with a pixel value already packed in the surface byte order
+void gr_kernel_fill32(uint8_t* dst, uint32_t pixel, int n);
+
+// Blend a constant color over n pixels, color is in the surface byte order with alpha in color[3]
+void gr_kernel_blend_fill32(uint8_t* dst, const uint8_t* color, int n);
+
+// Copy n pixels, swapping bytes 0 and 2 if the formats differ in channel order
+void gr_kernel_copy32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb);
+
+// Blend n pixels over dst using the alpha of each source pixel
+void gr_kernel_blend32(uint8_t* dst, const uint8_t* src, int n, bool swap_rb);
+
+// Blend a constant color over n pixels through 8-bit coverage values (A_8 glyph surfaces)
+void gr_kernel_blend_a8(uint8_t* dst, const uint8_t* coverage, const uint8_t* color, int n);
+
+// Portable versions, also used as the reference by minuitwrp_kernel_bench
+void gr_kernel_fill32_ref(uint8_t* dst, uint32_t pixel, int n);
+void gr_kernel_blend_fill32_ref(uint8_t* dst, const uint8_t* color, int n);
+void gr_kernel_copy32_ref(uint8_t* dst, const uint8_t* src, int n, bool swap_rb);
+void gr_kernel_blend32_ref(uint8_t* dst, const uint8_t* src, int n, bool swap_rb);
+void gr_kernel_blend_a8_ref(uint8_t* dst, const uint8_t* coverage, const uint8_t* color, int n);
+
+// Name of the instruction set the kernels were built for
+const char* gr_kernel_isa(void);
+
+#endif // _GRAPHICS_KERNELS_H
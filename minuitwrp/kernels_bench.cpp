@@ -0,0 +1,127 @@
+/*
+		Copyright 2013 to 2020 TeamWin
+		This file is part of TWRP/TeamWin Recovery Project.
+
+		TWRP is free software: you can redistribute it and/or modify
+		it under the terms of the GNU General Public License as published by
+		the Free Software Foundation, either version 3 of the License, or
+		(at your option) any later version.
+
+		TWRP is distributed in the hope that it will be useful,
+		but WITHOUT ANY WARRANTY; without even the implied warranty of
+		MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+		GNU General Public License for more details.
+
+		You should have received a copy of the GNU General Public License
+		along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Micro-benchmark for the minuitwrp row kernels. Every kernel is first
+// checked against its portable version, then both are timed on a full
+// screen worth of rows.
+//
+// Usage: minuitwrp_kernel_bench [width] [height] [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "graphics_kernels.h"
+
+static const uint8_t bench_color[4] = { 0x30, 0x90, 0xe0, 0xa0 };
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void fill_random(std::vector<uint8_t>& buf, unsigned seed)
+{
+	srand(seed);
+	for (size_t i = 0; i < buf.size(); i++)
+		buf[i] = rand() & 0xff;
+	// Make sure the all-transparent and all-opaque shortcuts get exercised too
+	for (size_t i = 0; i + 64 <= buf.size(); i += 256)
+		memset(&buf[i], (i / 256) & 1 ? 0xff : 0x00, 64);
+}
+
+struct Kernel {
+	const char* name;
+	void (*fast)(uint8_t* dst, const uint8_t* src, int n);
+	void (*ref)(uint8_t* dst, const uint8_t* src, int n);
+};
+
+static void fill_fast(uint8_t* dst, const uint8_t*, int n) { gr_kernel_fill32(dst, 0xff336699, n); }
+static void fill_ref(uint8_t* dst, const uint8_t*, int n) { gr_kernel_fill32_ref(dst, 0xff336699, n); }
+static void blend_fill_fast(uint8_t* dst, const uint8_t*, int n) { gr_kernel_blend_fill32(dst, bench_color, n); }
+static void blend_fill_ref(uint8_t* dst, const uint8_t*, int n) { gr_kernel_blend_fill32_ref(dst, bench_color, n); }
+static void copy_swap_fast(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_copy32(dst, src, n, true); }
+static void copy_swap_ref(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_copy32_ref(dst, src, n, true); }
+static void blend_fast(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_blend32(dst, src, n, false); }
+static void blend_ref(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_blend32_ref(dst, src, n, false); }
+static void blend_swap_fast(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_blend32(dst, src, n, true); }
+static void blend_swap_ref(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_blend32_ref(dst, src, n, true); }
+// The A_8 kernels read one coverage byte per pixel from the source buffer
+static void a8_fast(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_blend_a8(dst, src, bench_color, n); }
+static void a8_ref(uint8_t* dst, const uint8_t* src, int n) { gr_kernel_blend_a8_ref(dst, src, bench_color, n); }
+
+static const Kernel kernels[] = {
+	{ "fill32", fill_fast, fill_ref },
+	{ "blend_fill32", blend_fill_fast, blend_fill_ref },
+	{ "copy32_swap", copy_swap_fast, copy_swap_ref },
+	{ "blend32", blend_fast, blend_ref },
+	{ "blend32_swap", blend_swap_fast, blend_swap_ref },
+	{ "blend_a8", a8_fast, a8_ref },
+};
+
+int main(int argc, char** argv)
+{
+	int width = argc > 1 ? atoi(argv[1]) : 1080;
+	int height = argc > 2 ? atoi(argv[2]) : 2340;
+	int iterations = argc > 3 ? atoi(argv[3]) : 20;
+	if (width <= 0 || height <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: %s [width] [height] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	size_t size = (size_t)width * height * 4;
+	std::vector<uint8_t> src(size), dst_fast(size), dst_ref(size);
+	fill_random(src, 1);
+	int failed = 0;
+
+	printf("kernels: %s, %dx%d, %d iterations\n", gr_kernel_isa(), width, height, iterations);
+	for (const Kernel& k : kernels) {
+		// Odd row lengths and offsets so the scalar tails are covered as well
+		for (int n = 0; n <= 67; n++) {
+			fill_random(dst_fast, n + 2);
+			dst_ref = dst_fast;
+			k.fast(&dst_fast[4], &src[n], n);
+			k.ref(&dst_ref[4], &src[n], n);
+			if (dst_fast != dst_ref) {
+				printf("%-14s MISMATCH at length %d\n", k.name, n);
+				failed = 1;
+				break;
+			}
+		}
+
+		fill_random(dst_fast, 3);
+		dst_ref = dst_fast;
+		double start = now_ms();
+		for (int i = 0; i < iterations; i++)
+			for (int y = 0; y < height; y++)
+				k.fast(&dst_fast[(size_t)y * width * 4], &src[(size_t)y * width * 4], width);
+		double fast = now_ms() - start;
+		start = now_ms();
+		for (int i = 0; i < iterations; i++)
+			for (int y = 0; y < height; y++)
+				k.ref(&dst_ref[(size_t)y * width * 4], &src[(size_t)y * width * 4], width);
+		double ref = now_ms() - start;
+		printf("%-14s %8.3f ms/frame  ref %8.3f ms/frame  x%.2f\n", k.name,
+				fast / iterations, ref / iterations, fast > 0 ? ref / fast : 0.0);
+	}
+	return failed;
+}
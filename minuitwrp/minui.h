@@ -19,6 +19,8 @@
 
 #include "../gui/placement.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct GRSurface {
     int width;
@@ -42,6 +44,7 @@ int gr_fb_width(void);
 int gr_fb_height(void);
 gr_pixel *gr_fb_data(void);
 void gr_flip(void);
+int gr_set_damage(int x, int y, int w, int h);
 void gr_fb_blank(bool blank);
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -66,6 +69,9 @@ int gr_ttf_getMaxFontHeight(void *font);
 void gr_ttf_dump_stats(void);
 
 void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy);
+// Like gr_blit(), but for A_8 coverage surfaces drawn with the current color.
+// Returns -1 if the draw surface needs pixelflinger instead.
+int gr_blit_a8(gr_surface coverage, int sx, int sy, int w, int h, int dx, int dy);
 unsigned int gr_get_width(gr_surface surface);
 unsigned int gr_get_height(gr_surface surface);
 int gr_get_surface(gr_surface* surface);
@@ -95,6 +101,10 @@ int ev_has_mouse(void);
 
 // Returns 0 if no error, else negative.
 int res_create_surface(const char* name, gr_surface* pSurface);
+int res_create_surface_mem(const unsigned char* data, size_t size, gr_surface* pSurface);
+// Store and load decoded surfaces, key identifies the source and how it was processed
+int res_save_surface(gr_surface surface, const char* path, uint64_t key);
+int res_load_surface(const char* path, uint64_t key, gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h);
 
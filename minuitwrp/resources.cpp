@@ -19,6 +19,7 @@
 #include <unistd.h>
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 
 #include <sys/ioctl.h>
@@ -50,25 +51,14 @@ static GGLSurface* malloc_surface(size_t data_size) {
     return surface;
 }
 
-static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
-                    png_uint_32* width, png_uint_32* height, png_byte* channels, FILE** fpp) {
-    char resPath[256];
+// Reads the PNG header from fp, which is closed on failure
+static int open_png_file(FILE* fp, png_structp* png_ptr, png_infop* info_ptr,
+                         png_uint_32* width, png_uint_32* height, png_byte* channels) {
     unsigned char header[8];
     int result = 0;
     int color_type, bit_depth;
     size_t bytesRead;
 
-    snprintf(resPath, sizeof(resPath)-1, TWRES "images/%s.png", name);
-    resPath[sizeof(resPath)-1] = '\0';
-    FILE* fp = fopen(resPath, "rb");
-    if (fp == NULL) {
-        fp = fopen(name, "rb");
-        if (fp == NULL) {
-            result = -1;
-            goto exit;
-        }
-    }
-
     bytesRead = fread(header, 1, sizeof(header), fp);
     if (bytesRead != sizeof(header)) {
         result = -2;
@@ -122,17 +112,33 @@ static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
         png_set_palette_to_rgb(*png_ptr);
     }
 
-    *fpp = fp;
     return result;
 
   exit:
     if (result < 0) {
         png_destroy_read_struct(png_ptr, info_ptr, NULL);
     }
-    if (fp != NULL) {
-        fclose(fp);
+    fclose(fp);
+
+    return result;
+}
+
+static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
+                    png_uint_32* width, png_uint_32* height, png_byte* channels, FILE** fpp) {
+    char resPath[256];
+
+    snprintf(resPath, sizeof(resPath)-1, TWRES "images/%s.png", name);
+    resPath[sizeof(resPath)-1] = '\0';
+    FILE* fp = fopen(resPath, "rb");
+    if (fp == NULL) {
+        fp = fopen(name, "rb");
+        if (fp == NULL)
+            return -1;
     }
 
+    int result = open_png_file(fp, png_ptr, info_ptr, width, height, channels);
+    if (result >= 0)
+        *fpp = fp;
     return result;
 }
 
@@ -202,22 +208,15 @@ static void transform_rgb_to_draw(unsigned char* input_row,
     }
 }
 
-int res_create_surface_png(const char* name, gr_surface* pSurface) {
+// Decodes the rest of a PNG opened with open_png_file() and closes fp
+static int read_png_surface(FILE* fp, png_structp png_ptr, png_infop info_ptr,
+                            png_uint_32 width, png_uint_32 height, png_byte channels,
+                            gr_surface* pSurface) {
     GGLSurface* surface = NULL;
     int result = 0;
-    png_structp png_ptr = NULL;
-    png_infop info_ptr = NULL;
-    png_uint_32 width, height;
-    png_byte channels;
-    FILE* fp;
     unsigned char* p_row;
     unsigned int y;
 
-    *pSurface = NULL;
-
-    result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels, &fp);
-    if (result < 0) return result;
-
     surface = init_display_surface(width, height);
     if (surface == NULL) {
         result = -8;
@@ -253,8 +252,25 @@ int res_create_surface_png(const char* name, gr_surface* pSurface) {
     return result;
 }
 
+int res_create_surface_png(const char* name, gr_surface* pSurface) {
+    int result = 0;
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+    png_uint_32 width, height;
+    png_byte channels;
+    FILE* fp;
+
+    *pSurface = NULL;
+
+    result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels, &fp);
+    if (result < 0) return result;
+
+    return read_png_surface(fp, png_ptr, info_ptr, width, height, channels, pSurface);
+}
+
 #ifdef TW_INCLUDE_JPEG
-int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
+// Decodes a JPEG from fp and closes it
+static int read_jpg_surface(FILE* fp, gr_surface* pSurface) {
     GGLSurface* surface = NULL;
     int result = 0, y;
     struct jpeg_decompress_struct cinfo;
@@ -262,19 +278,6 @@ int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
     unsigned char* pData;
     size_t width, height, stride, pixelSize;
 
-    FILE* fp = fopen(name, "rb");
-    if (fp == NULL) {
-        char resPath[256];
-
-        snprintf(resPath, sizeof(resPath)-1, TWRES "images/%s", name);
-        resPath[sizeof(resPath)-1] = '\0';
-        fp = fopen(resPath, "rb");
-        if (fp == NULL) {
-            result = -1;
-            goto exit;
-        }
-    }
-
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_decompress(&cinfo);
 
@@ -351,6 +354,20 @@ exit:
     }
     return result;
 }
+
+int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
+    FILE* fp = fopen(name, "rb");
+    if (fp == NULL) {
+        char resPath[256];
+
+        snprintf(resPath, sizeof(resPath)-1, TWRES "images/%s", name);
+        resPath[sizeof(resPath)-1] = '\0';
+        fp = fopen(resPath, "rb");
+        if (fp == NULL)
+            return -1;
+    }
+    return read_jpg_surface(fp, pSurface);
+}
 #endif
 
 int res_create_surface(const char* name, gr_surface* pSurface) {
@@ -372,6 +389,118 @@ int res_create_surface(const char* name, gr_surface* pSurface) {
     return ret;
 }
 
+// Decodes a PNG (or JPEG, if supported) image that is already in memory,
+// e.g. extracted from a theme zip, without going through a temporary file
+int res_create_surface_mem(const unsigned char* data, size_t size, gr_surface* pSurface) {
+    *pSurface = NULL;
+    if (!data || size < 8)
+        return -2;
+
+    FILE* fp = fmemopen(const_cast<unsigned char*>(data), size, "rb");
+    if (fp == NULL)
+        return -1;
+
+    if (png_sig_cmp(const_cast<unsigned char*>(data), 0, 8) == 0) {
+        png_structp png_ptr = NULL;
+        png_infop info_ptr = NULL;
+        png_uint_32 width, height;
+        png_byte channels;
+
+        int result = open_png_file(fp, &png_ptr, &info_ptr, &width, &height, &channels);
+        if (result < 0)
+            return result;
+        return read_png_surface(fp, png_ptr, info_ptr, width, height, channels, pSurface);
+    }
+
+#ifdef TW_INCLUDE_JPEG
+    return read_jpg_surface(fp, pSurface);
+#else
+    fclose(fp);
+    return -3;
+#endif
+}
+
+// Surface cache files hold a header followed by the pixels exactly as they
+// are laid out in memory, so loading one is a single read. The version
+// includes the channel order the images were converted to at load time.
+#define SURFACE_CACHE_MAGIC 0x53465754 // "TWFS"
+#if defined(RECOVERY_ABGR) || defined(RECOVERY_BGRA)
+#define SURFACE_CACHE_VERSION 0x101
+#else
+#define SURFACE_CACHE_VERSION 0x001
+#endif
+
+struct surface_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t reserved;
+};
+
+int res_save_surface(gr_surface surface, const char* path, uint64_t key) {
+    GGLSurface* s = (GGLSurface*) surface;
+    if (!s || s->stride != (GGLint) s->width)
+        return -1;
+
+    struct surface_cache_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SURFACE_CACHE_MAGIC;
+    header.version = SURFACE_CACHE_VERSION;
+    header.key = key;
+    header.width = s->width;
+    header.height = s->height;
+    header.format = s->format;
+
+    // Write to a temporary file first so a partially written file is never picked up
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE* fp = fopen(tmpPath, "wb");
+    if (fp == NULL)
+        return -1;
+    size_t size = (size_t) s->width * s->height * 4;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(s->data, 1, size, fp) == size;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+int res_load_surface(const char* path, uint64_t key, gr_surface* pSurface) {
+    struct surface_cache_header header;
+    *pSurface = NULL;
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != SURFACE_CACHE_MAGIC ||
+            header.version != SURFACE_CACHE_VERSION || header.key != key ||
+            header.width == 0 || header.height == 0 || header.width > 16384 || header.height > 16384) {
+        fclose(fp);
+        return -2;
+    }
+
+    size_t size = (size_t) header.width * header.height * 4;
+    GGLSurface* surface = init_display_surface(header.width, header.height);
+    if (surface == NULL) {
+        fclose(fp);
+        return -8;
+    }
+    surface->format = header.format;
+    if (fread(surface->data, 1, size, fp) != size) {
+        fclose(fp);
+        free(surface);
+        return -3;
+    }
+    fclose(fp);
+    *pSurface = (gr_surface) surface;
+    return 0;
+}
+
 void res_free_surface(gr_surface surface) {
     GGLSurface* pSurface = (GGLSurface*) surface;
     if (pSurface) {
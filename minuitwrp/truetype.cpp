@@ -162,18 +162,7 @@ void* twrpTruetype::gr_ttf_scaleFont(void *font, int max_width, int measured_wid
 	return gr_ttf_loadFont(file, new_size, dpi);
 }
 
-static bool gr_ttf_freeFontCache(void *value, void *context __unused)
-{
-	TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-	FT_Done_Glyph((FT_Glyph)e->glyph);
-	delete e;
-	return true;
-}
-
-void twrpTruetype::gr_ttf_freeStringCache(void *key, void *value, void *context __unused) {
-	StringCacheKey *k = (StringCacheKey *)key;
-	delete k;
-
+void twrpTruetype::gr_ttf_freeStringCache(void *value) {
 	StringCacheEntry *e = (StringCacheEntry *)value;
 	free(e->surface.data);
 	delete e;
@@ -185,28 +174,29 @@ void twrpTruetype::gr_ttf_freeFont(void *font) {
 	TrueTypeFont *d = (TrueTypeFont *)font;
 	if(--d->refcount == 0)
 	{
-		delete d->key;
-
 		FT_Done_Face(d->face);
 
-		StringCacheMap::iterator stringCacheEntryIt = d->string_cache.begin();
-		while (stringCacheEntryIt != d->string_cache.end()) {
-			gr_ttf_freeStringCache(stringCacheEntryIt->second->key, stringCacheEntryIt->second, nullptr);
-			stringCacheEntryIt = d->string_cache.erase(stringCacheEntryIt);
-		}
+		for (auto& it : d->string_cache)
+			gr_ttf_freeStringCache(it.second);
+		d->string_cache.clear();
+		d->string_lru.clear();
 
-		TrueTypeCacheEntryMap::iterator ttcIt = d->glyph_cache.begin();
-		while(ttcIt != d->glyph_cache.end()) {
-			gr_ttf_freeFontCache(ttcIt->second, nullptr);
-			ttcIt = d->glyph_cache.erase(ttcIt);
+		for (auto& it : d->glyph_cache)
+			delete it.second;
+		d->glyph_cache.clear();
+
+		for (GlyphAtlasPage *page : d->atlas) {
+			free(page->surface.data);
+			delete page;
 		}
+		d->atlas.clear();
 
 		pthread_mutex_destroy(&d->mutex);
 
 		TrueTypeFontMap::iterator trueTypeFontIt = font_data.fonts.find(*(d->key));
-		delete d;
 		font_data.fonts.erase(trueTypeFontIt);
-
+		delete d->key;
+		delete d;
 	}
 
 	pthread_mutex_unlock(&font_data.mutex);
@@ -216,68 +206,122 @@ TrueTypeCacheEntry* twrpTruetype::gr_ttf_glyph_cache_peek(TrueTypeFont *font, in
 	TrueTypeCacheEntryMap::iterator glyphCacheItr = font->glyph_cache.find(char_index);
 
 	if(glyphCacheItr != font->glyph_cache.end()) {
-		return font->glyph_cache[char_index];
+		return glyphCacheItr->second;
 	}
 	return nullptr;
 }
 
+// Reserves a width x height area in the font's glyph atlas, returns the page index
+int twrpTruetype::gr_ttf_atlas_alloc(TrueTypeFont *font, int width, int height, int *x, int *y) {
+	GlyphAtlasPage *page = font->atlas.empty() ? nullptr : font->atlas.back();
+
+	if (page && page->shelf_x + width > (int)page->surface.width) {
+		// start a new shelf below the current one
+		page->shelf_y += page->shelf_height;
+		page->shelf_x = 0;
+		page->shelf_height = 0;
+	}
+	if (!page || width > (int)page->surface.width || page->shelf_y + height > (int)page->surface.height) {
+		// glyphs bigger than a page get a page of their own
+		int page_w = MAX(GLYPH_ATLAS_PAGE_SIZE, width);
+		int page_h = MAX(GLYPH_ATLAS_PAGE_SIZE, height);
+		uint8_t *data = (uint8_t *)calloc(page_w * page_h, 1);
+		if (!data)
+			return -1;
+
+		page = new GlyphAtlasPage;
+		page->surface.version = sizeof(page->surface);
+		page->surface.width = page_w;
+		page->surface.height = page_h;
+		page->surface.stride = page_w;
+		page->surface.data = (GGLubyte*)data;
+		page->surface.format = GGL_PIXEL_FORMAT_A_8;
+		page->shelf_x = 0;
+		page->shelf_y = 0;
+		page->shelf_height = 0;
+		font->atlas.push_back(page);
+	}
+
+	*x = page->shelf_x;
+	*y = page->shelf_y;
+	page->shelf_x += width;
+	page->shelf_height = MAX(page->shelf_height, height);
+	return font->atlas.size() - 1;
+}
+
 TrueTypeCacheEntry* twrpTruetype::gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index) {
 	TrueTypeCacheEntryMap::iterator glyphCacheItr = font->glyph_cache.find(char_index);
-	TrueTypeCacheEntry* res = nullptr;
-	if(glyphCacheItr == font->glyph_cache.end())
+	if(glyphCacheItr != font->glyph_cache.end())
+		return glyphCacheItr->second;
+
+	int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
+	if(error)
 	{
-		int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
-		if(error)
-		{
-			fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
-			return nullptr;
-		}
+		fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
+		return nullptr;
+	}
 
-		FT_BitmapGlyph glyph;
-		error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-		if(error)
+	FT_GlyphSlot slot = font->face->glyph;
+	FT_Bitmap *bitmap = &slot->bitmap;
+	TrueTypeCacheEntry *res = new TrueTypeCacheEntry;
+	res->page = -1;
+	res->atlas_x = res->atlas_y = 0;
+	res->width = bitmap->width;
+	res->height = bitmap->rows;
+	res->left = slot->bitmap_left;
+	res->top = slot->bitmap_top;
+	res->advance = slot->advance.x >> 6;
+	res->bbox.xMin = res->left;
+	res->bbox.xMax = res->left + res->width;
+	res->bbox.yMin = res->top - res->height;
+	res->bbox.yMax = res->top;
+
+	if(bitmap->pixel_mode != FT_PIXEL_MODE_GRAY)
+	{
+		fprintf(stderr, "Unsupported pixel mode in FT_Bitmap %d\n", bitmap->pixel_mode);
+		res->width = res->height = 0;
+	}
+
+	if(res->width > 0 && res->height > 0)
+	{
+		res->page = gr_ttf_atlas_alloc(font, res->width, res->height, &res->atlas_x, &res->atlas_y);
+		if(res->page >= 0)
 		{
-			fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-			return nullptr;
+			GGLSurface *atlas = &font->atlas[res->page]->surface;
+			uint8_t *src_itr = bitmap->buffer;
+			uint8_t *dest_itr = atlas->data + res->atlas_y * atlas->stride + res->atlas_x;
+			for(int y = 0; y < res->height; ++y)
+			{
+				memcpy(dest_itr, src_itr, res->width);
+				src_itr += bitmap->pitch;
+				dest_itr += atlas->stride;
+			}
 		}
-
-		res = new TrueTypeCacheEntry;
-		res->glyph = glyph;
-		FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
-		font->glyph_cache[char_index] = res;
-	}
-	else {
-		res = glyphCacheItr->second;
 	}
 
+	font->glyph_cache[char_index] = res;
 	return res;
 }
 
-int twrpTruetype::gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base) {
-	unsigned y;
-	uint8_t *src_itr = glyph->bitmap.buffer;
-	uint8_t *dest_itr = dest->data;
-
-	if(glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY)
-	{
-		fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
-		return -1;
-	}
-
-	dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
+// Copies a glyph from the atlas into a string surface, clipped to its bounds
+void twrpTruetype::gr_ttf_copy_glyph_to_surface(GGLSurface *dest, TrueTypeFont *font, const TrueTypeCacheEntry *glyph, int offX, int offY) {
+	if(glyph->page < 0)
+		return;
 
-	// FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
-	// the result might end up being before the buffer - I'm not sure how to properly handle this.
-	if(dest_itr < dest->data)
-		dest_itr = dest->data;
+	const GGLSurface *atlas = &font->atlas[glyph->page]->surface;
+	int dx = offX + glyph->left, dy = offY + font->base - glyph->top;
+	int x0 = MAX(dx, 0), y0 = MAX(dy, 0);
+	int x1 = MIN(dx + glyph->width, (int)dest->width);
+	int y1 = MIN(dy + glyph->height, (int)dest->height);
 
-	for(y = 0; y < glyph->bitmap.rows; ++y)
+	for(int y = y0; y < y1; ++y)
 	{
-		memcpy(dest_itr, src_itr, glyph->bitmap.width);
-		src_itr += glyph->bitmap.pitch;
-		dest_itr += dest->stride;
+		const uint8_t *src_itr = atlas->data + (glyph->atlas_y + y - dy) * atlas->stride + glyph->atlas_x + x0 - dx;
+		uint8_t *dest_itr = dest->data + y * dest->stride + x0;
+		// glyphs may overlap after kerning, keep the stronger coverage
+		for(int x = x0; x < x1; ++x, ++src_itr, ++dest_itr)
+			*dest_itr = MAX(*dest_itr, *src_itr);
 	}
-	return 0;
 }
 
 void twrpTruetype::gr_ttf_calcMaxFontHeight(TrueTypeFont *f) {
@@ -331,23 +375,19 @@ void twrpTruetype::gr_ttf_calcMaxFontHeight(TrueTypeFont *f) {
 	f->base += f->size / 4;
 }
 
-// returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
-int twrpTruetype::gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const std::string text, int max_width) {
+// Lays out text into entry->glyphs, stopping before the glyph that would exceed max_width.
+// Returns number of bytes from const char *text laid out, not number of UTF8 characters!
+int twrpTruetype::gr_ttf_layout_text(TrueTypeFont *font, StringCacheEntry *entry, const std::string text, int max_width) {
 	TrueTypeFont *f = font;
 	TrueTypeCacheEntry *ent;
 	int bytes_rendered = 0, total_w = 0;
 	int utf_bytes = 0;
 	unsigned int unicode = 0;
-	int i, x, diff, char_idx, prev_idx = 0;
-	int height;
+	int diff, kerning, char_idx, prev_idx = 0;
 	FT_Vector delta;
-	uint8_t *data = NULL;
 	const char *text_itr = text.c_str();
-	int *char_idxs;
-	int char_idxs_len = 0;
-
-	char_idxs = new int[text.length()];
 
+	entry->glyphs.clear();
 	while(*text_itr)
 	{
 		utf_bytes = utf8_to_unicode(text_itr, &unicode);
@@ -355,78 +395,64 @@ int twrpTruetype::gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, co
 		bytes_rendered += utf_bytes;
 
 		char_idx = FT_Get_Char_Index(f->face, unicode);
-		char_idxs[char_idxs_len] = char_idx;
 		ent = gr_ttf_glyph_cache_get(f, char_idx);
 		if(ent)
 		{
-			diff = ent->glyph->root.advance.x >> 16;
-
+			kerning = 0;
 			if(FT_HAS_KERNING(f->face) && prev_idx && char_idx)
 			{
 				FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-				diff += delta.x >> 6;
+				kerning = delta.x >> 6;
 			}
+			diff = ent->advance + kerning;
 
 			if(max_width != -1 && total_w + diff > max_width)
 				break;
 
+			StringCacheGlyph g = { ent, total_w + kerning };
+			entry->glyphs.push_back(g);
 			total_w += diff;
 		}
 		prev_idx = char_idx;
-		++char_idxs_len;
 	}
 
 	if(font->max_height == -1)
 		gr_ttf_calcMaxFontHeight(font);
 
 	if(font->max_height == -1)
-	{
-		delete [] char_idxs;
 		return -1;
-	}
-
-	height = font->max_height;
 
-	data = (uint8_t *)malloc(total_w*height);
-    memset(data, 0, total_w*height);	x = 0;
-	prev_idx = 0;
+	entry->surface.version = sizeof(entry->surface);
+	entry->surface.width = total_w;
+	entry->surface.height = font->max_height;
+	entry->surface.stride = total_w;
+	entry->surface.data = NULL;
+	entry->surface.format = GGL_PIXEL_FORMAT_A_8;
+	return bytes_rendered;
+}
 
-	surface->version = sizeof(*surface);
-	surface->width = total_w;
-	surface->height = height;
-	surface->stride = total_w;
-	surface->data = (GGLubyte*)data;
-	surface->format = GGL_PIXEL_FORMAT_A_8;
+// Composes the A_8 string surface of a laid out entry from the glyph atlas
+int twrpTruetype::gr_ttf_render_text(TrueTypeFont *font, StringCacheEntry *entry) {
+	GGLSurface *surface = &entry->surface;
 
-	for(i = 0; i < char_idxs_len; ++i)
-	{
-		char_idx = char_idxs[i];
-		if(FT_HAS_KERNING(f->face) && prev_idx && char_idx)
-		{
-			FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-			x += delta.x >> 6;
-		}
+	if(surface->data)
+		return 0;
 
-		ent = gr_ttf_glyph_cache_get(f, char_idx);
-		if(ent)
-		{
-			gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-			x += ent->glyph->root.advance.x >> 16;
-		}
-
-		prev_idx = char_idx;
-	}
+	surface->data = (GGLubyte*)calloc(MAX(surface->width * surface->height, 1), 1);
+	if(!surface->data)
+		return -1;
 
-	delete [] char_idxs;
-	return bytes_rendered;
+	for(const StringCacheGlyph& g : entry->glyphs)
+		gr_ttf_copy_glyph_to_surface(surface, font, g.glyph, g.x, 0);
+	return 0;
 }
 
 StringCacheEntry* twrpTruetype::gr_ttf_string_cache_peek(TrueTypeFont *font, 
 	const std::string text, 
 	__attribute__((unused)) int max_width) {
 		StringCacheKey k = {
-			.text = text,
-			.max_width = max_width
+			.max_width = max_width,
+			.text = text
 		};
 		StringCacheMap::iterator stringCacheItr = font->string_cache.find(k);
 		if (stringCacheItr != font->string_cache.end()) {
@@ -437,49 +463,48 @@ StringCacheEntry* twrpTruetype::gr_ttf_string_cache_peek(TrueTypeFont *font,
 		}
 }
 
+// Drops least recently used strings until there is room for a new one
 void twrpTruetype::gr_ttf_string_cache_truncate(TrueTypeFont *font) {
-	StringCacheMap::iterator stringCacheItr;
-
-	if (font->string_cache.size() == STRING_CACHE_MAX_ENTRIES) {
-		StringCacheEntry *truncateEntry = nullptr;
-		stringCacheItr = font->string_cache.begin();
-		int deleteCtr = 0;
-		while (stringCacheItr != font->string_cache.end() || deleteCtr == (STRING_CACHE_MAX_ENTRIES - 1)) {
-			truncateEntry = stringCacheItr->second;
-			gr_ttf_freeStringCache(truncateEntry->key, truncateEntry, nullptr);
-			stringCacheItr = font->string_cache.erase(stringCacheItr);
-			deleteCtr++;
-		}
+	while (font->string_cache.size() >= STRING_CACHE_MAX_ENTRIES) {
+		StringCacheMap::iterator stringCacheItr = font->string_cache.find(font->string_lru.back());
+		gr_ttf_freeStringCache(stringCacheItr->second);
+		font->string_cache.erase(stringCacheItr);
+		font->string_lru.pop_back();
 	}
 }
 
+void twrpTruetype::gr_ttf_string_cache_touch(TrueTypeFont *font, StringCacheEntry *entry) {
+	if (entry->lru != font->string_lru.begin())
+		font->string_lru.splice(font->string_lru.begin(), font->string_lru, entry->lru);
+}
+
 StringCacheEntry* twrpTruetype::gr_ttf_string_cache_get(TrueTypeFont *font, const std::string text, int max_width) {
 	StringCacheEntry *res = nullptr;
 	StringCacheMap::iterator stringCacheItr;
 
 	StringCacheKey k = {
-		.text = text,
-		.max_width = max_width
+		.max_width = max_width,
+		.text = text
 	};
 
 	stringCacheItr = font->string_cache.find(k);
 	if (stringCacheItr == font->string_cache.end()) {
 		res = new StringCacheEntry;
-		res->rendered_bytes = gr_ttf_render_text(font, &res->surface, text, max_width);
+		res->rendered_bytes = gr_ttf_layout_text(font, res, text, max_width);
 		if(res->rendered_bytes < 0) {
 			delete res;
 			return nullptr;
 		}
 
-		StringCacheKey *new_key = new StringCacheKey;
-		new_key->max_width = max_width;
-		new_key->text = text;
-		res->key = new_key;
-		font->string_cache[*new_key] = res; 
+		gr_ttf_string_cache_truncate(font);
+		font->string_lru.push_front(k);
+		res->lru = font->string_lru.begin();
+		font->string_cache[k] = res;
 	}
 	else
 	{
 		res = stringCacheItr->second;
+		gr_ttf_string_cache_touch(font, res);
 	}
 	return res;
 }
@@ -489,7 +514,6 @@ int twrpTruetype::gr_ttf_measureEx(const char *s, void *font) {
 	int res = -1;
 
 	pthread_mutex_lock(&f->mutex);
-	gr_ttf_string_cache_truncate(f);
 	StringCacheEntry *e = gr_ttf_string_cache_get(f, s, -1);
 	if(e)
 		res = e->surface.width;
@@ -539,7 +563,7 @@ int twrpTruetype::gr_ttf_maxExW(const char *s, void *font, int max_width) {
 		if(!ent)
 			continue;
 
-		total_w += ent->glyph->root.advance.x >> 16;
+		total_w += ent->advance;
 		max_bytes += utf_bytes;
 	}
 	pthread_mutex_unlock(&f->mutex);
@@ -570,6 +594,47 @@ int twrpTruetype::gr_ttf_textExWH(void *context, int x, int y,
 		return -1;
 	}
 
+	int y_bottom = y + e->surface.height;
+	int res = e->rendered_bytes;
+
+	if(max_height != -1 && max_height < y_bottom)
+	{
+		y_bottom = max_height;
+		if(y_bottom <= y)
+		{
+			pthread_mutex_unlock(&font->mutex);
+			return 0;
+		}
+	}
+
+	// Draw the string as a series of glyph blits from the atlas when the
+	// draw surface allows it, otherwise through its composed string surface
+	bool fallback = false;
+	for (const StringCacheGlyph& g : e->glyphs) {
+		if (g.glyph->page < 0)
+			continue;
+		int gx = x + g.x + g.glyph->left, gy = y + font->base - g.glyph->top;
+		int l = MAX(gx, x), t = MAX(gy, y);
+		int r = MIN(gx + g.glyph->width, x + (int)e->surface.width);
+		int b = MIN(gy + g.glyph->height, y_bottom);
+		if (l >= r || t >= b)
+			continue;
+		if (gr_blit_a8((gr_surface)&font->atlas[g.glyph->page]->surface,
+				g.glyph->atlas_x + l - gx, g.glyph->atlas_y + t - gy, r - l, b - t, l, t) < 0) {
+			fallback = true;
+			break;
+		}
+	}
+	if (!fallback) {
+		pthread_mutex_unlock(&font->mutex);
+		return res;
+	}
+
+	if (gr_ttf_render_text(font, e) < 0) {
+		pthread_mutex_unlock(&font->mutex);
+		return -1;
+	}
+
 	GGLSurface string_surface_rotated;
 	if (gr_rotation != 0) {
 		// Do not perform relatively expensive operation if not needed
@@ -585,19 +650,6 @@ int twrpTruetype::gr_ttf_textExWH(void *context, int x, int y,
 		surface_ROTATION_transform((gr_surface) &string_surface_rotated, (const gr_surface) &e->surface, 1);
 	}
 
-	int y_bottom = y + e->surface.height;
-	int res = e->rendered_bytes;
-
-	if(max_height != -1 && max_height < y_bottom)
-	{
-		y_bottom = max_height;
-		if(y_bottom <= y)
-		{
-			pthread_mutex_unlock(&font->mutex);
-			return 0;
-		}
-	}
-
 	// Figuring out display coordinates works for gr_rotation == 0 too,
 	// and isn't as expensive as allocating and rotating another surface,
 	// so we do this anyway.
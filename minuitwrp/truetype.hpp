@@ -17,8 +17,11 @@
 #ifndef _TWRP_TRUETYPE_HPP
 #define _TWRP_TRUETYPE_HPP
 
+#include <list>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <ft2build.h>
 #include <pthread.h>
 #include FT_FREETYPE_H
@@ -36,9 +39,24 @@ inline bool operator<(const TrueTypeFontKey &ttfkLeft, const TrueTypeFontKey &tt
     return std::tie(ttfkLeft.size, ttfkLeft.dpi, ttfkLeft.path) < std::tie(ttfkRight.size, ttfkRight.dpi, ttfkRight.path);
 }
 
+// One A_8 page of a font's glyph atlas, filled shelf by shelf
+typedef struct {
+    GGLSurface surface;
+    int shelf_x;
+    int shelf_y;
+    int shelf_height;
+} GlyphAtlasPage;
+
 typedef struct {
     FT_BBox bbox;
-    FT_BitmapGlyph glyph;
+    int page; // atlas page holding the bitmap, -1 for glyphs without one (e.g. space)
+    int atlas_x;
+    int atlas_y;
+    int width;
+    int height;
+    int left;
+    int top;
+    int advance;
 } TrueTypeCacheEntry;
 
 typedef struct StringCacheKey {
@@ -46,16 +64,44 @@ typedef struct StringCacheKey {
     std::string text;
 } StringCacheKey;
 
-inline bool operator<(const StringCacheKey &sckLeft, const StringCacheKey &sckRight)  {
-    return std::tie(sckLeft.text, sckLeft.max_width) < std::tie(sckRight.text, sckRight.max_width);
+inline bool operator==(const StringCacheKey &sckLeft, const StringCacheKey &sckRight)  {
+    return sckLeft.max_width == sckRight.max_width && sckLeft.text == sckRight.text;
 }
 
+// 32bit FNV-1a hash algorithm
+// http://isthe.com/chongo/tech/comp/fnv/#FNV-1a
+static const uint32_t FNV_prime = 16777619U;
+static const uint32_t offset_basis = 2166136261U;
+
+struct StringCacheKeyHash {
+    size_t operator()(const StringCacheKey &k) const {
+        uint32_t hash = offset_basis ^ (uint32_t)k.max_width;
+        for (unsigned char c : k.text) {
+            hash ^= c;
+            hash *= FNV_prime;
+        }
+        return hash;
+    }
+};
+
+// A glyph of a laid out string, x is relative to the start of the string
+typedef struct {
+    TrueTypeCacheEntry *glyph;
+    int x;
+} StringCacheGlyph;
+
 typedef struct StringCacheEntry {
+    std::vector<StringCacheGlyph> glyphs;
+    // A_8 rendering of the whole string, only composed from the atlas
+    // (data != NULL) when pixelflinger has to draw it
     GGLSurface surface;
     int rendered_bytes; // number of bytes from C string rendered, not number of UTF8 characters!
-    StringCacheKey *key;
+    std::list<StringCacheKey>::iterator lru;
 } StringCacheEntry;
 
+typedef std::unordered_map<StringCacheKey, StringCacheEntry*, StringCacheKeyHash> StringCacheMap;
+typedef std::unordered_map<int, TrueTypeCacheEntry*> TrueTypeCacheEntryMap;
+
 typedef struct {
     int type;
     int refcount;
@@ -64,8 +110,10 @@ typedef struct {
     int max_height;
     int base;
     FT_Face face;
-    std::map<int, TrueTypeCacheEntry*> glyph_cache;
-    std::map<StringCacheKey, StringCacheEntry*> string_cache;
+    TrueTypeCacheEntryMap glyph_cache;
+    std::vector<GlyphAtlasPage*> atlas;
+    StringCacheMap string_cache;
+    std::list<StringCacheKey> string_lru; // most recently used first
     pthread_mutex_t mutex;
     TrueTypeFontKey *key;
 } TrueTypeFont;
@@ -76,20 +124,13 @@ typedef struct {
     pthread_mutex_t mutex;
 } FontData;
 
-typedef std::map<StringCacheKey, StringCacheEntry*> StringCacheMap;
-typedef std::map<int, TrueTypeCacheEntry*> TrueTypeCacheEntryMap;
 typedef std::map<TrueTypeFontKey, TrueTypeFont*> TrueTypeFontMap;
 
 #define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
 #define MAX(X,Y) ((X) > (Y) ? (X) : (Y))
 
-// 32bit FNV-1a hash algorithm
-// http://isthe.com/chongo/tech/comp/fnv/#FNV-1a
-static const uint32_t FNV_prime = 16777619U;
-static const uint32_t offset_basis = 2166136261U;
-
 #define STRING_CACHE_MAX_ENTRIES 400
-#define STRING_CACHE_TRUNCATE_ENTRIES 150
+#define GLYPH_ATLAS_PAGE_SIZE 512
 
 class twrpTruetype {
 public:
@@ -97,13 +138,15 @@ public:
     static int utf8_to_unicode(const char* pIn, unsigned int *pOut);
     static void* gr_ttf_loadFont(const char *filename, int size, int dpi);
     static void* gr_ttf_scaleFont(void *font, int max_width, int measured_width);
-    static void gr_ttf_freeStringCache(void *key, void *value, void *context __unused);
+    static void gr_ttf_freeStringCache(void *value);
     static void gr_ttf_freeFont(void *font);
     static TrueTypeCacheEntry* gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_index);
     static TrueTypeCacheEntry* gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index);
-    static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base);
+    static int gr_ttf_atlas_alloc(TrueTypeFont *font, int width, int height, int *x, int *y);
+    static void gr_ttf_copy_glyph_to_surface(GGLSurface *dest, TrueTypeFont *font, const TrueTypeCacheEntry *glyph, int offX, int offY);
     static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f);
-    static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const std::string text, int max_width);
+    static int gr_ttf_layout_text(TrueTypeFont *font, StringCacheEntry *entry, const std::string text, int max_width);
+    static int gr_ttf_render_text(TrueTypeFont *font, StringCacheEntry *entry);
     static StringCacheEntry* gr_ttf_string_cache_peek(TrueTypeFont *font, const std::string text, __attribute__((unused)) int max_width);
     static StringCacheEntry* gr_ttf_string_cache_get(TrueTypeFont *font, const std::string text, int max_width);
     static int gr_ttf_measureEx(const char *s, void *font);
@@ -114,5 +157,6 @@ public:
                     const gr_surface gr_draw_surface);
     static int gr_ttf_getMaxFontHeight(void *font);
     static void gr_ttf_string_cache_truncate(TrueTypeFont *font);
+    static void gr_ttf_string_cache_touch(TrueTypeFont *font, StringCacheEntry *entry);
 };
 #endif // _TWRP_TRUETYPE_HPP
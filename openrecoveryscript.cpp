@@ -152,6 +152,10 @@ int OpenRecoveryScript::run_script_file(void) {
 			if (strcmp(command, "install") == 0) {
 				// Install Zip
 				DataManager::SetValue("tw_action_text2", "Installing Zip");
+				// a zip that is installed right after this one can be checked while this one installs
+				string next_zip = Peek_Next_Install(fp);
+				if (!next_zip.empty() && next_zip[0] != '@' && TWFunc::Path_Exists(next_zip))
+					TWinstall_Queue_Next(next_zip, DataManager::GetIntValue(TW_FORCE_DIGEST_CHECK_VAR) != 0);
 				ret_val = Install_Command(value);
 				tmp_tmp = ret_val;
 				install_cmd = -1;
@@ -475,6 +479,7 @@ int OpenRecoveryScript::run_script_file(void) {
 			}
 		}
 		fclose(fp);
+		TWinstall_Clear_Queue();
 		unlink(SCRIPT_FILE_TMP);
 		gui_msg("done_ors=Done processing script file");
 		tmp_tmp = ret_val;
@@ -573,7 +578,7 @@ int OpenRecoveryScript::Install_Command(string Zip) {
 			gui_msg(Msg("installing_zip=Installing zip file '{1}'")(Zip));
 	}
 
-	ret_val = TWinstall_zip(Zip.c_str(), &wipe_cache);
+	ret_val = TWinstall_zip(Zip.c_str(), &wipe_cache, DataManager::GetIntValue(TW_FORCE_DIGEST_CHECK_VAR) != 0);
 	if (ret_val != 0) {
 		LOGINFO ("OpenRecoveryScript::Install_Command() error.\n");
 		gui_msg(Msg(msg::kError, "zip_err=Error installing zip file '{1}'")(Zip));
@@ -586,6 +591,30 @@ int OpenRecoveryScript::Install_Command(string Zip) {
 	return ret_val;
 }
 
+string OpenRecoveryScript::Peek_Next_Install(FILE* fp) {
+	char script_line[SCRIPT_COMMAND_SIZE];
+	string Zip;
+	long pos = ftell(fp);
+
+	if (pos < 0)
+		return Zip;
+	while (fgets(script_line, SCRIPT_COMMAND_SIZE, fp) != NULL) {
+		string line = script_line;
+		while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+			line.erase(line.size() - 1);
+		if (line.size() < 2)
+			continue;
+		if (line.compare(0, 8, "install ") == 0) {
+			size_t start = line.find_first_not_of(" =", 8);
+			if (start != string::npos)
+				Zip = line.substr(start);
+		}
+		break;
+	}
+	fseek(fp, pos, SEEK_SET);
+	return Zip;
+}
+
 string OpenRecoveryScript::Locate_Zip_File(string Zip, string Storage_Root) {
 	string Path = TWFunc::Get_Path(Zip);
 	string File = TWFunc::Get_Filename(Zip);
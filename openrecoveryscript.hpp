@@ -22,6 +22,7 @@
 #ifndef _OPENRECOVERYSCRIPT_HPP
 #define _OPENRECOVERYSCRIPT_HPP
 
+#include <stdio.h>
 #include <string>
 
 using namespace std;
@@ -36,6 +37,7 @@ class OpenRecoveryScript
 	static int run_script_file();                                                  // Executes the commands in the ORS file
 	static int Install_Command(string Zip);                                        // Installs a zip
 	static string Locate_Zip_File(string Path, string File);                       // Attempts to locate the zip file in storage
+	static string Peek_Next_Install(FILE* fp);                                     // Returns the zip of the next command if it is an install, without consuming it
 	static int Backup_Command(string Options);                                     // Runs a backup
 public:
 	static int Insert_ORS_Command(string Command);                                 // Inserts the Command into the SCRIPT_FILE_TMP file
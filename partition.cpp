@@ -46,6 +46,9 @@
 #include "twrp-functions.hpp"
 #include "twrpTar.hpp"
 #include "exclude.hpp"
+#include "twrpRemover.hpp"
+#include "twrpFormatter.hpp"
+#include "twrpExec.hpp"
 #include "infomanager.hpp"
 #include "set_metadata.h"
 #include "gui/gui.hpp"
@@ -1907,9 +1910,18 @@ bool TWPartition::Repair() {
 			return false;
 		gui_msg(Msg("repairing_using=Repairing {1} using {2}...")(Display_Name)("e2fsck"));
 		Find_Actual_Block_Device();
-		command = "/system/bin/e2fsck -fp " + Actual_Block_Device;
-		LOGINFO("Repair command: %s\n", command.c_str());
-		if (TWFunc::Exec_Cmd(command) == 0) {
+		// -C 1 writes "pass current max device" lines to stdout, pass 1 usually takes the longest
+		twrpExec e2fsck({"/system/bin/e2fsck", "-fp", "-C", "1", Actual_Block_Device});
+		e2fsck.Set_Progress_Parser([](const std::string& line) -> float {
+			int pass;
+			unsigned long current, max;
+			if (sscanf(line.c_str(), "%d %lu %lu", &pass, &current, &max) != 3 || pass < 1 || pass > 5 || max == 0)
+				return -1;
+			return ((pass - 1) + (float)current / max) / 5;
+		});
+		LOGINFO("Repair command: %s\n", e2fsck.Get_Command().c_str());
+		DataManager::SetProgress(0);
+		if (e2fsck.Run() == 0) {
 			gui_msg("done=Done.");
 			return true;
 		} else {
@@ -1991,8 +2003,6 @@ bool TWPartition::Can_Resize() {
 }
 
 bool TWPartition::Resize() {
-	string command;
-
 	if (Current_File_System == "ext2" || Current_File_System == "ext3" || Current_File_System == "ext4") {
 		if (!Can_Repair()) {
 			LOGINFO("Cannot resize %s because %s cannot be repaired before resizing.\n", Display_Name.c_str(), Display_Name.c_str());
@@ -2010,7 +2020,7 @@ bool TWPartition::Resize() {
 			return false;
 		gui_msg(Msg("resizing=Resizing {1} using {2}...")(Display_Name)("resize2fs"));
 		Find_Actual_Block_Device();
-		command = "/system/bin/resize2fs " + Actual_Block_Device;
+		std::vector<std::string> args = { "/system/bin/resize2fs", Actual_Block_Device };
 		if (Length != 0) {
 			unsigned long long Actual_Size = IOCTL_Get_Block_Size();
 			if (Actual_Size == 0)
@@ -2024,14 +2034,11 @@ bool TWPartition::Resize() {
 				// This is the size, not a size reduction
 				Block_Count = ((unsigned long long)(Length) / 1024LLU);
 			}
-			char temp[256];
-			sprintf(temp, "%llu", Block_Count);
-			command += " ";
-			command += temp;
-			command += "K";
+			args.push_back(std::to_string(Block_Count) + "K");
 		}
-		LOGINFO("Resize command: %s\n", command.c_str());
-		if (TWFunc::Exec_Cmd(command) == 0) {
+		twrpExec resize2fs(args);
+		LOGINFO("Resize command: %s\n", resize2fs.Get_Command().c_str());
+		if (resize2fs.Run() == 0) {
 			Update_Size(true);
 			gui_msg("done=Done.");
 			return true;
@@ -2222,7 +2229,6 @@ bool TWPartition::Wipe_EXTFS(string File_System) {
 #endif
 		return Wipe_RMRF();
 
-	int ret;
 	bool NeedPreserveFooter = true;
 
 	Find_Actual_Block_Device();
@@ -2255,15 +2261,24 @@ bool TWPartition::Wipe_EXTFS(string File_System) {
 
 	//string size_str =to_string(dev_sz / 4096);
 	string size_str = dout;
-	string Command;
 
 	gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)("mke2fs"));
 
+	// Discard the device in parallel first, mke2fs can then skip its own discard pass
+	ProgressTracking progress(dev_sz);
+	progress.SetPartitionSize(dev_sz);
+	twrpFormatter formatter(Actual_Block_Device, dev_sz);
+	formatter.Discard(&progress);
+
 	// Execute mke2fs to create empty ext4 filesystem
-	Command = "mke2fs -t " + File_System + " -b 4096 " + Actual_Block_Device + " " + size_str;
-	LOGINFO("mke2fs command: %s\n", Command.c_str());
-	ret = TWFunc::Exec_Cmd(Command);
-	if (ret) {
+	std::vector<std::string> args = { "mke2fs", "-t", File_System, "-b", "4096" };
+	std::vector<std::string> options = TWFunc::Split_String(formatter.Ext4_Options(), " ");
+	args.insert(args.end(), options.begin(), options.end());
+	args.push_back(Actual_Block_Device);
+	args.push_back(size_str);
+	twrpExec mke2fs(args);
+	LOGINFO("mke2fs command: %s\n", mke2fs.Get_Command().c_str());
+	if (mke2fs.Run() != 0) {
 		gui_msg(Msg(msg::kError, "unable_to_wipe=Unable to wipe {1}.")(Display_Name));
 		return false;
 	}
@@ -2280,10 +2295,9 @@ bool TWPartition::Wipe_EXTFS(string File_System) {
 				TWFunc::removeDir("/persist/lost+found", false);
 				UnMount(true);
 			}
-			Command = "e2fsdroid -e -S /file_contexts -a " + File_Contexts_Entry + " " + Actual_Block_Device;
-			LOGINFO("e2fsdroid command: %s\n", Command.c_str());
-			ret = TWFunc::Exec_Cmd(Command);
-			if (ret) {
+			twrpExec e2fsdroid({"e2fsdroid", "-e", "-S", "/file_contexts", "-a", File_Contexts_Entry, Actual_Block_Device});
+			LOGINFO("e2fsdroid command: %s\n", e2fsdroid.Get_Command().c_str());
+			if (e2fsdroid.Run() != 0) {
 				gui_msg(Msg(msg::kError, "unable_to_wipe=Unable to wipe {1}.")(Display_Name));
 				return false;
 			}
@@ -2450,7 +2464,9 @@ bool TWPartition::Wipe_RMRF() {
 		PartitionManager.Remove_MTP_Storage(MTP_Storage_ID);
 
 	gui_msg(Msg("remove_all=Removing all files under '{1}'")(Mount_Point));
-	TWFunc::removeDir(Mount_Point, true);
+	twrpRemover remover;
+	remover.Show_Progress(true);
+	remover.Remove(Mount_Point, true);
 	Recreate_AndSec_Folder();
 	return true;
 }
@@ -2487,9 +2503,15 @@ bool TWPartition::Wipe_F2FS() {
 	if (NeedPreserveFooter)
 		Length < 0 ? dev_sz += Length : dev_sz -= CRYPT_FOOTER_OFFSET;
 
+	// Discard the device in parallel first, mkfs.f2fs can then skip its own discard pass
+	ProgressTracking progress(dev_sz);
+	progress.SetPartitionSize(dev_sz);
+	twrpFormatter formatter(Actual_Block_Device, dev_sz);
+	formatter.Discard(&progress);
+
 	char dev_sz_str[48];
 	sprintf(dev_sz_str, "%llu", (dev_sz / 4096));
-	command = f2fs_bin + " -d1 -f -O encrypt -O quota -O verity -w 4096 " + Actual_Block_Device + " " + dev_sz_str;
+	command = f2fs_bin + " -d1 -f" + formatter.F2fs_Options() + " -O encrypt -O quota -O verity -w 4096 " + Actual_Block_Device + " " + dev_sz_str;
 	if (TWFunc::Path_Exists("/system/bin/sload.f2fs")) {
 		command += " && sload.f2fs -t /data " + Actual_Block_Device;
 	}
@@ -2603,39 +2625,11 @@ bool TWPartition::Recreate_Logs_Dir() {
 }
 
 bool TWPartition::Wipe_Data_Without_Wiping_Media_Func(const string& parent __unused) {
-	string dir;
-
-	DIR* d;
-	d = opendir(parent.c_str());
-	if (d != NULL) {
-		struct dirent* de;
-		while ((de = readdir(d)) != NULL) {
-			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)	 continue;
-
-			dir = parent;
-			dir.append(de->d_name);
-			if (wipe_exclusions.check_skip_dirs(dir)) {
-				LOGINFO("skipped '%s'\n", dir.c_str());
-				continue;
-			}
-			if (de->d_type == DT_DIR) {
-				dir.append("/");
-				if (!Wipe_Data_Without_Wiping_Media_Func(dir)) {
-					closedir(d);
-					return false;
-				}
-				rmdir(dir.c_str());
-			} else if (de->d_type == DT_REG || de->d_type == DT_LNK || de->d_type == DT_FIFO || de->d_type == DT_SOCK) {
-				if (unlink(dir.c_str()) != 0)
-					LOGINFO("Unable to unlink '%s': %s\n", dir.c_str(), strerror(errno));
-			}
-		}
-		closedir(d);
-
-		return true;
-	}
-	gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(Mount_Point)(strerror(errno)));
-	return false;
+	twrpRemover remover;
+	remover.Show_Progress(true);
+	// entries that cannot be removed are logged and the wipe goes on, it only fails if parent cannot be opened
+	remover.Remove(parent, true, &wipe_exclusions);
+	return remover.Root_Opened();
 }
 
 void TWPartition::Wipe_Crypto_Key() {
@@ -3334,13 +3328,11 @@ bool TWPartition::Is_Sparse_Image(const string& Filename) {
 }
 
 bool TWPartition::Flash_Sparse_Image(const string& Filename) {
-	string Command;
-
 	gui_msg(Msg("flashing=Flashing {1}...")(Display_Name));
 
-	Command = "simg2img '" + Filename + "' '" + Actual_Block_Device + "'";
-	LOGINFO("Flash command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command);
+	twrpExec simg2img({"simg2img", Filename, Actual_Block_Device});
+	LOGINFO("Flash command: '%s'\n", simg2img.Get_Command().c_str());
+	simg2img.Run();
 	return true;
 }
 
@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 #include <sys/vfs.h>
 #include <unistd.h>
+#include <algorithm>
 #include <map>
 #include <vector>
 #include <dirent.h>
@@ -42,6 +43,7 @@
 
 
 #include <sys/poll.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <linux/types.h>
 #include <linux/netlink.h>
@@ -69,6 +71,10 @@
 #include "tw_atomic.hpp"
 #include "gui/gui.hpp"
 #include "progresstracking.hpp"
+#include "twrpProfiler.hpp"
+#include "twrpRemover.hpp"
+#include "twrpExec.hpp"
+#include "twrpBackupCatalog.hpp"
 #include "twrpDigestDriver.hpp"
 #include "twrpRepacker.hpp"
 #include "adbbu/libtwadbbu.hpp"
@@ -928,6 +934,7 @@ int TWPartitionManager::Cancel_Backup() {
 	string Backup_Folder, Backup_Name, Full_Backup_Path;
 
 	stop_backup.set_value(1);
+	twrpExec::Cancel_All();
 
 	if (tar_fork_pid != 0) {
 		DataManager::GetValue(TW_BACKUP_NAME, Backup_Name);
@@ -1168,6 +1175,8 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 	string backup_log = part_settings.Backup_Folder + "/recovery.log";
 	TWFunc::copy_file("/tmp/recovery.log", backup_log, 0644);
 	tw_set_default_metadata(backup_log.c_str());
+	if (!adbbackup)
+		twrpBackupCatalog::Update_Entry(part_settings.Backup_Folder);
 
 	if (part_settings.adbbackup) {
 		if (twadbbu::Write_ADB_Stream_Trailer() == false) {
@@ -1339,7 +1348,6 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 	// Start with the default values
 	string Restore_List;
-	bool get_date = true, check_encryption = true;
 	bool adbbackup = false;
 
 	DataManager::SetValue("tw_restore_encrypted", 0);
@@ -1358,74 +1366,22 @@ void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 		DataManager::SetValue("tw_enable_adb_backup", 1);
 	}
 	else {
-		DIR* d;
-		d = opendir(Restore_Name.c_str());
-		if (d == NULL)
-		{
+		// the catalog knows the files of a backup it has seen before, only new or changed ones are read
+		Backup_Catalog_Entry entry;
+		if (!twrpBackupCatalog::Get_Entry(Restore_Name, entry)) {
 			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(Restore_Name)(strerror(errno)));
 			return;
 		}
+		if (entry.date != 0) {
+			string backup_date = ctime(&entry.date);
+			DataManager::SetValue(TW_RESTORE_FILE_DATE, backup_date);
+		}
+		if (entry.encrypted)
+			DataManager::SetValue("tw_restore_encrypted", 1);
 
-		struct dirent* de;
-		while ((de = readdir(d)) != NULL)
-		{
-			// Strip off three components
-			char str[256];
-			char* label;
-			char* fstype = NULL;
-			char* extn = NULL;
-			char* ptr;
-
-			strcpy(str, de->d_name);
-			if (strlen(str) <= 2)
-				continue;
-
-			if (get_date) {
-				char file_path[255];
-				struct stat st;
-
-				strcpy(file_path, Restore_Name.c_str());
-				strcat(file_path, "/");
-				strcat(file_path, str);
-				stat(file_path, &st);
-				string backup_date = ctime((const time_t*)(&st.st_mtime));
-				DataManager::SetValue(TW_RESTORE_FILE_DATE, backup_date);
-				get_date = false;
-			}
-
-			label = str;
-			ptr = label;
-			while (*ptr && *ptr != '.')	 ptr++;
-			if (*ptr == '.')
-			{
-				*ptr = 0x00;
-				ptr++;
-				fstype = ptr;
-			}
-			while (*ptr && *ptr != '.')	 ptr++;
-			if (*ptr == '.')
-			{
-				*ptr = 0x00;
-				ptr++;
-				extn = ptr;
-			}
-
-			if (fstype == NULL || extn == NULL || strcmp(fstype, "log") == 0) continue;
-			int extnlength = strlen(extn);
-			if (extnlength != 3 && extnlength != 6) continue;
-			if (extnlength >= 3 && strncmp(extn, "win", 3) != 0) continue;
-			//if (extnlength == 6 && strncmp(extn, "win000", 6) != 0) continue;
-
-			if (check_encryption) {
-				string filename = Restore_Name + "/";
-				filename += de->d_name;
-				if (TWFunc::Get_File_Type(filename) == 2) {
-					LOGINFO("'%s' is encrypted\n", filename.c_str());
-					DataManager::SetValue("tw_restore_encrypted", 1);
-				}
-			}
-			if (extnlength == 6 && strncmp(extn, "win000", 6) != 0) continue;
-
+		for (size_t i = 0; i < entry.files.size(); i++) {
+			const string& filename = entry.files[i].filename;
+			string label = filename.substr(0, filename.find('.'));
 			TWPartition* Part = Find_Partition_By_Path(label);
 			if (Part == NULL)
 			{
@@ -1433,10 +1389,7 @@ void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 				continue;
 			}
 
-			Part->Backup_FileName = de->d_name;
-			if (strlen(extn) > 3) {
-				Part->Backup_FileName.resize(Part->Backup_FileName.size() - strlen(extn) + 3);
-			}
+			Part->Backup_FileName = filename;
 
 			if (!Part->Is_SubPartition) {
 				if (Part->Backup_Path == Get_Android_Root_Path())
@@ -1445,7 +1398,6 @@ void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 					Restore_List += Part->Backup_Path + ";";
 			}
 		}
-		closedir(d);
 	}
 
 	if (adbbackup) {
@@ -1580,7 +1532,9 @@ int TWPartitionManager::Wipe_Dalvik_Cache(void) {
 	}
 	for (unsigned i = 0; i < dir.size(); ++i) {
 		if (stat(dir.at(i).c_str(), &st) == 0) {
-			TWFunc::removeDir(dir.at(i), false);
+			twrpRemover remover;
+			remover.Show_Progress(true);
+			remover.Remove(dir.at(i), false);
 			gui_msg(Msg("cleaned=Cleaned: {1}...")(dir.at(i)));
 		}
 	}
@@ -1731,6 +1685,74 @@ int TWPartitionManager::Resize_By_Path(string Path, bool Display_Error) {
 	return false;
 }
 
+#define UPDATE_SIZE_MAX_THREADS 8
+
+// Partitions whose mount points nest or that share a block device have to be
+// mounted and unmounted in order, so they are refreshed by the same thread
+static bool Paths_Overlap(const string& a, const string& b) {
+	if (a.empty() || b.empty())
+		return false;
+	if (a.size() == b.size())
+		return a == b;
+	const string& shorter = a.size() < b.size() ? a : b;
+	const string& longer = a.size() < b.size() ? b : a;
+	return longer.compare(0, shorter.size(), shorter) == 0 && (shorter == "/" || longer[shorter.size()] == '/');
+}
+
+void TWPartitionManager::Update_Partition_Sizes(bool Display_Error) {
+	size_t count = Partitions.size();
+	std::vector<size_t> group_of(count);
+	for (size_t i = 0; i < count; i++)
+		group_of[i] = i;
+
+	// Merge related partitions into the group of the first one, keeping the fstab order within a group
+	for (size_t i = 0; i < count; i++) {
+		TWPartition* a = Partitions[i];
+		for (size_t j = i + 1; j < count; j++) {
+			TWPartition* b = Partitions[j];
+			bool related = (!a->Primary_Block_Device.empty() && a->Primary_Block_Device == b->Primary_Block_Device) ||
+				(a->Is_SubPartition && a->SubPartition_Of == b->Mount_Point) ||
+				(b->Is_SubPartition && b->SubPartition_Of == a->Mount_Point) ||
+				Paths_Overlap(a->Mount_Point, b->Mount_Point) ||
+				Paths_Overlap(a->Mount_Point, b->Symlink_Mount_Point) ||
+				Paths_Overlap(a->Symlink_Mount_Point, b->Mount_Point) ||
+				Paths_Overlap(a->Symlink_Mount_Point, b->Symlink_Mount_Point);
+			if (!related || group_of[i] == group_of[j])
+				continue;
+			size_t from = group_of[j], to = group_of[i];
+			if (from < to)
+				std::swap(from, to);
+			for (size_t k = 0; k < count; k++) {
+				if (group_of[k] == from)
+					group_of[k] = to;
+			}
+		}
+	}
+
+	std::vector<std::vector<TWPartition*> > groups;
+	std::map<size_t, size_t> group_index;
+	for (size_t i = 0; i < count; i++) {
+		std::map<size_t, size_t>::iterator it = group_index.find(group_of[i]);
+		if (it == group_index.end()) {
+			it = group_index.insert(std::make_pair(group_of[i], groups.size())).first;
+			groups.push_back(std::vector<TWPartition*>());
+		}
+		groups[it->second].push_back(Partitions[i]);
+	}
+
+	TWWorkQueue queue(std::min(groups.size(), (size_t)UPDATE_SIZE_MAX_THREADS));
+	for (size_t i = 0; i < groups.size(); i++) {
+		std::vector<TWPartition*>* group = &groups[i];
+		queue.Add([group, Display_Error]() {
+			for (size_t j = 0; j < group->size(); j++) {
+				twrpProfilerScope scope("update_size " + group->at(j)->Get_Mount_Point());
+				group->at(j)->Update_Size(Display_Error);
+			}
+		});
+	}
+	queue.Run();
+}
+
 void TWPartitionManager::Update_System_Details(void) {
 	std::vector<TWPartition*>::iterator iter;
 	int data_size = 0;
@@ -1742,8 +1764,9 @@ void TWPartitionManager::Update_System_Details(void) {
 
   	if (DataManager::GetIntValue(FOX_RUN_SURVIVAL_BACKUP) != 1)
 		gui_msg("update_part_details=Updating partition details...");
+	twrpProfilerScope scope("update_system_details");
+	Update_Partition_Sizes(reporter);
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
-		(*iter)->Update_Size(reporter);
 		if ((*iter)->Can_Be_Mounted) {
 			if ((*iter)->Mount_Point == Get_Android_Root_Path()) {
 				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
@@ -3548,56 +3571,146 @@ void TWPartitionManager::Add_Partition(TWPartition* Part) {
 	Partitions.push_back(Part);
 }
 
-void TWPartitionManager::Coldboot_Scan(std::vector<string> *sysfs_entries, const string& Path, int depth) {
-	string Real_Path = Path;
-	char real_path[PATH_MAX];
-	if (realpath(Path.c_str(), &real_path[0])) {
-		string Real_Path = real_path;
-		std::vector<string>::iterator iter;
-		for (iter = sysfs_entries->begin(); iter != sysfs_entries->end(); iter++) {
-			if (Real_Path.find((*iter)) != string::npos) {
-				string Write_Path = Real_Path + "/uevent";
-				if (TWFunc::Path_Exists(Write_Path)) {
-					const char* write_val = "add\n";
-					TWFunc::write_to_file(Write_Path, write_val);
-					break;
-				}
+#define COLDBOOT_MAX_THREADS 8
+
+// Finds the Sysfs_Entry values contained in a sysfs path. Entries that start
+// with a full path component are indexed by that component and only compared
+// where the path has the same component; anything else is searched for as is.
+class Sysfs_Matcher {
+public:
+	void Add(const string& entry) {
+		size_t end = entry.find('/', 1);
+		if (entry.size() > 1 && entry[0] == '/' && end != string::npos)
+			index[entry.substr(1, end - 1)].push_back(entry);
+		else
+			other.push_back(entry);
+	}
+
+	bool Empty() const {
+		return index.empty() && other.empty();
+	}
+
+	bool Match(const string& path) const {
+		for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1)) {
+			size_t end = path.find('/', slash + 1);
+			if (end == string::npos)
+				break; // an indexed entry has at least two components
+			std::map<string, std::vector<string> >::const_iterator it = index.find(path.substr(slash + 1, end - slash - 1));
+			if (it == index.end())
+				continue;
+			for (size_t i = 0; i < it->second.size(); i++) {
+				if (path.compare(slash, it->second[i].size(), it->second[i]) == 0)
+					return true;
 			}
 		}
+		for (size_t i = 0; i < other.size(); i++) {
+			if (path.find(other[i]) != string::npos)
+				return true;
+		}
+		return false;
 	}
 
-	DIR* d = opendir(Path.c_str());
-	if (d != NULL) {
-		struct dirent* de;
-		while ((de = readdir(d)) != NULL) {
-			if (de->d_name[0] == '.' || (de->d_type != DT_DIR && depth > 0))
-				continue;
-			if (strlen(de->d_name) >= 4 && (strncmp(de->d_name, "ram", 3) == 0 || strncmp(de->d_name, "loop", 4) == 0))
-				continue;
+private:
+	std::map<string, std::vector<string> > index;
+	std::vector<string> other;
+};
 
-			string item = Path + "/";
-			item.append(de->d_name);
-			Coldboot_Scan(sysfs_entries, item, depth + 1);
-		}
-		closedir(d);
+// Real_Path is the resolved Path. Below the /sys/block links every directory is
+// a real one, so its real path is its parent's plus its name and realpath() is
+// only needed once per block device. Matched is inherited, since a path that
+// contains an entry still contains it with more components added.
+static void Coldboot_Scan(const Sysfs_Matcher& matcher, const string& Path, const string& Real_Path, bool Matched, int depth,
+		std::vector<string>* uevents, unsigned long long* nodes) {
+	(*nodes)++;
+	if (!Matched)
+		Matched = matcher.Match(Real_Path);
+	if (Matched)
+		uevents->push_back(Real_Path);
+
+	DIR* d = opendir(Path.c_str());
+	if (d == NULL)
+		return;
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.' || de->d_type != DT_DIR)
+			continue;
+		if (strlen(de->d_name) >= 4 && (strncmp(de->d_name, "ram", 3) == 0 || strncmp(de->d_name, "loop", 4) == 0))
+			continue;
+		Coldboot_Scan(matcher, Path + "/" + de->d_name, Real_Path + "/" + de->d_name, Matched, depth + 1, uevents, nodes);
 	}
+	closedir(d);
 }
 
 void TWPartitionManager::Coldboot() {
+	twrpProfilerScope scope("coldboot");
 	std::vector<TWPartition*>::iterator iter;
-	std::vector<string> sysfs_entries;
+	Sysfs_Matcher matcher;
+	timespec start, stop;
 
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
 		if (!(*iter)->Sysfs_Entry.empty()) {
 			size_t wildcard_pos = (*iter)->Sysfs_Entry.find("*");
 			if (wildcard_pos == string::npos)
 				wildcard_pos = (*iter)->Sysfs_Entry.size();
-			sysfs_entries.push_back((*iter)->Sysfs_Entry.substr(0, wildcard_pos));
+			matcher.Add((*iter)->Sysfs_Entry.substr(0, wildcard_pos));
 		}
 	}
 
-	if (sysfs_entries.size() > 0)
-		Coldboot_Scan(&sysfs_entries, "/sys/block", 0);
+	if (matcher.Empty())
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	std::vector<string> roots;                                               // the entries of /sys/block
+	DIR* d = opendir("/sys/block");
+	if (d == NULL)
+		return;
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		if (strlen(de->d_name) >= 4 && (strncmp(de->d_name, "ram", 3) == 0 || strncmp(de->d_name, "loop", 4) == 0))
+			continue;
+		roots.push_back(string("/sys/block/") + de->d_name);
+	}
+	closedir(d);
+
+	std::vector<string> uevents;                                             // devices to trigger, collected from all threads
+	unsigned long long nodes = 0;
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	TWWorkQueue queue(std::min(roots.size(), (size_t)COLDBOOT_MAX_THREADS));
+	for (size_t i = 0; i < roots.size(); i++) {
+		const string* root = &roots[i];
+		queue.Add([&matcher, root, &uevents, &nodes, &lock]() {
+			std::vector<string> found;
+			unsigned long long scanned = 0;
+			char real_path[PATH_MAX];
+			if (realpath(root->c_str(), real_path))
+				Coldboot_Scan(matcher, *root, real_path, false, 1, &found, &scanned);
+			pthread_mutex_lock(&lock);
+			uevents.insert(uevents.end(), found.begin(), found.end());
+			nodes += scanned;
+			pthread_mutex_unlock(&lock);
+		});
+	}
+	size_t thread_count = queue.Run();
+	pthread_mutex_destroy(&lock);
+
+	// trigger every device once, parents before their children like a plain walk would
+	std::sort(uevents.begin(), uevents.end());
+	uevents.erase(std::unique(uevents.begin(), uevents.end()), uevents.end());
+	size_t triggered = 0;
+	for (size_t i = 0; i < uevents.size(); i++) {
+		string Write_Path = uevents[i] + "/uevent";
+		int fd = open(Write_Path.c_str(), O_WRONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		if (write(fd, "add\n", 4) == 4)
+			triggered++;
+		close(fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	LOGINFO("Coldboot: scanned %llu sysfs nodes under %zu block devices on %zu threads, triggered %zu uevents in %dms\n",
+		nodes, roots.size(), thread_count, triggered, TWFunc::timespec_diff_ms(start, stop));
 }
 
 int TWPartitionManager::Run_OTA_Survival_Backup(bool adbbackup)
@@ -4125,9 +4238,9 @@ void TWPartitionManager::Update_System_Details_OTA_Survival(void)
   bool reporter = false;
   #endif
 
+  Update_Partition_Sizes(reporter);
   for (iter = Partitions.begin(); iter != Partitions.end(); iter++)
     {
-      (*iter)->Update_Size(reporter);
       if ((*iter)->Can_Be_Mounted)
 	{
 	  if ((*iter)->Mount_Point == Get_Android_Root_Path())
@@ -4343,8 +4456,9 @@ bool TWPartitionManager::Prepare_Repack(const std::string& Source_Path, const st
 		if (TWFunc::copy_file(Source_Path, destination, 0644))
 			return false;
 	}
-	std::string command = "cd " + Temp_Folder_Destination + " && " + magiskboot + " unpack -h '" + Source_Path +"'";
-	if (TWFunc::Exec_Cmd(command) != 0) {
+	twrpExec unpack({magiskboot, "unpack", "-h", Source_Path});
+	unpack.Set_Working_Dir(Temp_Folder_Destination);
+	if (unpack.Run() != 0) {
 		LOGINFO("Error unpacking %s!\n", Source_Path.c_str());
 		gui_msg(Msg(msg::kError, "unpack_error=Error unpacking image."));
 		return false;
@@ -4396,8 +4510,9 @@ bool TWPartitionManager::Repack_Images(const std::string& Target_Image, const st
 		LOGERR("Disabling verity is not implemented yet\n");
 	if (Repack_Options.Disable_Force_Encrypt)
 		LOGERR("Disabling force encrypt is not implemented yet\n");
-	std::string command = "cd " + path + " && " + magiskboot + " repack " + path + "boot.img";
-	if (TWFunc::Exec_Cmd(command) != 0) {
+	twrpExec repack({magiskboot, "repack", path + "boot.img"});
+	repack.Set_Working_Dir(path);
+	if (repack.Run() != 0) {
 		gui_msg(Msg(msg::kError, "repack_error=Error repacking image."));
 		return false;
 	}
@@ -443,9 +443,9 @@ private:
 	TWPartition* Find_Next_Storage(string Path, bool Exclude_Data_Media);
 	int Open_Lun_File(string Partition_Path, string Lun_File);
 	void Post_Decrypt(const string& Block_Device);                            // Completes various post-decrypt tasks
-	void Coldboot_Scan(std::vector<string> *sysfs_entries, const string& Path, int depth); // Scans subfolders to find matches to the paths stored in sysfs_entries so we can trigger the uevent system to "re-add" devices
-	void Coldboot();                                                          // Starts the scan of the /sys/block folder
+	void Coldboot();                                                          // Scans /sys/block for devices matching a Sysfs_Entry and triggers the uevent system to "re-add" them
 	bool Prepare_Empty_Folder(const std::string& Folder);                     // Creates an empty folder at Folder. If the folder already exists, the folder is deleted, then created
+	void Update_Partition_Sizes(bool Display_Error);                          // Runs Update_Size on all partitions, unrelated partitions in parallel
 	pid_t mtppid;
 	bool mtp_was_enabled;
 	int mtp_write_fd;
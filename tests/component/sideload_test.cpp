@@ -54,20 +54,11 @@ TEST(SideloadTest, run_fuse_sideload_wrong_parameters) {
   ASSERT_EQ(-1, run_fuse_sideload(std::move(provider_too_many_blocks)));
 }
 
-TEST(SideloadTest, run_fuse_sideload) {
-  const std::vector<std::string> blocks = {
-    std::string(2048, 'a') + std::string(2048, 'b'),
-    std::string(2048, 'c') + std::string(2048, 'd'),
-    std::string(2048, 'e') + std::string(2048, 'f'),
-    std::string(2048, 'g') + std::string(2048, 'h'),
-  };
-  const std::string content = android::base::Join(blocks, "");
-  ASSERT_EQ(16384U, content.size());
-
+static void ReadThroughFuseSideload(const std::string& content, uint32_t block_size) {
   TemporaryFile temp_file;
   ASSERT_TRUE(android::base::WriteStringToFile(content, temp_file.path));
 
-  auto provider = std::make_unique<FuseFileDataProvider>(temp_file.path, 4096);
+  auto provider = std::make_unique<FuseFileDataProvider>(temp_file.path, block_size);
   ASSERT_TRUE(provider->Valid());
   TemporaryDir mount_point;
   pid_t pid = fork();
@@ -106,3 +97,25 @@ TEST(SideloadTest, run_fuse_sideload) {
   ASSERT_EQ(0, WEXITSTATUS(status));
   ASSERT_EQ(EXIT_SUCCESS, WEXITSTATUS(status));
 }
+
+TEST(SideloadTest, run_fuse_sideload) {
+  const std::vector<std::string> blocks = {
+    std::string(2048, 'a') + std::string(2048, 'b'),
+    std::string(2048, 'c') + std::string(2048, 'd'),
+    std::string(2048, 'e') + std::string(2048, 'f'),
+    std::string(2048, 'g') + std::string(2048, 'h'),
+  };
+  const std::string content = android::base::Join(blocks, "");
+  ASSERT_EQ(16384U, content.size());
+
+  ReadThroughFuseSideload(content, 4096);
+}
+
+TEST(SideloadTest, run_fuse_sideload_prefetch) {
+  // Spans several prefetch windows and ends with a partial block.
+  std::string content;
+  for (size_t i = 0; i < 40 * 4096 + 100; i++) {
+    content.push_back(static_cast<char>(i * 7));
+  }
+  ReadThroughFuseSideload(content, 4096);
+}
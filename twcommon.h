@@ -26,7 +26,7 @@ extern "C" {
 #ifndef BUILD_TWRPTAR_MAIN
 #include "gui/gui.h"
 #define LOGERR(...) gui_print_color("error", "E:" __VA_ARGS__)
-#define LOGINFO(...) fprintf(stdout, "I:" __VA_ARGS__)
+#define LOGINFO(...) gui_log_printf('I', "I:" __VA_ARGS__)
 #else
 #include <stdio.h>
 #define LOGERR(...) printf("E:" __VA_ARGS__)
@@ -44,7 +44,10 @@
 #include <ctime>
 #include <locale>
 #include <codecvt>
+#include <map>
 #include <selinux/label.h>
+#include <zlib.h>
+#include <android-base/file.h>
 #include <android-base/properties.h>
 
 #include "twrp-functions.hpp"
@@ -64,6 +67,8 @@
 #endif
 #include "set_metadata.h"
 #include "twinstall.h"
+#include "twrpRemover.hpp"
+#include "twrpExec.hpp"
 #include "gui/pages.hpp"
 
 extern "C"
@@ -923,82 +928,125 @@ void TWFunc::GUI_Operation_Text(string Read_Value, string Partition_Name,
   DataManager::SetValue("tw_partition", Partition_Name);
 }
 
-void TWFunc::Copy_Log(string Source, string Destination) {
-	int logPipe[2];
-	int pigz_pid;
-	int destination_fd;
-	std::string destLogBuffer;
+// Persistent logs are a series of gzip members, one per copy. What a copy
+// appended is remembered, so the next copy of the same source only has to
+// compress what was logged since, unless the destination was changed by
+// someone else in the meantime.
+struct Log_Copy_State {
+	off_t source_offset;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+};
+static std::map<string, Log_Copy_State> Log_Copy_States;
+
+// Compress source_fd from offset to its end into one gzip member on destination_fd
+static bool Append_Gzip_Member(int destination_fd, int source_fd, off_t offset, off_t* end) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+
+	std::vector<unsigned char> in(64 * 1024), out(64 * 1024);
+	bool ok = true;
+	int flush = Z_NO_FLUSH;
+	while (ok && flush != Z_FINISH) {
+		ssize_t len = TEMP_FAILURE_RETRY(pread(source_fd, in.data(), in.size(), offset));
+		if (len < 0) {
+			ok = false;
+			break;
+		}
+		offset += len;
+		flush = (len == 0) ? Z_FINISH : Z_NO_FLUSH;
+		zs.next_in = in.data();
+		zs.avail_in = len;
+		do {
+			zs.next_out = out.data();
+			zs.avail_out = out.size();
+			if (deflate(&zs, flush) == Z_STREAM_ERROR) {
+				ok = false;
+				break;
+			}
+			size_t have = out.size() - zs.avail_out;
+			if (have && !android::base::WriteFully(destination_fd, out.data(), have))
+				ok = false;
+		} while (ok && zs.avail_out == 0);
+	}
+	deflateEnd(&zs);
+	*end = offset;
+	return ok;
+}
 
+void TWFunc::Copy_Log(string Source, string Destination) {
+	gui_log_flush();
 	PartitionManager.Mount_By_Path(Destination, false);
 
+	int destination_fd = open(Destination.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (destination_fd < 0) {
+		LOGINFO("Unable to open persistent log file: %s\n", Destination.c_str());
+		return;
+	}
+	struct stat st;
+	if (fstat(destination_fd, &st) != 0) {
+		close(destination_fd);
+		return;
+	}
+
+	off_t sourceOffset = 0;
+	string key = Source + "|" + Destination;
+	std::map<string, Log_Copy_State>::iterator it = Log_Copy_States.find(key);
+	if (it != Log_Copy_States.end() && it->second.dev == st.st_dev && it->second.ino == st.st_ino && it->second.size == st.st_size)
+		sourceOffset = it->second.source_offset;
+	else if (st.st_size > 0 && Get_File_Type(Destination) != COMPRESSED && ftruncate(destination_fd, 0) == 0)
+		st.st_size = 0; // not a compressed log, start over
+
+	// Fold in a log left behind uncompressed by older versions
 	size_t extPos = Destination.find(".gz");
-	std::string uncompressedLog(Destination);
-	uncompressedLog.replace(extPos, Destination.length(), "");
-
-	if (Path_Exists(Destination)) {
-		Archive_Type type = Get_File_Type(Destination);
-		if (type == COMPRESSED) {
-			std::string destFileBuffer;
-			std::string getCompressedContents = "pigz -c -d " + Destination;
-			if (Exec_Cmd(getCompressedContents, destFileBuffer) < 0) {
-				LOGINFO("Unable to get destination logfile contents.\n");
+	if (extPos != string::npos) {
+		string uncompressedLog = Destination.substr(0, extPos);
+		int uncompressed_fd = open(uncompressedLog.c_str(), O_RDONLY | O_CLOEXEC);
+		if (uncompressed_fd >= 0) {
+			off_t end;
+			bool ok = Append_Gzip_Member(destination_fd, uncompressed_fd, 0, &end);
+			close(uncompressed_fd);
+			if (!ok) {
+				LOGINFO("Unable to append to persistent log: %s\n", Destination.c_str());
+				ftruncate(destination_fd, st.st_size);
+				close(destination_fd);
 				return;
 			}
-			destLogBuffer.append(destFileBuffer);
+			std::remove(uncompressedLog.c_str());
+			fstat(destination_fd, &st);
 		}
-	} else if (Path_Exists(uncompressedLog)) {
-		std::ifstream uncompressedIfs(uncompressedLog);
-		std::stringstream uncompressedSS;
-		uncompressedSS << uncompressedIfs.rdbuf();
-		uncompressedIfs.close();
-		std::string uncompressedLogBuffer(uncompressedSS.str());
-		destLogBuffer.append(uncompressedLogBuffer);
-		std::remove(uncompressedLog.c_str());
-	}
-
-	std::ifstream ifs(Source);
-	std::stringstream ss;
-	ss << ifs.rdbuf();
-	std::string srcLogBuffer(ss.str());
-	ifs.close();
-
-	if (pipe(logPipe) < 0) {
-		LOGINFO("Unable to open pipe to write to persistent log file: %s\n", Destination.c_str());
 	}
 
-	destination_fd = open(Destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
-
-	pigz_pid = fork();
-	if (pigz_pid < 0) {
-		LOGINFO("fork() failed\n");
+	int source_fd = open(Source.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat sst;
+	if (source_fd < 0 || fstat(source_fd, &sst) != 0) {
+		LOGINFO("Unable to read log file: %s\n", Source.c_str());
+		if (source_fd >= 0)
+			close(source_fd);
 		close(destination_fd);
-		close(logPipe[0]);
-		close(logPipe[1]);
-	} else if (pigz_pid == 0) {
-		close(logPipe[1]);
-		dup2(logPipe[0], fileno(stdin));
-		dup2(destination_fd, fileno(stdout));
-		if (execlp("pigz", "pigz", "-", NULL) < 0) {
-			close(destination_fd);
-			close(logPipe[0]);
-			_exit(-1);
-		}
-	} else {
-		close(logPipe[0]);
-		if (write(logPipe[1], destLogBuffer.c_str(), destLogBuffer.size()) < 0) {
-			LOGINFO("Unable to append to persistent log: %s\n", Destination.c_str());
-			close(logPipe[1]);
-			close(destination_fd);
-			return;
-		}
-		if (write(logPipe[1], srcLogBuffer.c_str(), srcLogBuffer.size()) < 0) {
-			LOGINFO("Unable to append to persistent log: %s\n", Destination.c_str());
-			close(logPipe[1]);
-			close(destination_fd);
-			return;
-		}
-		close(logPipe[1]);
+		return;
+	}
+	if (sst.st_size < sourceOffset)
+		sourceOffset = 0; // the source was truncated or replaced
+
+	off_t sourceEnd = sourceOffset;
+	if (sst.st_size > sourceOffset && !Append_Gzip_Member(destination_fd, source_fd, sourceOffset, &sourceEnd)) {
+		LOGINFO("Unable to append to persistent log: %s\n", Destination.c_str());
+		// drop the partial member so the earlier ones stay readable
+		ftruncate(destination_fd, st.st_size);
+		Log_Copy_States.erase(key);
+	} else if (fstat(destination_fd, &st) == 0) {
+		Log_Copy_State state;
+		state.source_offset = sourceEnd;
+		state.dev = st.st_dev;
+		state.ino = st.st_ino;
+		state.size = st.st_size;
+		Log_Copy_States[key] = state;
 	}
+	close(source_fd);
 	close(destination_fd);
 }
 
@@ -1134,65 +1182,13 @@ void TWFunc::check_and_run_script(const char *script_file,
 
 int TWFunc::removeDir(const string path, bool skipParent)
 {
-  DIR *d = opendir(path.c_str());
-  int r = 0;
-  string new_path;
-
-  if (d == NULL)
-    {
-      gui_msg(Msg
-	      (msg::kError,
-	       "error_opening_strerr=Error opening: '{1}' ({2})") (path)
-	      (strerror(errno)));
-      return -1;
-    }
-
-  if (d)
-    {
-      struct dirent *p;
-      while (!r && (p = readdir(d)))
-	{
-	  if (!strcmp(p->d_name, ".") || !strcmp(p->d_name, ".."))
-	    continue;
-	  new_path = path + "/";
-	  new_path.append(p->d_name);
-	  if (p->d_type == DT_DIR)
-	    {
-	      r = removeDir(new_path, true);
-	      if (!r)
-		{
-		  if (p->d_type == DT_DIR)
-		    r = rmdir(new_path.c_str());
-		  else
-		    LOGINFO("Unable to removeDir '%s': %s\n",
-			    new_path.c_str(), strerror(errno));
-		}
-	    }
-	  else if (p->d_type == DT_REG || p->d_type == DT_LNK
-		   || p->d_type == DT_FIFO || p->d_type == DT_SOCK)
-	    {
-	      r = unlink(new_path.c_str());
-	      if (r != 0)
-		{
-		  LOGINFO("Unable to unlink '%s: %s'\n", new_path.c_str(),
-			  strerror(errno));
-		}
-	    }
-	}
-      closedir(d);
-
-      if (!r)
-	{
-	  if (skipParent)
-	    return 0;
-	  else
-	    r = rmdir(path.c_str());
-	}
-    }
-  return r;
+  twrpRemover remover;
+  return remover.Remove(path, skipParent) ? 0 : -1;
 }
 
 int TWFunc::copy_file(string src, string dst, int mode) {
+	if (src == TMP_LOG_FILE)
+		gui_log_flush(); // pick up everything still queued for the log
 	PartitionManager.Mount_By_Path(src, false);
 	PartitionManager.Mount_By_Path(dst, false);
 
@@ -3125,8 +3121,6 @@ bool TWFunc::Unpack_Image(string mount_point)
 #else // OF_USE_MAGISKBOOT_FOR_ALL_PATCHES
 bool TWFunc::Unpack_Image(string mount_point)
 {
-  string null;
-
   if (TWFunc::Path_Exists(tmp))
     	TWFunc::removeDir(tmp, false);
 
@@ -3150,15 +3144,16 @@ bool TWFunc::Unpack_Image(string mount_point)
     }
     
   Read_Write_Specific_Partition(tmp_boot.c_str(), mount_point, true);
-  string Command = "unpackbootimg -i " + tmp + "/boot.img" + " -o " + split_img;
-  if (TWFunc::Exec_Cmd(Command, null) != 0)
+  twrpExec unpackbootimg({"unpackbootimg", "-i", tmp + "/boot.img", "-o", split_img});
+  unpackbootimg.Set_Stdout_Callback([](const string&) {});
+  if (unpackbootimg.Run() != 0)
     {
       TWFunc::removeDir(tmp, false);
       LOGERR("TWFunc::Unpack_Image: Unpacking image failed.");
       return false;
     }
   
-  string local, result, hexdump;
+  string local, result, hexdump, Command;
   DIR *dir;
   struct dirent *der;
   dir = opendir(split_img.c_str());
@@ -5071,3 +5066,94 @@ bool TWFunc::Magiskboot_Repack_Patch_VBMeta()
    #endif
 }
 //
+
+TWWorkQueue::TWWorkQueue(size_t max_threads) {
+	this->max_threads = max_threads < 1 ? 1 : max_threads;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	outstanding = 0;
+}
+
+TWWorkQueue::~TWWorkQueue() {
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&lock);
+}
+
+size_t TWWorkQueue::Cpu_Threads(size_t max_threads) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		return 1;
+	return (size_t)cpus < max_threads ? (size_t)cpus : max_threads;
+}
+
+void TWWorkQueue::Add(const Work_Item& item) {
+	pthread_mutex_lock(&lock);
+	queue.push_front(item);
+	outstanding++;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+size_t TWWorkQueue::Run(const std::function<void()>& progress, int interval_ms) {
+	size_t thread_count = progress ? max_threads : max_threads - 1;
+	std::vector<pthread_t> threads;
+	for (size_t i = 0; i < thread_count; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, Thread_Start, this) == 0)
+			threads.push_back(thread);
+	}
+
+	bool report = progress && !threads.empty();
+	if (!report) {
+		Worker();
+	} else {
+		pthread_mutex_lock(&lock);
+		while (outstanding > 0) {
+			struct timespec timeout;
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec += interval_ms / 1000;
+			timeout.tv_nsec += (interval_ms % 1000) * 1000000L;
+			if (timeout.tv_nsec >= 1000000000L) {
+				timeout.tv_sec++;
+				timeout.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&done_cond, &lock, &timeout);
+			if (outstanding > 0) {
+				pthread_mutex_unlock(&lock);
+				progress();
+				pthread_mutex_lock(&lock);
+			}
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+	return report ? threads.size() : threads.size() + 1;
+}
+
+void* TWWorkQueue::Thread_Start(void* cookie) {
+	((TWWorkQueue*)cookie)->Worker();
+	return NULL;
+}
+
+void TWWorkQueue::Worker() {
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (queue.empty() && outstanding > 0)
+			pthread_cond_wait(&work_cond, &lock);
+		if (queue.empty())
+			break;
+		Work_Item item = queue.front();
+		queue.pop_front();
+		pthread_mutex_unlock(&lock);
+		item();
+		pthread_mutex_lock(&lock);
+		if (--outstanding == 0) {
+			pthread_cond_broadcast(&work_cond);
+			pthread_cond_broadcast(&done_cond);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -22,6 +22,9 @@
 #ifndef _TWRPFUNCTIONS_HPP
 #define _TWRPFUNCTIONS_HPP
 
+#include <pthread.h>
+#include <deque>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -233,4 +236,34 @@ extern int Log_Offset;
 };
 #endif // ndef BUILD_TWRPTAR_MAIN
 
+// Runs work items on several threads, the calling thread included. An item may
+// queue more items while it runs. New items are run first, so a tree is walked
+// depth first and the queue stays short. Run() returns once every item is done.
+class TWWorkQueue
+{
+public:
+	typedef std::function<void()> Work_Item;
+
+	TWWorkQueue(size_t max_threads);                                        // Threads for Run(), the calling thread counts as one
+	~TWWorkQueue();
+
+	void Add(const Work_Item& item);                                        // Safe to call from inside an item
+	// Runs everything queued and returns the number of threads that ran items. With a
+	// progress callback the calling thread calls it every interval_ms instead of running
+	// items itself, unless no thread could be started.
+	size_t Run(const std::function<void()>& progress = std::function<void()>(), int interval_ms = 250);
+	static size_t Cpu_Threads(size_t max_threads);                          // One per online cpu, at most max_threads
+
+private:
+	static void* Thread_Start(void* cookie);
+	void Worker();
+
+	size_t max_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;                                               // an item was queued or everything is done
+	pthread_cond_t done_cond;                                               // everything is done
+	std::deque<Work_Item> queue;
+	size_t outstanding;                                                     // items queued or running
+};
+
 #endif // _TWRPFUNCTIONS_HPP
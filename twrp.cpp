@@ -57,6 +57,8 @@ extern "C" {
 #include "variables.h"
 #include "startupArgs.hpp"
 #include "twrpAdbBuFifo.hpp"
+#include "twrpProfiler.hpp"
+#include "twrpWarmup.hpp"
 #ifdef TW_USE_NEW_MINADBD
 // #include "minadbd/minadbd.h"
 #else
@@ -131,15 +133,19 @@ static void process_recovery_mode(twrpAdbBuFifo* adb_bu_fifo, bool skip_decrypti
 		fstab_filename = "/etc/recovery.fstab";
 	}
 	printf("=> Processing %s\n", fstab_filename.c_str());
+	twrpProfiler::Begin("process_fstab");
 	if (!PartitionManager.Process_Fstab(fstab_filename, 1)) {
 		LOGERR("Failing out of recovery due to problem with fstab.\n");
+		twrpProfiler::End();
 		return;
 	}
+	twrpProfiler::End();
 	PartitionManager.Output_Partition_Logging();
 
 // We are doing this here to allow super partition to be set up prior to overriding properties
 // #if defined(TW_INCLUDE_LIBRESETPROP) && defined(TW_OVERRIDE_SYSTEM_PROPS)
 #if defined(TW_OVERRIDE_SYSTEM_PROPS) // OrangeFox has its own resetprop, so we don't need libresetprop
+	twrpProfiler::Begin("override_system_props");
 	if (!PartitionManager.Mount_By_Path(PartitionManager.Get_Android_Root_Path(), true)) {
 		LOGERR("Unable to mount %s\n", PartitionManager.Get_Android_Root_Path().c_str());
 	} else {
@@ -168,12 +174,15 @@ static void process_recovery_mode(twrpAdbBuFifo* adb_bu_fifo, bool skip_decrypti
 		}
 		PartitionManager.UnMount_By_Path(PartitionManager.Get_Android_Root_Path(), false);
 	}
+	twrpProfiler::End();
 #endif
 
         // use the ROM's fingerprint?
+	twrpProfiler::Begin("startup_scripts");
         TWFunc::RunStartupScript();
         TWFunc::UseSystemFingerprint();
 	TWFunc::RunFoxScript("/system/bin/runatboot.sh");
+	twrpProfiler::End();
 
 #ifdef TW_INCLUDE_INJECTTWRP
 	// Back up TWRP Ramdisk if needed:
@@ -193,14 +202,18 @@ static void process_recovery_mode(twrpAdbBuFifo* adb_bu_fifo, bool skip_decrypti
   	property_set("orangefox.adb.status", "0");
 #endif
 
+	twrpProfiler::Begin("decrypt");
 	Decrypt_Page(skip_decryption, datamedia);
+	twrpProfiler::End();
 
 	// Fixup the RTC clock on devices which require it
 	if (crash_counter == 0)
 		TWFunc::Fixup_Time_On_Boot();
 
+	twrpProfiler::Begin("settings");
 	TWFunc::Update_Log_File();
 	DataManager::ReadSettingsFile();
+	twrpProfiler::End();
 
 	// Run any outstanding OpenRecoveryScript
 	std::string cacheDir = TWFunc::get_log_dir();
@@ -208,11 +221,14 @@ static void process_recovery_mode(twrpAdbBuFifo* adb_bu_fifo, bool skip_decrypti
 		cacheDir = "/data/cache";
 	std::string orsFile = cacheDir + "/recovery/openrecoveryscript";
 	if ((DataManager::GetIntValue(TW_IS_ENCRYPTED) == 0 || skip_decryption) && (TWFunc::Path_Exists(SCRIPT_FILE_TMP) || TWFunc::Path_Exists(orsFile))) {
+		twrpProfilerScope scope("openrecoveryscript");
 		OpenRecoveryScript::Run_OpenRecoveryScript();
 	}
 
   	// call OrangeFox startup code
+	twrpProfiler::Begin("orangefox_startup");
   	TWFunc::OrangeFox_Startup();
+	twrpProfiler::End();
   	
 #ifdef FOX_ADVANCED_SECURITY
 	LOGINFO("ADB & MTP disabled by maintainer\n");
@@ -227,6 +243,7 @@ static void process_recovery_mode(twrpAdbBuFifo* adb_bu_fifo, bool skip_decrypti
 			&& (!DataManager::GetIntValue(TW_IS_ENCRYPTED) || DataManager::GetIntValue(TW_IS_DECRYPTED))) {
 		property_set("mtp.crash_check", "1");
 		LOGINFO("Starting MTP\n");
+		twrpProfilerScope scope("mtp");
 		if (!PartitionManager.Enable_MTP())
 			PartitionManager.Disable_MTP();
 		else
@@ -287,7 +304,9 @@ static void process_recovery_mode(twrpAdbBuFifo* adb_bu_fifo, bool skip_decrypti
 	adb_bu_fifo->threadAdbBuFifo();
 
 	// run the postrecoveryboot script here
+	twrpProfiler::Begin("postrecoveryboot");
 	TWFunc::RunFoxScript("/system/bin/postrecoveryboot.sh");
+	twrpProfiler::End();
 #ifndef OF_DEVICE_WITHOUT_PERSIST
 	DataManager::RestorePasswordBackup();
 #endif
@@ -353,12 +372,14 @@ int main(int argc, char **argv) {
 	umask(0);
 
 	Log_Offset = 0;
+	twrpProfiler::Mark("main");
 
 	// Set up temporary log file (/tmp/recovery.log)
 	freopen(TMP_LOG_FILE, "a", stdout);
 	setbuf(stdout, NULL);
 	freopen(TMP_LOG_FILE, "a", stderr);
 	setbuf(stderr, NULL);
+	gui_log_start();
 
 	signal(SIGPIPE, SIG_IGN);
 
@@ -415,17 +436,23 @@ int main(int argc, char **argv) {
 	TWFunc::Fox_Set_Current_Device_CodeName();
 
 	// Load default values to set DataManager constants and handle ifdefs
+	twrpProfiler::Begin("default_values");
 	DataManager::SetDefaultValues();
+	twrpProfiler::End();
 
 	// Symlink mapper to bootdevice if we have dynamic partitions
 	TWFunc::Mapper_to_BootDevice();
 
 	// start the UI
 	printf("Starting the UI...\n");
+	twrpProfiler::Begin("gui_init");
 	gui_init();
+	twrpProfiler::End();
 
 	// Load up all the resources
+	twrpProfiler::Begin("gui_load_resources");
 	gui_loadResources();
+	twrpProfiler::End();
 
 	startupArgs startup;
 	startup.parse(&argc, &argv);
@@ -444,15 +471,24 @@ int main(int argc, char **argv) {
 		reboot();
 		return 0;
 	} else {
+		twrpProfiler::Begin("recovery_mode");
 		process_recovery_mode(adb_bu_fifo, startup.Should_Skip_Decryption());
+		twrpProfiler::End();
 	}
 
 	// Language
+	twrpProfiler::Begin("language");
 	PageManager::LoadLanguage(DataManager::GetStrValue("tw_language"));
 	GUIConsole::Translate_Now();
+	twrpProfiler::End();
 
 	// Fox extra setup
+	twrpProfiler::Begin("verity_forced_encryption");
   	TWFunc::Setup_Verity_Forced_Encryption();
+	twrpProfiler::End();
+
+	twrpProfiler::Finish(BOOT_TRACE_FILE);
+	twrpWarmup::Start();
 
 	// Launch the main GUI
 	if (Fox_CheckReload_Themes()) {
@@ -462,6 +498,7 @@ int main(int argc, char **argv) {
 		gui_startPage("reapply_settings", 1, 0);
 	} else gui_start();
 
+	twrpWarmup::Stop();
 	delete adb_bu_fifo;
 	TWFunc::Update_Intent_File(startup.Get_Intent());
 
@@ -29,6 +29,7 @@
 #include "variables.h"
 #include "partitions.hpp"
 #include "twrp-functions.hpp"
+#include "twrpWarmup.hpp"
 #include "gui/gui.hpp"
 #include "gui/objects.hpp"
 #include "gui/pages.hpp"
@@ -48,6 +49,7 @@ void twrpAdbBuFifo::Check_Adb_Fifo_For_Events(void)
 	if (read(adb_fifo_fd, &cmd, sizeof(cmd)) > 0) 
 	{
 		LOGINFO("adb backup cmd: %s\n", cmd);
+		twrpWarmup::Stop();
 		std::string cmdcheck(cmd);
 		cmdcheck = cmdcheck.substr(0, strlen(ADB_BACKUP_OP));
 		std::string Options(cmd);
@@ -1,9 +1,12 @@
+#include <algorithm>
+
 #include "twrpApex.hpp"
+#include "twrp-functions.hpp"
 
 namespace fs = std::filesystem;
 
 bool twrpApex::loadApexImages() {
-	std::vector<std::string> apexFiles;
+	apexFiles.clear();
 	if (access(APEX_DIR, F_OK) != 0) {
 		LOGERR("Unable to open %s\n", APEX_DIR);
 		return false;
@@ -28,21 +31,26 @@ bool twrpApex::loadApexImages() {
 		return false;
 	}
 
-	size_t apexFileCount = 0;
-	for (auto&& apexFile : apexFiles) {
-		std::string fileToMount = unzipImage(apexFile);
-		loadApexImage(fileToMount, apexFileCount++);
+	// every apex has its own loop device, so they can be set up side by side
+	TWWorkQueue queue(std::min(apexFiles.size(), (size_t)APEX_MAX_THREADS));
+	for (size_t i = 0; i < apexFiles.size(); i++) {
+		queue.Add([this, i]() {
+			apexImage image;
+			if (findApexImage(apexFiles[i], &image))
+				loadApexImage(image, i);
+		});
 	}
+	queue.Run();
 	return true;
 }
 
-std::string twrpApex::unzipImage(std::string file) {
+bool twrpApex::findApexImage(std::string file, apexImage* image) {
 	ZipArchiveHandle handle;
 	int32_t ret = OpenArchive(file.c_str(), &handle);
 	if (ret != 0) {
 		LOGERR("unable to open zip archive %s\n", file.c_str());
 		CloseArchive(handle);
-		return nullptr;
+		return false;
 	}
 
 	ZipEntry entry;
@@ -51,24 +59,49 @@ std::string twrpApex::unzipImage(std::string file) {
 	if (ret != 0) {
 		LOGERR("unable to find %s in zip\n", APEX_PAYLOAD);
 		CloseArchive(handle);
-		return nullptr;
+		return false;
 	}
 
+	image->apexFile = file;
+#ifdef USE_VENDOR_LIBS
+	// System stays mounted, so a payload stored as is can be read by the loop device
+	// straight from the apex. Otherwise the loop device would keep system busy and
+	// it could not be unmounted after the apex images are loaded.
+	if (entry.method == kCompressStored) {
+		image->imageFile = file;
+		image->offset = entry.offset;
+		image->size = entry.uncompressed_length;
+		CloseArchive(handle);
+		return true;
+	}
+#endif
+
+	bool extracted = unzipImage(handle, &entry, file, image);
+	CloseArchive(handle);
+	return extracted;
+}
+
+bool twrpApex::unzipImage(ZipArchiveHandle handle, ZipEntry* entry, std::string file, apexImage* image) {
 	std::string baseFile = basename(file.c_str());
 	std::string path("/tmp/");
 	path = path + baseFile;
 	int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
-	ret = ExtractEntryToFile(handle, &entry, fd);
+	if (fd < 0) {
+		LOGERR("unable to create %s\n", path.c_str());
+		return false;
+	}
+	int32_t ret = ExtractEntryToFile(handle, entry, fd);
 	if (ret != 0) {
 		LOGERR("unable to extract %s\n", path.c_str());
 		close(fd);
-		CloseArchive(handle);
-		return nullptr;
+		return false;
 	}
 
 	close(fd);
-	CloseArchive(handle);
-	return path;
+	image->imageFile = path;
+	image->offset = 0;
+	image->size = 0;
+	return true;
 }
 
 bool twrpApex::createLoopBackDevices(size_t count) {
@@ -95,8 +128,9 @@ bool twrpApex::createLoopBackDevices(size_t count) {
 	return true;
 }
 
-bool twrpApex::loadApexImage(std::string fileToMount, size_t loop_device_number) {
+bool twrpApex::loadApexImage(const apexImage& image, size_t loop_device_number) {
 	struct loop_info64 info;
+	const std::string& fileToMount = image.imageFile;
 
 	int fd = open(fileToMount.c_str(), O_RDONLY);
 	if (fd < 0) {
@@ -122,6 +156,8 @@ bool twrpApex::loadApexImage(std::string fileToMount, size_t loop_device_number)
 	close(fd);
 
 	memset(&info, 0, sizeof(struct loop_info64));
+	info.lo_offset = image.offset;
+	info.lo_sizelimit = image.size;
 	if (ioctl(loop_fd, LOOP_SET_STATUS64, &info)) {
 		LOGERR("failed to mount loop: %s: %s\n", fileToMount.c_str(), strerror(errno));
 		close(loop_fd);
@@ -129,7 +165,7 @@ bool twrpApex::loadApexImage(std::string fileToMount, size_t loop_device_number)
 	}
 	close(loop_fd);
 	std::string bind_mount(APEX_BASE);
-	bind_mount = bind_mount + basename(fileToMount.c_str());
+	bind_mount = bind_mount + basename(image.apexFile.c_str());
 	int ret = mkdir(bind_mount.c_str(), 0666);
 	if (ret != 0) {
 		LOGERR("Unable to create mount directory: %s\n", bind_mount.c_str());
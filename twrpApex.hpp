@@ -23,14 +23,26 @@
 #define APEX_PAYLOAD "apex_payload.img"
 #define LOOP_BLOCK_DEVICE_DIR "/dev/block/"
 #define APEX_BASE "/apex/"
+#define APEX_MAX_THREADS 4
+
+// Where the ext4 image of an apex can be read from
+struct apexImage {
+	std::string apexFile;                  // the .apex, names the mount point
+	std::string imageFile;                 // the apex itself, or the payload extracted to /tmp
+	off64_t offset;
+	off64_t size;                          // 0 for the whole file
+};
 
 class twrpApex {
 public:
 	bool loadApexImages();
 
 private:
-	std::string unzipImage(std::string file);
+	bool findApexImage(std::string file, apexImage* image);
+	bool unzipImage(ZipArchiveHandle handle, ZipEntry* entry, std::string file, apexImage* image);
 	bool createLoopBackDevices(size_t count);
-	bool loadApexImage(std::string fileToMount, size_t loop_device_number);
+	bool loadApexImage(const apexImage& image, size_t loop_device_number);
+
+	std::vector<std::string> apexFiles;
 };
 #endif
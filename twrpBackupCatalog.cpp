@@ -0,0 +1,307 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "twrpBackupCatalog.hpp"
+#include "twcommon.h"
+#include "data.hpp"
+#include "twrp-functions.hpp"
+#include "variables.h"
+#include "set_metadata.h"
+
+static pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static std::string Volume_Name(const Backup_Catalog_File& file, int volume) {
+	if (file.volumes == 0)
+		return file.filename;
+	char extn[8];
+	snprintf(extn, sizeof(extn), "%03i", volume);
+	return file.filename + extn;
+}
+
+static bool Entries_Equal(const Backup_Catalog_Entry& a, const Backup_Catalog_Entry& b) {
+	if (a.name != b.name || a.folder_ino != b.folder_ino || a.folder_mtime != b.folder_mtime ||
+			a.folder_mtime_nsec != b.folder_mtime_nsec || a.date != b.date || a.encrypted != b.encrypted ||
+			a.files.size() != b.files.size())
+		return false;
+	for (size_t i = 0; i < a.files.size(); i++) {
+		const Backup_Catalog_File& fa = a.files[i];
+		const Backup_Catalog_File& fb = b.files[i];
+		if (fa.filename != fb.filename || fa.volumes != fb.volumes || fa.mtime != fb.mtime || fa.mtime_nsec != fb.mtime_nsec)
+			return false;
+	}
+	return true;
+}
+
+// Adding or removing a file changes the folder, so the files are only looked at
+// once the folder matches. Rewriting a backup in place writes its last volume
+// last, so that one stat per file catches it.
+bool twrpBackupCatalog::Is_Current(const std::string& Backup_Folder, const struct stat& folder_st, const Backup_Catalog_Entry& entry) {
+	if (folder_st.st_ino != entry.folder_ino || folder_st.st_mtime != entry.folder_mtime || folder_st.st_mtim.tv_nsec != entry.folder_mtime_nsec)
+		return false;
+	for (size_t i = 0; i < entry.files.size(); i++) {
+		const Backup_Catalog_File& file = entry.files[i];
+		struct stat st;
+		if (stat((Backup_Folder + "/" + Volume_Name(file, file.volumes == 0 ? 0 : file.volumes - 1)).c_str(), &st) != 0)
+			return false;
+		if (st.st_mtime != file.mtime || st.st_mtim.tv_nsec != file.mtime_nsec)
+			return false;
+	}
+	return true;
+}
+
+bool twrpBackupCatalog::Scan_Backup(const std::string& Backup_Folder, Backup_Catalog_Entry& entry) {
+	struct stat folder_st;
+	if (stat(Backup_Folder.c_str(), &folder_st) != 0)
+		return false;
+	DIR* d = opendir(Backup_Folder.c_str());
+	if (d == NULL)
+		return false;
+
+	entry.name = TWFunc::Get_Filename(Backup_Folder);
+	entry.folder_ino = folder_st.st_ino;
+	entry.folder_mtime = folder_st.st_mtime;
+	entry.folder_mtime_nsec = folder_st.st_mtim.tv_nsec;
+	entry.date = 0;
+	entry.encrypted = false;
+	entry.files.clear();
+
+	std::map<std::string, Backup_Catalog_File> volumes;                      // volume count and last volume mtime of each file
+	std::map<std::string, int> last_volume;
+	bool get_date = true;
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL) {
+		std::string name = de->d_name;
+		if (name.size() <= 2)
+			continue;
+
+		std::string file_path = Backup_Folder + "/" + name;
+		struct stat st;
+		bool have_stat = stat(file_path.c_str(), &st) == 0;
+		if (get_date) {
+			entry.date = have_stat ? st.st_mtime : 0;
+			get_date = false;
+		}
+
+		// label.fstype.win or label.fstype.win000 for split backups
+		size_t fstype_pos = name.find('.');
+		if (fstype_pos == std::string::npos)
+			continue;
+		size_t extn_pos = name.find('.', fstype_pos + 1);
+		if (extn_pos == std::string::npos)
+			continue;
+		std::string fstype = name.substr(fstype_pos + 1, extn_pos - fstype_pos - 1);
+		std::string extn = name.substr(extn_pos + 1);
+		if (fstype == "log" || (extn.size() != 3 && extn.size() != 6) || extn.compare(0, 3, "win") != 0)
+			continue;
+
+		if (TWFunc::Get_File_Type(file_path) == 2) {
+			LOGINFO("'%s' is encrypted\n", file_path.c_str());
+			entry.encrypted = true;
+		}
+		std::string filename = name.substr(0, extn_pos + 4);
+		Backup_Catalog_File& totals = volumes[filename];
+		int volume = extn.size() == 6 ? atoi(extn.c_str() + 3) : 0;
+		if (extn.size() == 6)
+			totals.volumes++;
+		if (have_stat && (!last_volume.count(filename) || volume > last_volume[filename])) {
+			last_volume[filename] = volume;
+			totals.mtime = st.st_mtime;
+			totals.mtime_nsec = st.st_mtim.tv_nsec;
+		}
+		if (extn.size() == 6 && extn != "win000")
+			continue;
+
+		Backup_Catalog_File file;
+		file.filename = filename;
+		entry.files.push_back(file);
+	}
+	closedir(d);
+
+	for (size_t i = 0; i < entry.files.size(); i++) {
+		Backup_Catalog_File& file = entry.files[i];
+		const Backup_Catalog_File& totals = volumes[file.filename];
+		file.volumes = totals.volumes;
+		file.mtime = totals.mtime;
+		file.mtime_nsec = totals.mtime_nsec;
+	}
+	return true;
+}
+
+// Only the backups folder of this device gets a catalog, restores from elsewhere leave no trace
+bool twrpBackupCatalog::Use_Catalog(const std::string& Backup_Folder, std::string& catalog_file) {
+	std::string backups_folder = TWFunc::Remove_Trailing_Slashes(DataManager::GetStrValue(TW_BACKUPS_FOLDER_VAR));
+	std::string parent = TWFunc::Remove_Trailing_Slashes(TWFunc::Get_Path(TWFunc::Remove_Trailing_Slashes(Backup_Folder)));
+	if (backups_folder.empty() || parent != backups_folder)
+		return false;
+	// the catalog is line based
+	std::string name = TWFunc::Get_Filename(TWFunc::Remove_Trailing_Slashes(Backup_Folder));
+	if (name.empty() || name.find_first_of("\t\n") != std::string::npos)
+		return false;
+	catalog_file = backups_folder + "/" BACKUP_CATALOG_FILE;
+	return true;
+}
+
+bool twrpBackupCatalog::Load(const std::string& catalog_file, std::vector<Backup_Catalog_Entry>& entries) {
+	FILE* fp = fopen(catalog_file.c_str(), "r");
+	if (!fp)
+		return false;
+
+	char line[1024];
+	int version = 0;
+	if (!fgets(line, sizeof(line), fp) || sscanf(line, "catalog %d", &version) != 1 || version != BACKUP_CATALOG_VERSION) {
+		LOGINFO("Ignoring backup catalog '%s' with unknown version\n", catalog_file.c_str());
+		fclose(fp);
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = '\0';
+		std::vector<std::string> fields = TWFunc::Split_String(line, "\t", false);
+		if (fields.size() == 7 && fields[0] == "backup") {
+			Backup_Catalog_Entry entry;
+			entry.name = fields[1];
+			entry.folder_ino = strtoull(fields[2].c_str(), NULL, 10);
+			entry.folder_mtime = strtoll(fields[3].c_str(), NULL, 10);
+			entry.folder_mtime_nsec = strtol(fields[4].c_str(), NULL, 10);
+			entry.date = strtoll(fields[5].c_str(), NULL, 10);
+			entry.encrypted = fields[6] == "1";
+			entries.push_back(entry);
+		} else if (fields.size() == 5 && fields[0] == "file" && !entries.empty()) {
+			Backup_Catalog_File file;
+			file.filename = fields[1];
+			file.volumes = atoi(fields[2].c_str());
+			file.mtime = strtoll(fields[3].c_str(), NULL, 10);
+			file.mtime_nsec = strtol(fields[4].c_str(), NULL, 10);
+			entries.back().files.push_back(file);
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+// Writes the catalog to a temporary file and renames it over the old one, so a
+// catalog is either the old or the new one if the device goes down in between.
+// Entries for backups that are gone are dropped on the way.
+bool twrpBackupCatalog::Save(const std::string& catalog_file, std::vector<Backup_Catalog_Entry>& entries) {
+	std::string backups_folder = TWFunc::Get_Path(catalog_file);
+	std::string temp_file = catalog_file + ".tmp";
+	FILE* fp = fopen(temp_file.c_str(), "w");
+	if (!fp) {
+		LOGINFO("Unable to write backup catalog '%s': %s\n", temp_file.c_str(), strerror(errno));
+		return false;
+	}
+	fprintf(fp, "catalog %d\n", BACKUP_CATALOG_VERSION);
+	for (size_t i = 0; i < entries.size(); i++) {
+		const Backup_Catalog_Entry& entry = entries[i];
+		struct stat st;
+		if (stat((backups_folder + entry.name).c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+			continue;
+		fprintf(fp, "backup\t%s\t%llu\t%lld\t%ld\t%lld\t%d\n", entry.name.c_str(), (unsigned long long)entry.folder_ino,
+			(long long)entry.folder_mtime, entry.folder_mtime_nsec, (long long)entry.date, entry.encrypted ? 1 : 0);
+		for (size_t j = 0; j < entry.files.size(); j++) {
+			const Backup_Catalog_File& file = entry.files[j];
+			fprintf(fp, "file\t%s\t%d\t%lld\t%ld\n", file.filename.c_str(), file.volumes, (long long)file.mtime,
+				file.mtime_nsec);
+		}
+	}
+	bool ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	ok = fclose(fp) == 0 && ok;
+	if (!ok || rename(temp_file.c_str(), catalog_file.c_str()) != 0) {
+		LOGINFO("Unable to write backup catalog '%s': %s\n", catalog_file.c_str(), strerror(errno));
+		unlink(temp_file.c_str());
+		return false;
+	}
+	tw_set_default_metadata(catalog_file.c_str());
+	return true;
+}
+
+// Replaces or adds the entry, called with catalog_lock held
+void twrpBackupCatalog::Store(const std::string& catalog_file, const Backup_Catalog_Entry& entry) {
+	std::vector<Backup_Catalog_Entry> entries;
+	Load(catalog_file, entries);
+	bool found = false;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].name == entry.name) {
+			if (Entries_Equal(entries[i], entry))
+				return;
+			entries[i] = entry;
+			found = true;
+		}
+	}
+	if (!found)
+		entries.push_back(entry);
+	Save(catalog_file, entries);
+}
+
+bool twrpBackupCatalog::Get_Entry(const std::string& Backup_Folder, Backup_Catalog_Entry& entry) {
+	std::string catalog_file;
+	if (!Use_Catalog(Backup_Folder, catalog_file))
+		return Scan_Backup(Backup_Folder, entry);
+
+	struct stat st;
+	if (stat(Backup_Folder.c_str(), &st) != 0)
+		return false;
+
+	pthread_mutex_lock(&catalog_lock);
+	std::vector<Backup_Catalog_Entry> entries;
+	Load(catalog_file, entries);
+	std::string name = TWFunc::Get_Filename(TWFunc::Remove_Trailing_Slashes(Backup_Folder));
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].name == name && Is_Current(Backup_Folder, st, entries[i])) {
+			entry = entries[i];
+			pthread_mutex_unlock(&catalog_lock);
+			return true;
+		}
+	}
+
+	LOGINFO("Backup catalog has no current entry for '%s', scanning it\n", name.c_str());
+	if (!Scan_Backup(Backup_Folder, entry)) {
+		int err = errno;
+		pthread_mutex_unlock(&catalog_lock);
+		errno = err;
+		return false;
+	}
+	Store(catalog_file, entry);
+	pthread_mutex_unlock(&catalog_lock);
+	return true;
+}
+
+bool twrpBackupCatalog::Update_Entry(const std::string& Backup_Folder) {
+	std::string catalog_file;
+	if (!Use_Catalog(Backup_Folder, catalog_file))
+		return false;
+
+	Backup_Catalog_Entry entry;
+	pthread_mutex_lock(&catalog_lock);
+	bool ret = Scan_Backup(Backup_Folder, entry);
+	if (ret)
+		Store(catalog_file, entry);
+	pthread_mutex_unlock(&catalog_lock);
+	return ret;
+}
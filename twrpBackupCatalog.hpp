@@ -0,0 +1,72 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TWRPBACKUPCATALOG_HPP
+#define __TWRPBACKUPCATALOG_HPP
+
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#define BACKUP_CATALOG_FILE ".backup_catalog"
+#define BACKUP_CATALOG_VERSION 3
+
+struct Backup_Catalog_File {
+	std::string filename;                                                   // as used for Backup_FileName, "data.ext4.win" for split backups too
+	int volumes;                                                            // 0 if the backup is not split
+	time_t mtime;                                                           // of the last volume, which is written last
+	long mtime_nsec;
+};
+
+struct Backup_Catalog_Entry {
+	std::string name;
+	ino_t folder_ino;                                                       // the entry is valid while the folder and its files are unchanged
+	time_t folder_mtime;
+	long folder_mtime_nsec;
+	time_t date;                                                            // shown on the restore page
+	bool encrypted;
+	std::vector<Backup_Catalog_File> files;
+};
+
+// Caches what the restore page needs to know about each backup in a catalog file
+// in the backups folder of the device, so selecting a backup takes a stat of its
+// folder and one per backed up partition instead of a stat and a read of every
+// file in it.
+// An entry that is missing, or whose folder or files changed since it was made, is
+// rebuilt from the folder when it is needed. The catalog is only written when an
+// entry changes.
+class twrpBackupCatalog
+{
+public:
+	// Fills entry for the backup in Backup_Folder, from the catalog when it is up to
+	// date. Backups outside the backups folder of the device are always scanned.
+	// Returns false with errno set if the folder cannot be read.
+	static bool Get_Entry(const std::string& Backup_Folder, Backup_Catalog_Entry& entry);
+	static bool Update_Entry(const std::string& Backup_Folder);            // Rescans a backup, called once Run_Backup() is done writing it
+
+private:
+	static bool Scan_Backup(const std::string& Backup_Folder, Backup_Catalog_Entry& entry);
+	static bool Is_Current(const std::string& Backup_Folder, const struct stat& folder_st, const Backup_Catalog_Entry& entry);
+	static bool Use_Catalog(const std::string& Backup_Folder, std::string& catalog_file);
+	static bool Load(const std::string& catalog_file, std::vector<Backup_Catalog_Entry>& entries);
+	static bool Save(const std::string& catalog_file, std::vector<Backup_Catalog_Entry>& entries);
+	static void Store(const std::string& catalog_file, const Backup_Catalog_Entry& entry);   // Writes the catalog if entry differs from the stored one
+};
+
+#endif // __TWRPBACKUPCATALOG_HPP
@@ -34,26 +34,21 @@
 
 std::vector<string> PartFilenames;
 
-bool twrpDigestDriver::Check_File_Digest(const string& Filename) {
-	twrpDigest *digest;
-	string digestfile = Filename, file_name = Filename;
-	string digest_str;
-	bool use_sha2 = false;
+string twrpDigestDriver::Find_Digest_File(const string& Filename, bool& use_sha2) {
+	string digestfile = Filename;
 
+	use_sha2 = false;
 #ifndef TW_NO_SHA2_LIBRARY
 
 	digestfile += ".sha2";
 	if (TWFunc::Path_Exists(digestfile)) {
-		digest = new twrpSHA256();
 		use_sha2 = true;
 	}
 	else {
 		digestfile = Filename + ".sha256";
 		if (TWFunc::Path_Exists(digestfile)) {
-			digest = new twrpSHA256();
 			use_sha2 = true;
 		} else {
-			digest = new twrpMD5();
 			digestfile = Filename + ".md5";
 			if (!TWFunc::Path_Exists(digestfile)) {
 				digestfile = Filename + ".md5sum";
@@ -61,7 +56,6 @@ bool twrpDigestDriver::Check_File_Digest(const string& Filename) {
 		}
 	}
 #else
-	digest = new twrpMD5();
 	digestfile = Filename + ".md5";
 	if (!TWFunc::Path_Exists(digestfile)) {
 		digestfile = Filename + ".md5sum";
@@ -69,8 +63,23 @@ bool twrpDigestDriver::Check_File_Digest(const string& Filename) {
 
 #endif
 
-	if (!TWFunc::Path_Exists(digestfile)) {
-		delete digest;
+	if (!TWFunc::Path_Exists(digestfile))
+		return "";
+	return digestfile;
+}
+
+twrpDigest* twrpDigestDriver::New_Digest(bool use_sha2) {
+#ifndef TW_NO_SHA2_LIBRARY
+	if (use_sha2)
+		return new twrpSHA256();
+#endif
+	return new twrpMD5();
+}
+
+bool twrpDigestDriver::Open_Digest_File(const string& Filename, twrpDigest** digest, string& digest_str, bool& use_sha2) {
+	*digest = NULL;
+	string digestfile = Find_Digest_File(Filename, use_sha2);
+	if (digestfile.empty()) {
 		gui_msg(Msg(msg::kWarning, "no_digest=Skipping Digest check: no Digest file found"));
 		return true;
 	}
@@ -78,14 +87,14 @@ bool twrpDigestDriver::Check_File_Digest(const string& Filename) {
 
 	if (TWFunc::read_file(digestfile, digest_str) != 0) {
 		gui_msg("digest_error=Digest Error!");
-		delete digest;
 		return false;
 	}
 
-	if (!stream_file_to_digest(file_name, digest)) {
-		delete digest;
-		return false;
-	}
+	*digest = New_Digest(use_sha2);
+	return true;
+}
+
+bool twrpDigestDriver::Compare_Digest(const string& Filename, twrpDigest* digest, const string& digest_str, bool use_sha2) {
 	string digest_check = digest->return_digest_string();
 	if (digest_check == digest_str) {
 		if (use_sha2)
@@ -93,15 +102,32 @@ bool twrpDigestDriver::Check_File_Digest(const string& Filename) {
 		else
 			LOGINFO("MD5 Digest: %s  %s\n", digest_str.c_str(), TWFunc::Get_Filename(Filename).c_str());
 		gui_msg(Msg("digest_matched=Digest matched for '{1}'.")(Filename));
-		delete digest;
 		return true;
 	}
 
 	gui_msg(Msg(msg::kError, "digest_fail_match=Digest failed to match on '{1}'.")(Filename));
-	delete digest;
 	return false;
 }
 
+bool twrpDigestDriver::Check_File_Digest(const string& Filename) {
+	twrpDigest *digest;
+	string digest_str;
+	bool use_sha2;
+
+	if (!Open_Digest_File(Filename, &digest, digest_str, use_sha2))
+		return false;
+	if (digest == NULL)
+		return true;
+
+	if (!stream_file_to_digest(Filename, digest)) {
+		delete digest;
+		return false;
+	}
+	bool ret = Compare_Digest(Filename, digest, digest_str, use_sha2);
+	delete digest;
+	return ret;
+}
+
 bool twrpDigestDriver::Check_Digest(string Full_Filename) {
 	char split_filename[512];
 	int index = 0;
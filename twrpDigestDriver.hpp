@@ -25,6 +25,10 @@ class twrpDigestDriver {
 public:
 
 	static bool Check_File_Digest(const string& Filename);		//Check the digest of a TWRP partition backup
+	static string Find_Digest_File(const string& Filename, bool& use_sha2); //Return the .sha2/.sha256/.md5/.md5sum file of Filename, empty if there is none
+	static twrpDigest* New_Digest(bool use_sha2);				//Create a SHA-256 or MD5 twrpDigest
+	static bool Open_Digest_File(const string& Filename, twrpDigest** digest, string& digest_str, bool& use_sha2); //Read the digest file of Filename and create the matching twrpDigest, NULL if there is none
+	static bool Compare_Digest(const string& Filename, twrpDigest* digest, const string& digest_str, bool use_sha2); //Check a fed twrpDigest against the digest file contents
 	static bool Check_Digest(string Full_Filename);				//Check to make sure the digest is correct
 	static bool Write_Digest(string Full_Filename);				//Write the digest to a file
 	static bool Make_Digest(string Full_Filename);				//Create the digest for a partition backup
@@ -0,0 +1,345 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "twrpExec.hpp"
+#include "twcommon.h"
+#include "twrp-functions.hpp"
+#ifndef BUILD_TWRPTAR_MAIN
+#include "data.hpp"
+#endif
+#include "gui/gui.hpp"
+
+static pthread_mutex_t running_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<twrpExec*> running;
+
+static unsigned long long Now_Ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static unsigned long long Timeval_Ms(const struct timeval& tv) {
+	return (unsigned long long)tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+}
+
+twrpExec::twrpExec(const std::vector<std::string>& args) : args(args) {
+	stdin_fd = -1;
+	stdout_fd = -1;
+	timeout_ms = 0;
+	show_errors = true;
+	pid = -1;
+	cancel_requested = false;
+	start_ms = 0;
+	term_sent_ms = 0;
+	kill_sent = false;
+	memset(&stats, 0, sizeof(stats));
+	stats.exit_status = -1;
+}
+
+twrpExec::~twrpExec() {
+	Close_Passed_Fds();
+}
+
+void twrpExec::Close_Passed_Fds() {
+	if (stdin_fd >= 0)
+		close(stdin_fd);
+	if (stdout_fd >= 0)
+		close(stdout_fd);
+	stdin_fd = -1;
+	stdout_fd = -1;
+}
+
+std::string twrpExec::Get_Command() {
+	std::string command;
+	for (size_t i = 0; i < args.size(); i++) {
+		if (i)
+			command += " ";
+		if (args[i].empty() || args[i].find_first_of(" \t'\"") != std::string::npos)
+			command += "'" + args[i] + "'";
+		else
+			command += args[i];
+	}
+	return command;
+}
+
+void twrpExec::Cancel() {
+	cancel_requested = true;
+}
+
+void twrpExec::Cancel_All() {
+	pthread_mutex_lock(&running_lock);
+	for (size_t i = 0; i < running.size(); i++)
+		running[i]->Cancel();
+	pthread_mutex_unlock(&running_lock);
+}
+
+int twrpExec::Run() {
+	memset(&stats, 0, sizeof(stats));
+	stats.exit_status = -1;
+	term_sent_ms = 0;
+	kill_sent = false;
+	if (args.empty()) {
+		Close_Passed_Fds();
+		return -1;
+	}
+
+	std::vector<char*> argv;
+	for (size_t i = 0; i < args.size(); i++)
+		argv.push_back(const_cast<char*>(args[i].c_str()));
+	argv.push_back(NULL);
+
+	// only the streams someone is listening to go through a pipe
+	bool pipe_stdout = stdout_fd < 0 && (stdout_callback || progress_parser);
+	bool pipe_stderr = stderr_callback || progress_parser;
+	int out_pipe[2] = { -1, -1 }, err_pipe[2] = { -1, -1 };
+	if ((pipe_stdout && pipe2(out_pipe, O_CLOEXEC) < 0) || (pipe_stderr && pipe2(err_pipe, O_CLOEXEC) < 0)) {
+		LOGERR("twrpExec: unable to create pipe: %s\n", strerror(errno));
+		for (int i = 0; i < 2; i++) {
+			if (out_pipe[i] >= 0)
+				close(out_pipe[i]);
+			if (err_pipe[i] >= 0)
+				close(err_pipe[i]);
+		}
+		Close_Passed_Fds();
+		return -1;
+	}
+
+	pthread_mutex_lock(&running_lock);
+	running.push_back(this);
+	pthread_mutex_unlock(&running_lock);
+
+	start_ms = Now_Ms();
+	pid = fork();
+	if (pid == 0) {
+		// own process group, so a timeout or cancel also reaches its children
+		setpgid(0, 0);
+		if (stdin_fd >= 0) {
+			dup2(stdin_fd, STDIN_FILENO);
+		} else {
+			int null_fd = open("/dev/null", O_RDONLY);
+			if (null_fd >= 0)
+				dup2(null_fd, STDIN_FILENO);
+		}
+		if (stdout_fd >= 0)
+			dup2(stdout_fd, STDOUT_FILENO);
+		else if (pipe_stdout)
+			dup2(out_pipe[1], STDOUT_FILENO);
+		if (pipe_stderr)
+			dup2(err_pipe[1], STDERR_FILENO);
+		if (!working_dir.empty() && chdir(working_dir.c_str()) != 0)
+			_exit(127);
+		execvp(argv[0], argv.data());
+		_exit(127);
+	}
+
+	if (out_pipe[1] >= 0)
+		close(out_pipe[1]);
+	if (err_pipe[1] >= 0)
+		close(err_pipe[1]);
+	// the child has its own copies, the reader of a pipe only sees EOF once ours are closed too
+	Close_Passed_Fds();
+	Output_Stream streams[2];
+	streams[0].fd = out_pipe[0];
+	streams[0].callback = &stdout_callback;
+	streams[1].fd = err_pipe[0];
+	streams[1].callback = &stderr_callback;
+
+	if (pid < 0) {
+		LOGERR("twrpExec: fork failed: %s\n", strerror(errno));
+		for (int i = 0; i < 2; i++) {
+			if (streams[i].fd >= 0)
+				close(streams[i].fd);
+		}
+	} else {
+		// the child does the same, whichever runs first wins
+		setpgid(pid, pid);
+
+		for (;;) {
+			struct pollfd fds[2];
+			int nfds = 0;
+			for (int i = 0; i < 2; i++) {
+				if (streams[i].fd >= 0) {
+					fds[nfds].fd = streams[i].fd;
+					fds[nfds].events = POLLIN;
+					fds[nfds].revents = 0;
+					nfds++;
+				}
+			}
+			if (nfds == 0)
+				break;
+			if (poll(fds, nfds, EXEC_POLL_MS) > 0) {
+				for (int i = 0; i < nfds; i++) {
+					if (!fds[i].revents)
+						continue;
+					Output_Stream* stream = fds[i].fd == streams[0].fd ? &streams[0] : &streams[1];
+					if (!Read_Stream(stream)) {
+						Flush_Stream(stream);
+						close(stream->fd);
+						stream->fd = -1;
+					}
+				}
+			}
+			Check_Stop(Now_Ms());
+		}
+
+		// the output is closed, wait for the exit without reaping so /proc/<pid>/io can still be read
+		for (;;) {
+			siginfo_t info;
+			memset(&info, 0, sizeof(info));
+			if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid == pid)
+				break;
+			Check_Stop(Now_Ms());
+			usleep(10 * 1000);
+		}
+		Read_Proc_Io();
+
+		int status = 0;
+		struct rusage usage;
+		memset(&usage, 0, sizeof(usage));
+		if (wait4(pid, &status, 0, &usage) == pid) {
+			if (WIFEXITED(status))
+				stats.exit_status = WEXITSTATUS(status);
+			else if (WIFSIGNALED(status))
+				stats.signal = WTERMSIG(status);
+			stats.user_ms = Timeval_Ms(usage.ru_utime);
+			stats.system_ms = Timeval_Ms(usage.ru_stime);
+			stats.max_rss_kb = usage.ru_maxrss;
+		}
+	}
+	stats.elapsed_ms = Now_Ms() - start_ms;
+	stats.cancelled = cancel_requested;
+	cancel_requested = false;
+	pid = -1;
+
+	pthread_mutex_lock(&running_lock);
+	running.erase(std::remove(running.begin(), running.end(), this), running.end());
+	pthread_mutex_unlock(&running_lock);
+
+	Report();
+	return stats.exit_status == 0 && !stats.timed_out && !stats.cancelled ? 0 : -1;
+}
+
+bool twrpExec::Read_Stream(Output_Stream* stream) {
+	char buffer[4096];
+	ssize_t len = read(stream->fd, buffer, sizeof(buffer));
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN;
+	if (len == 0)
+		return false;
+
+	// progress bars redraw with a carriage return, treat it as the end of a line
+	for (ssize_t i = 0; i < len; i++) {
+		if (buffer[i] == '\n' || buffer[i] == '\r') {
+			if (!stream->partial.empty())
+				Dispatch_Line(stream, stream->partial);
+			stream->partial.clear();
+		} else {
+			stream->partial += buffer[i];
+		}
+	}
+	return true;
+}
+
+void twrpExec::Flush_Stream(Output_Stream* stream) {
+	if (!stream->partial.empty())
+		Dispatch_Line(stream, stream->partial);
+	stream->partial.clear();
+}
+
+void twrpExec::Dispatch_Line(Output_Stream* stream, const std::string& line) {
+	if (progress_parser) {
+		float progress = progress_parser(line);
+		if (progress >= 0) {
+#ifndef BUILD_TWRPTAR_MAIN
+			DataManager::SetProgress(progress > 1 ? 1 : progress);
+#endif
+			return;
+		}
+	}
+	if (*stream->callback)
+		(*stream->callback)(line);
+	else
+		LOGINFO("%s\n", line.c_str());
+}
+
+// Sends SIGTERM once the run was cancelled or timed out, and SIGKILL if that did not do it
+void twrpExec::Check_Stop(unsigned long long now_ms) {
+	if (term_sent_ms == 0) {
+		if (timeout_ms > 0 && now_ms - start_ms >= (unsigned long long)timeout_ms) {
+			LOGERR("%s took too long, killing process\n", args[0].c_str());
+			stats.timed_out = true;
+		} else if (!cancel_requested) {
+			return;
+		}
+		kill(-pid, SIGTERM);
+		term_sent_ms = now_ms;
+	} else if (!kill_sent && now_ms - term_sent_ms >= EXEC_KILL_GRACE_MS) {
+		LOGINFO("%s did not stop, sending SIGKILL\n", args[0].c_str());
+		kill(-pid, SIGKILL);
+		kill_sent = true;
+	}
+}
+
+void twrpExec::Read_Proc_Io() {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/io", pid);
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return;
+	char line[128];
+	unsigned long long value;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "read_bytes: %llu", &value) == 1)
+			stats.read_bytes = value;
+		else if (sscanf(line, "write_bytes: %llu", &value) == 1)
+			stats.write_bytes = value;
+	}
+	fclose(fp);
+}
+
+void twrpExec::Report() {
+	std::string name = TWFunc::Get_Filename(args[0]);
+	LOGINFO("%s: exit %d, %llums (user %llums, sys %llums), max rss %ldKB, read %lluKB, written %lluKB\n",
+		name.c_str(), stats.signal ? -stats.signal : stats.exit_status, stats.elapsed_ms, stats.user_ms, stats.system_ms,
+		stats.max_rss_kb, stats.read_bytes / 1024ULL, stats.write_bytes / 1024ULL);
+
+	if (stats.cancelled) {
+		LOGINFO("%s was cancelled\n", name.c_str());
+	} else if (!show_errors || stats.timed_out) {
+		return;
+	} else if (stats.signal) {
+		gui_msg(Msg(msg::kError, "pid_signal={1} process ended with signal: {2}")(name)(stats.signal));
+	} else if (stats.exit_status != 0) {
+		gui_msg(Msg(msg::kError, "pid_error={1} process ended with ERROR: {2}")(name)(stats.exit_status));
+	}
+}
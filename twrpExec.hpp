@@ -0,0 +1,114 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TWRPEXEC_HPP
+#define __TWRPEXEC_HPP
+
+#include <sys/types.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define EXEC_POLL_MS 100
+#define EXEC_KILL_GRACE_MS 3000
+
+// What a finished child cost, filled in by twrpExec::Run()
+struct twrpExec_Stats {
+	int exit_status;                                                        // -1 if the child did not exit normally
+	int signal;                                                             // signal that ended the child, 0 if none
+	bool timed_out;
+	bool cancelled;
+	unsigned long long elapsed_ms;
+	unsigned long long user_ms;
+	unsigned long long system_ms;
+	long max_rss_kb;
+	unsigned long long read_bytes;                                          // bytes fetched from storage, from /proc/<pid>/io
+	unsigned long long write_bytes;
+};
+
+// Runs a program from an argument list, without a shell in between. Output of
+// the child can be handed to callbacks line by line, and a progress parser can
+// turn lines into the progress bar. A run can be given a timeout and can be
+// cancelled from another thread, in both cases the whole process group of the
+// child is sent SIGTERM and, if it is still around after a grace period, SIGKILL.
+//
+// Streams without a callback or parser are inherited, so they end up in the log
+// like they did with TWFunc::Exec_Cmd(). Stdin is /dev/null unless a fd is given,
+// and two runs can be chained by handing the ends of a pipe to them.
+class twrpExec
+{
+public:
+	typedef std::function<void(const std::string& line)> Line_Callback;
+	typedef std::function<float(const std::string& line)> Progress_Parser;    // returns 0 to 1, or a negative value if the line has no progress
+
+	twrpExec(const std::vector<std::string>& args);
+	~twrpExec();
+
+	void Set_Working_Dir(const std::string& dir) { working_dir = dir; }
+	void Set_Stdout_Callback(const Line_Callback& callback) { stdout_callback = callback; }
+	void Set_Stderr_Callback(const Line_Callback& callback) { stderr_callback = callback; }
+	void Set_Progress_Parser(const Progress_Parser& parser) { progress_parser = parser; }   // Results are passed to DataManager::SetProgress
+	void Set_Stdin_Fd(int fd) { stdin_fd = fd; }                            // The child reads fd, Run() closes it once the child is started
+	void Set_Stdout_Fd(int fd) { stdout_fd = fd; }                          // The child writes to fd instead of the stdout callback, closed like stdin_fd
+	void Set_Timeout(int ms) { timeout_ms = ms; }                           // 0 waits forever, the default
+	void Show_Errors(bool show) { show_errors = show; }                     // Displays a failed run in the GUI, true by default
+
+	// Runs the program and waits for it, calling the callbacks on this thread.
+	// Returns 0 if it exited with 0, -1 otherwise, like TWFunc::Exec_Cmd().
+	int Run();
+	void Cancel();                                                          // Stops Run() on another thread, safe to call at any time
+	const twrpExec_Stats& Get_Stats() { return stats; }
+	std::string Get_Command();                                              // The argument list joined for logging
+
+	static void Cancel_All();                                               // Cancels every run in progress
+
+private:
+	struct Output_Stream {
+		int fd;
+		std::string partial;
+		Line_Callback* callback;
+	};
+
+	bool Read_Stream(Output_Stream* stream);
+	void Flush_Stream(Output_Stream* stream);
+	void Dispatch_Line(Output_Stream* stream, const std::string& line);
+	void Check_Stop(unsigned long long now_ms);
+	void Read_Proc_Io();
+	void Report();
+	void Close_Passed_Fds();
+
+	std::vector<std::string> args;
+	std::string working_dir;
+	Line_Callback stdout_callback;
+	Line_Callback stderr_callback;
+	Progress_Parser progress_parser;
+	int stdin_fd;
+	int stdout_fd;
+	int timeout_ms;
+	bool show_errors;
+
+	pid_t pid;
+	std::atomic<bool> cancel_requested;
+	unsigned long long start_ms;
+	unsigned long long term_sent_ms;                                        // 0 until the child was asked to stop
+	bool kill_sent;
+	twrpExec_Stats stats;
+};
+
+#endif // __TWRPEXEC_HPP
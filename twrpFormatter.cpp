@@ -0,0 +1,113 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "twrpFormatter.hpp"
+#include "twcommon.h"
+#include "twrp-functions.hpp"
+
+twrpFormatter::twrpFormatter(const std::string& block_device, unsigned long long size) {
+	this->block_device = block_device;
+	// discard ranges have to be sector aligned, the filesystem is made of 4k blocks anyway
+	this->size = size & ~4095ULL;
+	fd = -1;
+	discarded = false;
+	done = 0;
+	failed = false;
+	unsupported = false;
+}
+
+bool twrpFormatter::Discard(ProgressTracking* progress) {
+	timespec start, stop;
+
+	discarded = false;
+	if (size == 0)
+		return false;
+	fd = open(block_device.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		LOGINFO("Unable to open '%s' for discard: %s\n", block_device.c_str(), strerror(errno));
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	done = 0;
+	failed = false;
+	unsupported = false;
+
+	unsigned long long chunks = (size + FORMATTER_DISCARD_CHUNK - 1) / FORMATTER_DISCARD_CHUNK;
+	TWWorkQueue queue(chunks < FORMATTER_MAX_THREADS ? chunks : FORMATTER_MAX_THREADS);
+	// the last range is queued first, so the device is discarded from the start
+	for (unsigned long long i = chunks; i-- > 0;) {
+		unsigned long long offset = i * FORMATTER_DISCARD_CHUNK;
+		queue.Add([this, offset]() { Discard_Range(offset); });
+	}
+	size_t thread_count;
+	if (progress)
+		thread_count = queue.Run([this, progress]() { progress->UpdateSize(done.load()); });
+	else
+		thread_count = queue.Run();
+	close(fd);
+	fd = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	if (unsupported) {
+		LOGINFO("'%s' does not support discard\n", block_device.c_str());
+		return false;
+	}
+	if (failed) {
+		LOGINFO("Discard of '%s' failed after %llu bytes\n", block_device.c_str(), done.load());
+		return false;
+	}
+	if (progress)
+		progress->UpdateSize(size);
+	LOGINFO("Discarded %lluMB of '%s' on %zu threads in %dms\n", size / 1048576, block_device.c_str(),
+		thread_count, TWFunc::timespec_diff_ms(start, stop));
+	discarded = true;
+	return true;
+}
+
+void twrpFormatter::Discard_Range(unsigned long long offset) {
+	if (failed || unsupported)
+		return;
+	uint64_t range[2];
+	range[0] = offset;
+	range[1] = size - offset < FORMATTER_DISCARD_CHUNK ? size - offset : FORMATTER_DISCARD_CHUNK;
+	if (ioctl(fd, BLKDISCARD, &range) != 0) {
+		if (errno == EOPNOTSUPP || errno == ENOTTY)
+			unsupported = true;
+		else
+			failed = true;
+		return;
+	}
+	done += range[1];
+}
+
+std::string twrpFormatter::Ext4_Options() {
+	return discarded ? " -E nodiscard" : "";
+}
+
+std::string twrpFormatter::F2fs_Options() {
+	return discarded ? " -t 0" : "";
+}
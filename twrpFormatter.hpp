@@ -0,0 +1,59 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TWRPFORMATTER_HPP
+#define __TWRPFORMATTER_HPP
+
+#include <atomic>
+#include <string>
+#include "progresstracking.hpp"
+
+#define FORMATTER_MAX_THREADS 4
+#define FORMATTER_DISCARD_CHUNK (1024ULL * 1024ULL * 1024ULL)
+
+// Prepares a block device for a new filesystem. The device is discarded up
+// front in large ranges on several threads, so the mkfs tools can be told to
+// skip their own discard pass, which covers the whole device in one go and
+// gives no progress.
+class twrpFormatter
+{
+public:
+	twrpFormatter(const std::string& block_device, unsigned long long size);
+
+	// Discards the first size bytes of the device, reporting the bytes done to progress
+	// if it is set. Returns false if the device does not support discard or any range
+	// failed, in which case the mkfs tools should do their own discard.
+	bool Discard(ProgressTracking* progress);
+	bool Is_Discarded() { return discarded; }
+	std::string Ext4_Options();                                             // Extra mke2fs options for the state of the device
+	std::string F2fs_Options();                                             // Extra mkfs.f2fs options for the state of the device
+
+private:
+	void Discard_Range(unsigned long long offset);
+
+	std::string block_device;
+	unsigned long long size;
+	int fd;
+	bool discarded;
+
+	std::atomic<unsigned long long> done;
+	std::atomic<bool> failed;
+	std::atomic<bool> unsupported;
+};
+
+#endif // __TWRPFORMATTER_HPP
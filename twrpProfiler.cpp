@@ -0,0 +1,177 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "twrpProfiler.hpp"
+#include "twcommon.h"
+#include "data.hpp"
+
+#define PROFILER_MAX_EVENTS 4096
+
+struct Profiler_Event {
+	std::string name;
+	unsigned long long start;                                                // microseconds since boot
+	unsigned long long duration;
+	pid_t tid;
+	int depth;
+	bool instant;
+	bool ended;
+};
+
+static pthread_mutex_t profiler_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<Profiler_Event> profiler_events;
+static bool profiler_finished = false;
+static thread_local std::vector<size_t> profiler_stack;                      // open phases of this thread, as indexes into profiler_events
+
+static unsigned long long Now_Us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void Add_Event(const std::string& name, bool instant) {
+	unsigned long long now = Now_Us();
+	pthread_mutex_lock(&profiler_lock);
+	if (profiler_finished || profiler_events.size() >= PROFILER_MAX_EVENTS) {
+		pthread_mutex_unlock(&profiler_lock);
+		if (!instant)
+			profiler_stack.push_back((size_t)-1);                            // keep Begin and End paired
+		return;
+	}
+	Profiler_Event event;
+	event.name = name;
+	event.start = now;
+	event.duration = 0;
+	event.tid = syscall(SYS_gettid);
+	event.depth = profiler_stack.size();
+	event.instant = instant;
+	event.ended = instant;
+	if (!instant)
+		profiler_stack.push_back(profiler_events.size());
+	profiler_events.push_back(event);
+	pthread_mutex_unlock(&profiler_lock);
+}
+
+void twrpProfiler::Begin(const std::string& name) {
+	Add_Event(name, false);
+}
+
+void twrpProfiler::End() {
+	unsigned long long now = Now_Us();
+	if (profiler_stack.empty())
+		return;
+	size_t index = profiler_stack.back();
+	profiler_stack.pop_back();
+	if (index == (size_t)-1)
+		return;
+	pthread_mutex_lock(&profiler_lock);
+	if (!profiler_finished) {
+		profiler_events[index].duration = now - profiler_events[index].start;
+		profiler_events[index].ended = true;
+	}
+	pthread_mutex_unlock(&profiler_lock);
+}
+
+void twrpProfiler::Mark(const std::string& name) {
+	Add_Event(name, true);
+}
+
+static std::string Json_Escape(const std::string& str) {
+	std::string ret;
+	for (size_t i = 0; i < str.size(); i++) {
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			ret += buf;
+		} else
+			ret += c;
+	}
+	return ret;
+}
+
+void twrpProfiler::Finish(const std::string& trace_file) {
+	Mark("gui");
+	unsigned long long now = Now_Us();
+
+	pthread_mutex_lock(&profiler_lock);
+	if (profiler_finished) {
+		pthread_mutex_unlock(&profiler_lock);
+		return;
+	}
+	profiler_finished = true;
+	// phases still open, like the thread that called Finish, end here
+	for (size_t i = 0; i < profiler_events.size(); i++) {
+		if (!profiler_events[i].ended)
+			profiler_events[i].duration = now - profiler_events[i].start;
+	}
+	pthread_mutex_unlock(&profiler_lock);
+
+	DataManager::SetValue("of_boot_time_ms", (int)(now / 1000ULL));
+
+	FILE* fp = fopen(trace_file.c_str(), "w");
+	if (!fp) {
+		LOGINFO("Unable to write boot trace to '%s'\n", trace_file.c_str());
+		return;
+	}
+	pid_t pid = getpid();
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (size_t i = 0; i < profiler_events.size(); i++) {
+		const Profiler_Event& event = profiler_events[i];
+		if (event.instant)
+			fprintf(fp, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%llu,\"pid\":%d,\"tid\":%d}",
+				Json_Escape(event.name).c_str(), event.start, pid, event.tid);
+		else
+			fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d}",
+				Json_Escape(event.name).c_str(), event.start, event.duration, pid, event.tid);
+		fprintf(fp, "%s\n", i + 1 < profiler_events.size() ? "," : "");
+	}
+	fprintf(fp, "]}\n");
+	fclose(fp);
+	LOGINFO("Boot to GUI took %llums, trace written to '%s'\n", now / 1000ULL, trace_file.c_str());
+}
+
+void twrpProfiler::Print_Summary() {
+	pthread_mutex_lock(&profiler_lock);
+	std::vector<Profiler_Event> events(profiler_events);
+	pthread_mutex_unlock(&profiler_lock);
+
+	if (events.empty())
+		return;
+	pid_t main_tid = events[0].tid;
+	gui_print("Startup timeline (ms since boot):\n");
+	for (size_t i = 0; i < events.size(); i++) {
+		const Profiler_Event& event = events[i];
+		std::string indent(event.depth * 2, ' ');
+		const char* thread = event.tid == main_tid ? "" : " (thread)";
+		if (event.instant)
+			gui_print("%8.1f  %s* %s%s\n", event.start / 1000.0, indent.c_str(), event.name.c_str(), thread);
+		else
+			gui_print("%8.1f  %s%s: %.1fms%s\n", event.start / 1000.0, indent.c_str(), event.name.c_str(), event.duration / 1000.0, thread);
+	}
+}
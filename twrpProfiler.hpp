@@ -0,0 +1,47 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TWRPPROFILER_HPP
+#define __TWRPPROFILER_HPP
+
+#include <string>
+
+#define BOOT_TRACE_FILE "/tmp/recovery_boot_trace.json"
+
+// Records how long the phases of recovery startup take. Phases nest per thread
+// and are kept until Finish(), which writes them out as a Chrome trace
+// (chrome://tracing or ui.perfetto.dev) and stops recording.
+class twrpProfiler
+{
+public:
+	static void Begin(const std::string& name);                             // Starts a phase, nested in the current phase of this thread
+	static void End();                                                      // Ends the current phase of this thread
+	static void Mark(const std::string& name);                              // Records a point in time
+	static void Finish(const std::string& trace_file);                      // Stops recording, writes the trace and sets of_boot_time_ms
+	static void Print_Summary();                                            // Prints the recorded phases to the console
+};
+
+// Times the enclosing scope as one phase
+class twrpProfilerScope
+{
+public:
+	twrpProfilerScope(const std::string& name) { twrpProfiler::Begin(name); }
+	~twrpProfilerScope() { twrpProfiler::End(); }
+};
+
+#endif // __TWRPPROFILER_HPP
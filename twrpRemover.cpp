@@ -0,0 +1,178 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "twrpRemover.hpp"
+#include "twcommon.h"
+#include "data.hpp"
+#include "twrp-functions.hpp"
+#include "gui/gui.hpp"
+
+twrpRemover::twrpRemover() {
+	work = NULL;
+	exclusions = NULL;
+	show_progress = false;
+	root_opened = false;
+	removed = 0;
+	errors = 0;
+}
+
+twrpRemover::~twrpRemover() {
+}
+
+bool twrpRemover::Remove(const std::string& path, bool keep_root, TWExclude* exclude) {
+	Dir_Item* root = new Dir_Item;
+	root->parent = NULL;
+	root->name = path;
+	while (root->name.size() > 1 && root->name[root->name.size() - 1] == '/')
+		root->name.erase(root->name.size() - 1);
+	root->fd = -1;
+	if (exclude)
+		root->excluded = exclude->get_absolute_dirs_below(root->name);
+	root->pending = 1;
+	root->keep = false;
+	root->remove = !keep_root;
+
+	exclusions = exclude;
+	root_opened = false;
+	removed = 0;
+	errors = 0;
+	TWWorkQueue queue(TWWorkQueue::Cpu_Threads(REMOVER_MAX_THREADS));
+	work = &queue;
+	Queue(root);
+	if (show_progress) {
+		queue.Run([this]() {
+			DataManager::SetValue("tw_file_progress", std::to_string(removed.load()) + " files removed");
+		});
+	} else {
+		queue.Run();
+	}
+	work = NULL;
+
+	if (show_progress)
+		DataManager::SetValue("tw_file_progress", "");
+	LOGINFO("Removed %llu files under '%s'\n", removed.load(), path.c_str());
+	return errors == 0;
+}
+
+void twrpRemover::Queue(Dir_Item* dir) {
+	work->Add([this, dir]() { Scan(dir); });
+}
+
+void twrpRemover::Scan(Dir_Item* dir) {
+	int parent_fd = dir->parent ? dir->parent->fd : AT_FDCWD;
+	dir->fd = openat(parent_fd, dir->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	// readdir gets its own fd, dir->fd stays open for the subdirectories
+	int dir_fd = dir->fd < 0 ? -1 : fcntl(dir->fd, F_DUPFD_CLOEXEC, 0);
+	DIR* d = dir_fd < 0 ? NULL : fdopendir(dir_fd);
+	if (d == NULL) {
+		if (dir->parent == NULL)
+			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(dir->name)(strerror(errno)));
+		else
+			LOGINFO("Unable to open '%s': %s\n", Get_Path(dir).c_str(), strerror(errno));
+		if (dir_fd >= 0)
+			close(dir_fd);
+		errors++;
+		dir->keep = true;
+		Release(dir);
+		return;
+	}
+	if (dir->parent == NULL)
+		root_opened = true;
+
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		if (exclusions && (exclusions->check_relative_skip_dirs(de->d_name) ||
+				std::find(dir->excluded.begin(), dir->excluded.end(), de->d_name) != dir->excluded.end())) {
+			LOGINFO("skipped '%s'\n", Get_Path(dir, de->d_name).c_str());
+			dir->keep = true;
+			continue;
+		}
+
+		unsigned char type = de->d_type;
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+			if (fstatat(dir->fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+				type = DT_DIR;
+		}
+
+		if (type == DT_DIR) {
+			Dir_Item* child = new Dir_Item;
+			child->parent = dir;
+			child->name = de->d_name;
+			child->fd = -1;
+			if (!dir->excluded.empty()) {
+				std::string prefix = child->name + "/";
+				for (size_t i = 0; i < dir->excluded.size(); i++) {
+					if (dir->excluded[i].compare(0, prefix.size(), prefix) == 0)
+						child->excluded.push_back(dir->excluded[i].substr(prefix.size()));
+				}
+			}
+			child->pending = 1;
+			child->keep = false;
+			child->remove = true;
+			dir->pending++;
+			Queue(child);
+		} else if (unlinkat(dir->fd, de->d_name, 0) == 0) {
+			removed++;
+		} else {
+			LOGINFO("Unable to unlink '%s': %s\n", Get_Path(dir, de->d_name).c_str(), strerror(errno));
+			errors++;
+			dir->keep = true;
+		}
+	}
+	closedir(d);
+	Release(dir);
+}
+
+void twrpRemover::Release(Dir_Item* dir) {
+	while (dir && --dir->pending == 0) {
+		Dir_Item* parent = dir->parent;
+		if (dir->fd >= 0)
+			close(dir->fd);
+		if (dir->keep) {
+			if (parent)
+				parent->keep = true;
+		} else if (dir->remove && unlinkat(parent ? parent->fd : AT_FDCWD, dir->name.c_str(), AT_REMOVEDIR) != 0) {
+			LOGINFO("Unable to remove '%s': %s\n", Get_Path(dir).c_str(), strerror(errno));
+			errors++;
+			if (parent)
+				parent->keep = true;
+		}
+		delete dir;
+		dir = parent;
+	}
+}
+
+// Parents outlive their subdirectories, so the chain up to the root is still there
+std::string twrpRemover::Get_Path(Dir_Item* dir, const char* name) {
+	std::string path = dir->parent ? Get_Path(dir->parent, dir->name.c_str()) : dir->name;
+	if (name)
+		path += "/" + std::string(name);
+	return path;
+}
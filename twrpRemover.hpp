@@ -0,0 +1,74 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TWRPREMOVER_HPP
+#define __TWRPREMOVER_HPP
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "exclude.hpp"
+
+class TWWorkQueue;
+
+#define REMOVER_MAX_THREADS 8
+
+// Deletes a directory tree on several threads. Every directory is one work
+// item: a worker opens it relative to the fd of its parent, unlinks its files
+// relative to its own fd and queues its subdirectories. A directory keeps its
+// fd open until all of its subdirectories are gone and is then removed from
+// its parent, so no path is built for any entry below the root.
+class twrpRemover
+{
+public:
+	twrpRemover();
+	~twrpRemover();
+
+	// Removes everything below path, and path itself unless keep_root is set. Entries
+	// matching exclusions are left alone, along with the directories containing them.
+	// Returns false if anything that was not excluded could not be removed.
+	bool Remove(const std::string& path, bool keep_root, TWExclude* exclusions = NULL);
+	void Show_Progress(bool show) { show_progress = show; }                 // Reports the number of removed files in tw_file_progress
+	unsigned long long Get_Removed_Count() { return removed.load(); }
+	bool Root_Opened() { return root_opened; }                              // false if Remove() could not even open path
+
+private:
+	struct Dir_Item {
+		Dir_Item* parent;
+		std::string name;                                                   // relative to the parent, the full path for the root
+		int fd;                                                             // open from its scan until it is removed
+		std::vector<std::string> excluded;                                  // absolute exclusions below it, relative to it
+		std::atomic<int> pending;                                           // its own scan plus every subdirectory not yet removed
+		std::atomic<bool> keep;                                             // something below was excluded or could not be removed
+		bool remove;
+	};
+
+	void Queue(Dir_Item* dir);
+	void Scan(Dir_Item* dir);
+	void Release(Dir_Item* dir);
+	std::string Get_Path(Dir_Item* dir, const char* name = NULL);          // only for messages
+
+	TWWorkQueue* work;                                                      // set while Remove() runs
+	TWExclude* exclusions;
+	bool show_progress;
+	bool root_opened;
+	std::atomic<unsigned long long> removed;
+	std::atomic<unsigned long long> errors;
+};
+
+#endif // __TWRPREMOVER_HPP
@@ -26,6 +26,7 @@ extern "C" {
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <fstream>
@@ -45,6 +46,7 @@ extern "C" {
 #include "variables.h"
 #include "adbbu/libtwadbbu.hpp"
 #include "twrp-functions.hpp"
+#include "twrpExec.hpp"
 #include "gui/gui.hpp"
 #include "progresstracking.hpp"
 
@@ -1474,31 +1476,30 @@ unsigned long long twrpTar::get_size() {
 	return 0;
 }
 
+// pigz -l prints a header line, then "<compressed> <original> <reduced> <name>"
+static void Parse_Pigz_List(const string& line, unsigned long long* size) {
+	vector<string> split = TWFunc::split_string(line, ' ', true);
+	if (split.size() > 1 && isdigit((unsigned char)split[0][0]) && isdigit((unsigned char)split[1][0]))
+		*size = strtoull(split[1].c_str(), NULL, 10);
+}
+
+static void* Exec_Thread(void* cookie) {
+	((twrpExec*)cookie)->Run();
+	return NULL;
+}
+
 unsigned long long twrpTar::uncompressedSize(string filename) {
 	unsigned long long total_size = 0;
-	string Tar, Command, result;
-	vector<string> split;
 
 	Set_Archive_Type(TWFunc::Get_File_Type(tarfn));
 	if (current_archive_type == UNCOMPRESSED) {
 		total_size = TWFunc::Get_File_Size(filename);
 	} else if (current_archive_type == COMPRESSED) {
 		// Compressed
-		Command = "pigz -l '" + filename + "'";
-		/* if we set Command = "pigz -l " + tarfn + " | sed '1d' | cut -f5 -d' '";
-		we get the uncompressed size at once. */
-		TWFunc::Exec_Cmd(Command, result, false);
-		if (!result.empty()) {
-			/* Expected output:
-			compressed original  reduced name
-			95855838   179403776 -1.3%   data.yaffs2.win
-			^
-			split[5]
-			*/
-			split = TWFunc::split_string(result, ' ', true);
-			if (split.size() > 4)
-				total_size = atoi(split[5].c_str());
-		}
+		twrpExec pigz({"pigz", "-l", filename});
+		pigz.Set_Stdout_Callback([&total_size](const string& line) { Parse_Pigz_List(line, &total_size); });
+		pigz.Show_Errors(false);
+		pigz.Run();
 	} else if (current_archive_type == COMPRESSED_ENCRYPTED) {
 		// File is encrypted and may be compressed
 		int ret = TWFunc::Try_Decrypting_File(filename, password);
@@ -1509,22 +1510,28 @@ unsigned long long twrpTar::uncompressedSize(string filename) {
 			LOGERR("Decrypted file is not in tar format.\n");
 			total_size = TWFunc::Get_File_Size(filename);
 		} else if (ret == 3) {
-			Command = "openaes dec --key \"" + password + "\" --in '" + filename + "' | pigz -l";
-			/* if we set Command = "pigz -l " + tarfn + " | sed '1d' | cut -f5 -d' '";
-			we get the uncompressed size at once. */
-			TWFunc::Exec_Cmd(Command, result, false);
-			if (!result.empty()) {
-				LOGINFO("result was: '%s'\n", result.c_str());
-				/* Expected output:
-				compressed original  reduced name
-				95855838   179403776 -1.3%   data.yaffs2.win
-				^
-				split[5]
-				*/
-				split = TWFunc::split_string(result, ' ', true);
-				if (split.size() > 4)
-					total_size = atoi(split[5].c_str());
+			// openaes decrypts into a pipe that pigz lists, the password never goes through a shell
+			int oaesfd[2];
+			if (pipe2(oaesfd, O_CLOEXEC) < 0) {
+				LOGINFO("Error creating pipe for openaes: %s\n", strerror(errno));
+				return TWFunc::Get_File_Size(filename);
+			}
+			twrpExec openaes({"openaes", "dec", "--key", password, "--in", filename});
+			openaes.Set_Stdout_Fd(oaesfd[1]);
+			openaes.Show_Errors(false);
+			twrpExec pigz({"pigz", "-l"});
+			pigz.Set_Stdin_Fd(oaesfd[0]);
+			pigz.Set_Stdout_Callback([&total_size](const string& line) { Parse_Pigz_List(line, &total_size); });
+			pigz.Show_Errors(false);
+
+			pthread_t openaes_thread;
+			if (pthread_create(&openaes_thread, NULL, Exec_Thread, &openaes) != 0) {
+				LOGINFO("Unable to start openaes thread\n");
+				return TWFunc::Get_File_Size(filename);
 			}
+			pigz.Run();
+			pthread_join(openaes_thread, NULL);
+			LOGINFO("uncompressed size of '%s': %llu\n", filename.c_str(), total_size);
 		} else {
 			total_size = TWFunc::Get_File_Size(filename);
 		}
@@ -7,6 +7,7 @@ LOCAL_SRC_FILES:= \
 	twrpTarMain.cpp \
 	../twrp-functions.cpp \
 	../twrpTar.cpp \
+	../twrpExec.cpp \
 	../tarWrite.c \
 	../exclude.cpp \
 	../progresstracking.cpp \
@@ -49,6 +50,7 @@ LOCAL_SRC_FILES:= \
 	twrpTarMain.cpp \
 	../twrp-functions.cpp \
 	../twrpTar.cpp \
+	../twrpExec.cpp \
 	../tarWrite.c \
 	../exclude.cpp \
 	../progresstracking.cpp \
@@ -0,0 +1,178 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+
+#include "twrpWarmup.hpp"
+#include "twcommon.h"
+#include "data.hpp"
+#include "partitions.hpp"
+#include "twrp-functions.hpp"
+#include "variables.h"
+
+static pthread_mutex_t warmup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warmup_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t warmup_join_lock = PTHREAD_MUTEX_INITIALIZER;         // a second Stop() waits for the first one to join
+static pthread_t warmup_thread;
+static bool warmup_running = false;                                         // warmup_thread still has to be joined
+static std::atomic<bool> warmup_stop(false);
+static std::string warmup_backups_folder;
+
+// Gives the GUI a moment to draw its first page, returns false if Stop() came first
+static bool Wait_For_Idle() {
+	struct timespec timeout;
+	clock_gettime(CLOCK_REALTIME, &timeout);
+	timeout.tv_sec += WARMUP_IDLE_DELAY_MS / 1000;
+	timeout.tv_nsec += (WARMUP_IDLE_DELAY_MS % 1000) * 1000000L;
+	if (timeout.tv_nsec >= 1000000000L) {
+		timeout.tv_sec++;
+		timeout.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&warmup_lock);
+	while (!warmup_stop.load()) {
+		if (pthread_cond_timedwait(&warmup_cond, &warmup_lock, &timeout) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&warmup_lock);
+	return !warmup_stop.load();
+}
+
+static bool Read_File(int dir_fd, const char* name) {
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return false;
+	char buffer[4096];
+	ssize_t len, total = 0;
+	while (total < WARMUP_MAX_INFO_SIZE && (len = read(fd, buffer, sizeof(buffer))) > 0)
+		total += len;
+	close(fd);
+	return true;
+}
+
+// Stats everything in one backup, so opening it on the restore page does not go to
+// the storage for each entry, and reads the .info files the restore page loads
+static int Warm_Backup(int parent_fd, const char* name) {
+	int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	DIR* d = fd < 0 ? NULL : fdopendir(fd);
+	if (d == NULL) {
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	int info_files = 0;
+	struct dirent* de;
+	while (!warmup_stop.load() && (de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		struct stat st;
+		if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		size_t len = strlen(de->d_name);
+		if (len > 5 && strcmp(de->d_name + len - 5, ".info") == 0 && Read_File(fd, de->d_name))
+			info_files++;
+	}
+	closedir(d);
+	return info_files;
+}
+
+static void Warm_Backups_Folder(const std::string& folder) {
+	int fd = open(folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR* d = fd < 0 ? NULL : fdopendir(fd);
+	if (d == NULL) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	int backups = 0, info_files = 0;
+	struct dirent* de;
+	while (!warmup_stop.load() && (de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+			continue;
+		info_files += Warm_Backup(fd, de->d_name);
+		backups++;
+	}
+	closedir(d);
+	LOGINFO("Warm-up: read %i backups and %i info files in '%s'\n", backups, info_files, folder.c_str());
+}
+
+static void* Warmup_Thread(void* cookie __unused) {
+	// whatever the user does in the meantime comes first
+	setpriority(PRIO_PROCESS, 0, 10);
+	if (!Wait_For_Idle())
+		return NULL;
+
+	timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!warmup_stop.load())
+		PartitionManager.Mount_Settings_Storage(false);
+	if (!warmup_stop.load())
+		PartitionManager.Mount_Current_Storage(false);
+	if (!warmup_stop.load() && !warmup_backups_folder.empty())
+		Warm_Backups_Folder(warmup_backups_folder);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	LOGINFO("Warm-up %s after %ims\n", warmup_stop.load() ? "stopped" : "done", TWFunc::timespec_diff_ms(start, stop));
+	return NULL;
+}
+
+void twrpWarmup::Start() {
+	pthread_mutex_lock(&warmup_lock);
+	if (warmup_running) {
+		pthread_mutex_unlock(&warmup_lock);
+		return;
+	}
+	// the variables are read here, the thread only touches the partitions
+	warmup_backups_folder = DataManager::GetStrValue(TW_BACKUPS_FOLDER_VAR);
+	warmup_stop.store(false);
+	if (pthread_create(&warmup_thread, NULL, Warmup_Thread, NULL) == 0)
+		warmup_running = true;
+	pthread_mutex_unlock(&warmup_lock);
+}
+
+void twrpWarmup::Stop() {
+	pthread_mutex_lock(&warmup_join_lock);
+	pthread_mutex_lock(&warmup_lock);
+	if (!warmup_running) {
+		pthread_mutex_unlock(&warmup_lock);
+		pthread_mutex_unlock(&warmup_join_lock);
+		return;
+	}
+	warmup_stop.store(true);
+	pthread_cond_broadcast(&warmup_cond);
+	pthread_mutex_unlock(&warmup_lock);
+
+	pthread_join(warmup_thread, NULL);
+
+	pthread_mutex_lock(&warmup_lock);
+	warmup_running = false;
+	pthread_mutex_unlock(&warmup_lock);
+	pthread_mutex_unlock(&warmup_join_lock);
+}
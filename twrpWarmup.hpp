@@ -0,0 +1,39 @@
+/*
+	Copyright 2020 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TWRPWARMUP_HPP
+#define __TWRPWARMUP_HPP
+
+#define WARMUP_IDLE_DELAY_MS 1000
+#define WARMUP_MAX_INFO_SIZE (64 * 1024)
+
+// Gets the storage the user is most likely to open next ready while the GUI is
+// idle after boot. A low priority thread mounts the settings and current storage,
+// walks the backup folder so its directory entries and inodes are cached, and
+// reads the .info file of every backed up partition.
+//
+// The partition code is not meant to be used from two threads at once, so
+// anything that mounts, unmounts or formats calls Stop() first.
+class twrpWarmup
+{
+public:
+	static void Start();                                                    // Starts the warm-up, called once the GUI is loaded
+	static void Stop();                                                     // Stops the warm-up and waits for it, returns at once if it is not running
+};
+
+#endif // __TWRPWARMUP_HPP
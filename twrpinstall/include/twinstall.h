@@ -1,7 +1,11 @@
 #ifndef RECOVERY_TWINSTALL_H_
 #define RECOVERY_TWINSTALL_H_
 
+#include <string>
+
 int TWinstall_zip(const char* path, int* wipe_cache, bool check_for_digest = false);
+void TWinstall_Queue_Next(const std::string& path, bool check_for_digest = false); // verify and read path in the background while the next TWinstall_zip runs its installer
+void TWinstall_Clear_Queue(); // drop the queued package and any prefetch in progress
 int TWinstall_Run_OTA_BAK (bool reportback); // run the MIUI OTA backup; set some values of reportback is true
 
 #endif  // RECOVERY_TWINSTALL_H_
@@ -0,0 +1,53 @@
+/*
+	Copyright (C) 2018-2022 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	This file is part of TWRP/TeamWin Recovery Project.
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECOVERY_TWINSTALL_INSTALL_QUEUE_H_
+#define RECOVERY_TWINSTALL_INSTALL_QUEUE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "package.h"
+#include "twinstall/verifier.h"
+#include "twrpDigest/twrpDigest.hpp"
+
+#define OTA_CERTIFICATE_ZIP_FILE "/system/etc/security/otacerts.zip"
+
+// A package that was opened and checked in the background while the previous
+// zip in the queue was being installed
+struct Prefetched_Package {
+	std::string path;
+	std::vector<Certificate> keys;          // the signature is checked against these, empty if it is not checked
+	std::unique_ptr<Package> package;
+	bool verified;                          // verify_result is valid
+	int verify_result;
+	std::unique_ptr<twrpDigest> digest;     // fed with the whole package, NULL if there was no digest file
+	bool use_sha2;
+};
+
+// Starts reading the package queued with TWinstall_Queue_Next() on a background
+// thread. Called once the current package is verified, right before its installer runs,
+// with the keys it was verified with. The keys are not loaded on the thread, as the
+// installer may mount something else on /system while it runs.
+void TWinstall_Start_Prefetch(std::vector<Certificate> keys);
+
+// Returns the prefetched package for path, waiting for it to finish if needed,
+// or NULL if path was not prefetched.
+std::unique_ptr<Prefetched_Package> TWinstall_Take_Prefetch(const std::string& path);
+
+#endif  // RECOVERY_TWINSTALL_INSTALL_QUEUE_H_
@@ -83,6 +83,14 @@ class VerifierInterface {
 int verify_file(VerifierInterface* package, const std::vector<Certificate>& keys,
                 const std::function<void(float)>& set_progress = nullptr);
 
+// Same as above, and also feeds every byte of the package, signed or not, to |extra_hashers|
+// from the same buffers used for the signature hashes. This lets a caller compute a whole-file
+// digest without reading the package a second time. The extra hashers have only seen the whole
+// package if VERIFY_SUCCESS is returned.
+int verify_file(VerifierInterface* package, const std::vector<Certificate>& keys,
+                const std::function<void(float)>& set_progress,
+                const std::vector<HasherUpdateCallback>& extra_hashers);
+
 // Checks that the RSA key has a modulus of 2048 or 4096 bits long, and public exponent is 3 or
 // 65537.
 bool CheckRSAKey(const std::unique_ptr<RSA, RSADeleter>& rsa);
@@ -0,0 +1,211 @@
+/*
+	Copyright (C) 2018-2022 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	This file is part of TWRP/TeamWin Recovery Project.
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// install_queue.cpp - Background preparation of the next zip in an install queue
+//
+// While the update-binary of one zip runs, the next queued zip is mapped,
+// its signature and digest are checked, its central directory is parsed and
+// its pages are pulled into the page cache. TWinstall_zip() then picks the
+// result up instead of doing all of that in the foreground.
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "twcommon.h"
+#include "twinstall.h"
+#include "twinstall/install_queue.h"
+#include "twinstall/verifier.h"
+#include "twrp-functions.hpp"
+#include "twrpDigestDriver.hpp"
+
+#define PREFETCH_CHUNK_SIZE (16 * MiB)
+#define PREFETCH_PAGE_SIZE 4096
+
+// Passes the package through to verify_file, but stops feeding the hashers once
+// the prefetch is cancelled so a large package does not hold up the caller
+class Prefetch_Verifier : public VerifierInterface {
+public:
+	Prefetch_Verifier(Package* package, std::atomic<bool>* cancel) : package_(package), cancel_(cancel) {}
+
+	uint64_t GetPackageSize() const override { return package_->GetPackageSize(); }
+	bool ReadFullyAtOffset(uint8_t* buffer, uint64_t byte_count, uint64_t offset) override {
+		return package_->ReadFullyAtOffset(buffer, byte_count, offset);
+	}
+	bool UpdateHashAtOffset(const std::vector<HasherUpdateCallback>& hashers, uint64_t start, uint64_t length) override {
+		if (cancel_->load())
+			return false;
+		return package_->UpdateHashAtOffset(hashers, start, length);
+	}
+	void SetProgress(float progress __unused) override {}
+
+private:
+	Package* package_;
+	std::atomic<bool>* cancel_;
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::string queued_path;
+static bool queued_check_digest = false;
+
+// owned by the prefetch thread until it is joined
+static pthread_t prefetch_thread;
+static bool prefetch_running = false;
+static bool prefetch_check_digest = false;
+static std::atomic<bool> prefetch_cancel(false);
+static Prefetched_Package* prefetch_result = NULL;
+
+static void Touch_Pages(const uint8_t* addr, uint64_t size) {
+	volatile uint8_t sink = 0;
+	for (uint64_t i = 0; i < size; i += PREFETCH_PAGE_SIZE)
+		sink ^= addr[i];
+}
+
+// Feeds the whole package to the hashers, returns false if it was cancelled or could not be read
+static bool Hash_Package(Prefetch_Verifier* verifier, const std::vector<HasherUpdateCallback>& hashers) {
+	uint64_t package_size = verifier->GetPackageSize();
+	uint64_t so_far = 0;
+	while (so_far < package_size) {
+		uint64_t read_size = std::min<uint64_t>(package_size - so_far, PREFETCH_CHUNK_SIZE);
+		if (!verifier->UpdateHashAtOffset(hashers, so_far, read_size))
+			return false;
+		so_far += read_size;
+	}
+	return true;
+}
+
+static void* Prefetch_Thread(void* cookie) {
+	Prefetched_Package* result = (Prefetched_Package*)cookie;
+
+	// the installer in the foreground comes first
+	setpriority(PRIO_PROCESS, 0, 10);
+
+	result->package = Package::CreateMemoryPackage(result->path);
+	if (!result->package) {
+		LOGINFO("Unable to prefetch '%s'\n", result->path.c_str());
+		return NULL;
+	}
+	Prefetch_Verifier verifier(result->package.get(), &prefetch_cancel);
+
+	std::vector<HasherUpdateCallback> digest_hashers;
+	if (prefetch_check_digest && result->path[0] != '@') {
+		if (!twrpDigestDriver::Find_Digest_File(result->path, result->use_sha2).empty()) {
+			result->digest.reset(twrpDigestDriver::New_Digest(result->use_sha2));
+			twrpDigest* digest = result->digest.get();
+			digest_hashers.emplace_back([digest](const uint8_t* addr, uint64_t size) { digest->update(addr, size); });
+		}
+	}
+
+	bool hashed = false;
+	if (!result->keys.empty()) {
+		result->verify_result = verify_file(&verifier, result->keys, nullptr, digest_hashers);
+		result->verified = true;
+		hashed = true;
+		// the digest only saw the whole package if the signature pass finished
+		if (result->verify_result != VERIFY_SUCCESS)
+			result->digest.reset();
+	}
+	if (!hashed) {
+		if (digest_hashers.empty())
+			digest_hashers.emplace_back(Touch_Pages);
+		if (!Hash_Package(&verifier, digest_hashers))
+			result->digest.reset();
+	}
+
+	// parse the central directory now, the installer looks up its entries first
+	result->package->GetZipArchiveHandle();
+
+	if (prefetch_cancel.load()) {
+		result->verified = false;
+		result->digest.reset();
+	}
+	return NULL;
+}
+
+// Called with queue_lock held
+static void Stop_Prefetch() {
+	if (!prefetch_running)
+		return;
+	prefetch_cancel.store(true);
+	pthread_join(prefetch_thread, NULL);
+	prefetch_running = false;
+	delete prefetch_result;
+	prefetch_result = NULL;
+}
+
+void TWinstall_Queue_Next(const std::string& path, bool check_for_digest) {
+	pthread_mutex_lock(&queue_lock);
+	queued_path = path;
+	queued_check_digest = check_for_digest;
+	pthread_mutex_unlock(&queue_lock);
+}
+
+void TWinstall_Clear_Queue() {
+	pthread_mutex_lock(&queue_lock);
+	queued_path.clear();
+	Stop_Prefetch();
+	pthread_mutex_unlock(&queue_lock);
+}
+
+void TWinstall_Start_Prefetch(std::vector<Certificate> keys) {
+	pthread_mutex_lock(&queue_lock);
+	if (queued_path.empty()) {
+		pthread_mutex_unlock(&queue_lock);
+		return;
+	}
+	// an earlier prefetch that was never picked up is not going to be
+	Stop_Prefetch();
+
+	prefetch_result = new Prefetched_Package;
+	prefetch_result->path = queued_path;
+	prefetch_result->keys = std::move(keys);
+	prefetch_result->verified = false;
+	prefetch_result->verify_result = VERIFY_FAILURE;
+	prefetch_result->use_sha2 = false;
+	prefetch_check_digest = queued_check_digest;
+	prefetch_cancel.store(false);
+	queued_path.clear();
+
+	if (pthread_create(&prefetch_thread, NULL, Prefetch_Thread, prefetch_result) == 0) {
+		LOGINFO("Preparing '%s' in the background\n", prefetch_result->path.c_str());
+		prefetch_running = true;
+	} else {
+		delete prefetch_result;
+		prefetch_result = NULL;
+	}
+	pthread_mutex_unlock(&queue_lock);
+}
+
+std::unique_ptr<Prefetched_Package> TWinstall_Take_Prefetch(const std::string& path) {
+	std::unique_ptr<Prefetched_Package> ret;
+
+	pthread_mutex_lock(&queue_lock);
+	if (prefetch_running && prefetch_result->path == path) {
+		pthread_join(prefetch_thread, NULL);
+		prefetch_running = false;
+		ret.reset(prefetch_result);
+		prefetch_result = NULL;
+		if (!ret->package)
+			ret.reset();
+	}
+	pthread_mutex_unlock(&queue_lock);
+	return ret;
+}
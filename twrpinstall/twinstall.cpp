@@ -30,6 +30,7 @@
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -46,6 +47,7 @@
 #include "otautil/sysutil.h"
 #include <ziparchive/zip_archive.h>
 #include "twinstall/install.h"
+#include "twinstall/install_queue.h"
 #include "twinstall/verifier.h"
 #include "variables.h"
 #include "data.hpp"
@@ -397,6 +399,9 @@ int TWinstall_zip(const char *path, int *wipe_cache, bool check_for_digest)
 {
   int ret_val, zip_verify = 1, unmount_system = 1, unmount_vendor = 1;
   bool run_rom_scripts = false;
+  std::unique_ptr<twrpDigest> sidecar_digest;
+  string sidecar_digest_str, Full_Filename = path;
+  bool sidecar_sha2 = false;
 
   if (strcmp(path, "error") == 0)
     {
@@ -413,15 +418,15 @@ int TWinstall_zip(const char *path, int *wipe_cache, bool check_for_digest)
     {
 	gui_msg(Msg("installing_zip=Installing zip file '{1}'")(path));
 	if (strlen(path) < 9 || strncmp(path, "/sideload", 9) != 0) {
-		string digest_str;
-		string Full_Filename = path;
-
 		if (check_for_digest) {
 			gui_msg("check_for_digest=Checking for Digest file...");
-			if (*path != '@' && !twrpDigestDriver::Check_File_Digest(Full_Filename)) {
+			// the digest itself is computed below, in the same pass as the signature
+			twrpDigest* digest = NULL;
+			if (*path != '@' && !twrpDigestDriver::Open_Digest_File(Full_Filename, &digest, sidecar_digest_str, sidecar_sha2)) {
 				LOGERR("Aborting zip install: Digest verification failed\n");
 				return INSTALL_CORRUPT;
 			}
+			sidecar_digest.reset(digest);
 		}
 	}
     }
@@ -435,22 +440,49 @@ int TWinstall_zip(const char *path, int *wipe_cache, bool check_for_digest)
 
   DataManager::SetProgress(0);
 
-	auto package = Package::CreateMemoryPackage(path);
+	// a queued zip may already have been mapped and checked while the previous one was installing
+	std::unique_ptr<Package> package;
+	bool prefetch_verified = false, digest_done = false;
+	std::unique_ptr<Prefetched_Package> prefetched = TWinstall_Take_Prefetch(path);
+	if (prefetched) {
+		LOGINFO("Using the package prepared in the background\n");
+		package = std::move(prefetched->package);
+		prefetch_verified = prefetched->verified;
+		if (sidecar_digest && prefetched->digest && prefetched->use_sha2 == sidecar_sha2) {
+			sidecar_digest = std::move(prefetched->digest);
+			digest_done = true;
+		}
+	} else {
+		package = Package::CreateMemoryPackage(path);
+	}
 	if (!package) {
 		return INSTALL_CORRUPT;
 	}
 
+	std::vector<HasherUpdateCallback> digest_hashers;
+	if (sidecar_digest && !digest_done) {
+		twrpDigest* digest = sidecar_digest.get();
+		digest_hashers.emplace_back([digest](const uint8_t* addr, uint64_t size) { digest->update(addr, size); });
+	}
+
+	// the keys are loaded here even if the prefetch checked this zip already, the prefetch of
+	// the next zip gets them too, as otacerts.zip may not be readable while an installer runs
+	std::vector<Certificate> loaded_keys;
 	if (zip_verify) {
 		gui_msg("verify_zip_sig=Verifying zip signature...");
-		static constexpr const char* CERTIFICATE_ZIP_FILE = "/system/etc/security/otacerts.zip";
-		std::vector<Certificate> loaded_keys = LoadKeysFromZipfile(CERTIFICATE_ZIP_FILE);
+		loaded_keys = LoadKeysFromZipfile(OTA_CERTIFICATE_ZIP_FILE);
 		if (loaded_keys.empty()) {
 			LOGERR("Failed to load keys\n");
 			return -1;
 		}
-		LOGINFO("%zu key(s) loaded from %s\n", loaded_keys.size(), CERTIFICATE_ZIP_FILE);
+		LOGINFO("%zu key(s) loaded from %s\n", loaded_keys.size(), OTA_CERTIFICATE_ZIP_FILE);
 
-		ret_val = verify_file(package.get(), loaded_keys, std::bind(&DataManager::SetProgress, std::placeholders::_1));
+		if (prefetch_verified) {
+			ret_val = prefetched->verify_result;
+		} else {
+			ret_val = verify_file(package.get(), loaded_keys, std::bind(&DataManager::SetProgress, std::placeholders::_1), digest_hashers);
+			digest_done = true;
+		}
 		if (ret_val != VERIFY_SUCCESS) {
 			LOGINFO("Zip signature verification failed: %i\n", ret_val);
 			gui_err("verify_zip_fail=Zip signature verification failed!");
@@ -459,6 +491,25 @@ int TWinstall_zip(const char *path, int *wipe_cache, bool check_for_digest)
 			gui_msg("verify_zip_done=Zip signature verified successfully.");
 		}
     }
+
+	if (sidecar_digest && !digest_done) {
+		uint64_t package_size = package->GetPackageSize();
+		uint64_t so_far = 0;
+		while (so_far < package_size) {
+			uint64_t read_size = std::min<uint64_t>(package_size - so_far, 16 * MiB);
+			if (!package->UpdateHashAtOffset(digest_hashers, so_far, read_size)) {
+				LOGERR("Aborting zip install: Digest verification failed\n");
+				return INSTALL_CORRUPT;
+			}
+			so_far += read_size;
+			DataManager::SetProgress(so_far / static_cast<float>(package_size));
+		}
+	}
+
+	if (sidecar_digest && !twrpDigestDriver::Compare_Digest(Full_Filename, sidecar_digest.get(), sidecar_digest_str, sidecar_sha2)) {
+		LOGERR("Aborting zip install: Digest verification failed\n");
+		return INSTALL_CORRUPT;
+	}
     
     ZipArchiveHandle Zip = package->GetZipArchiveHandle();
     if (!Zip) {
@@ -515,6 +566,9 @@ int TWinstall_zip(const char *path, int *wipe_cache, bool check_for_digest)
 			CloseArchive(Zip);
 			ret_val = INSTALL_CORRUPT;
 		} else {
+			// this package is checked, get the next one in the queue ready while it installs.
+			// A/B zips do not get here, another zip can only be flashed after a reboot.
+			TWinstall_Start_Prefetch(std::move(loaded_keys));
 			ret_val = Prepare_Update_Binary(path, Zip);
 			if (ret_val == INSTALL_SUCCESS) {
 				usleep(32);
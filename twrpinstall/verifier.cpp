@@ -112,6 +112,12 @@ static bool read_pkcs7(const uint8_t* pkcs7_der, size_t pkcs7_der_len,
 
 int verify_file(VerifierInterface* package, const std::vector<Certificate>& keys,
   const std::function<void(float)>& set_progress) {
+  return verify_file(package, keys, set_progress, {});
+}
+
+int verify_file(VerifierInterface* package, const std::vector<Certificate>& keys,
+                const std::function<void(float)>& set_progress,
+                const std::vector<HasherUpdateCallback>& extra_hashers) {
   CHECK(package);
   package->SetProgress(0.0);
 
@@ -226,6 +232,7 @@ int verify_file(VerifierInterface* package, const std::vector<Certificate>& keys
     hashers.emplace_back(
         std::bind(&SHA256_Update, &sha256_ctx, std::placeholders::_1, std::placeholders::_2));
   }
+  hashers.insert(hashers.end(), extra_hashers.begin(), extra_hashers.end());
 
   double frac = -1.0;
   uint64_t so_far = 0;
@@ -246,6 +253,13 @@ int verify_file(VerifierInterface* package, const std::vector<Certificate>& keys
     }
   }
 
+  // The signature does not cover the tail of the EOCD, but a whole-file digest does.
+  if (!extra_hashers.empty() && so_far < length &&
+      !package->UpdateHashAtOffset(extra_hashers, so_far, length - so_far)) {
+    LOG(ERROR) << "Failed to read the unsigned tail of the package";
+    return VERIFY_FAILURE;
+  }
+
   uint8_t sha1[SHA_DIGEST_LENGTH];
   SHA1_Final(sha1, &sha1_ctx);
   uint8_t sha256[SHA256_DIGEST_LENGTH];